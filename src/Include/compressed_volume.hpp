@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+
+// A compressed volume is a disk image split into blocks of `block_bytes`,
+// each compressed separately in the LZ4 block format.
+// The header is followed by `block_count + 1` offsets (uint64_t, from the head
+// of the container); block i is stored in [offsets[i], offsets[i + 1]).
+// A block of size 0 is all zero, and one of `block_bytes` is stored as is.
+// tools/compress_volume.py makes one from a raw image.
+
+#define COMPRESSED_VOLUME_MAGIC "MIKANLZ4"
+
+struct CompressedVolumeHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t block_bytes;
+    uint64_t image_bytes;
+    uint64_t container_bytes;
+    uint32_t block_count;
+    uint32_t reserved;
+} __attribute__((packed));
+
+#ifdef __cplusplus
+
+const uint32_t kCompressedVolumeVersion = 1;
+
+inline bool IsCompressedVolume(const void *image) {
+    const auto header = reinterpret_cast<const CompressedVolumeHeader *>(image);
+    for (int i = 0; i < 8; ++i) {
+        if (header->magic[i] != COMPRESSED_VOLUME_MAGIC[i]) {
+            return false;
+        }
+    }
+    return header->version == kCompressedVolumeVersion;
+}
+
+#endif // __cplusplus
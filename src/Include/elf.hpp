@@ -48,3 +48,38 @@ typedef struct {
     Elf64_Xword p_memsz;
     Elf64_Xword p_align;
 } Elf64_Phdr;
+
+// p_flags
+#define PF_X 0x1
+#define PF_W 0x2
+#define PF_R 0x4
+
+typedef struct {
+    Elf64_Word sh_name;
+    Elf64_Word sh_type;
+    Elf64_Xword sh_flags;
+    Elf64_Addr sh_addr;
+    Elf64_Off sh_offset;
+    Elf64_Xword sh_size;
+    Elf64_Word sh_link; // for SHT_SYMTAB, the index of its string table
+    Elf64_Word sh_info;
+    Elf64_Xword sh_addralign;
+    Elf64_Xword sh_entsize;
+} Elf64_Shdr; // section header
+
+// sh_type
+#define SHT_SYMTAB 2
+#define SHT_STRTAB 3
+
+typedef struct {
+    Elf64_Word st_name; // offset in the string table
+    unsigned char st_info;
+    unsigned char st_other;
+    Elf64_Half st_shndx;
+    Elf64_Addr st_value;
+    Elf64_Xword st_size;
+} Elf64_Sym;
+
+#define ELF64_ST_TYPE(i) ((i) & 0xf)
+// st_info type
+#define STT_FUNC 2
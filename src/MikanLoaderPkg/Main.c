@@ -12,6 +12,7 @@
 #include "frame_buffer_config.hpp"
 #include "elf.hpp"
 #include "memory_map.hpp"
+#include "compressed_volume.hpp"
 
 
 #define CASE_STRING(memtype) case memtype: return L"" #memtype
@@ -444,6 +445,12 @@ EFI_STATUS EFIAPI UefiMain(
             Print(L"Failed to read volume file: %r\n", status);
             Halt();
         }
+        // a compressed volume is passed as is, and the kernel expands its blocks on demand
+        struct CompressedVolumeHeader *header = (struct CompressedVolumeHeader *)volume_image;
+        if (CompareMem(header->magic, COMPRESSED_VOLUME_MAGIC, sizeof(header->magic)) == 0) {
+            Print(L"Compressed volume: %lu bytes for %lu bytes image\n",
+                header->container_bytes, header->image_bytes);
+        }
     } else {
         // if fat_disk file is missing, read head 16MB with block io protocol
         EFI_BLOCK_IO_PROTOCOL *block_io;
@@ -0,0 +1 @@
+../Include/compressed_volume.hpp
\ No newline at end of file
@@ -1,32 +1,28 @@
-#include <cstring>
-#include <cstdlib>
+// utilities
+// rpn doesn't link libc, see Makefile
 
+int strcmp(const char *a, const char *b) {
+    int i = 0;
+    for (; a[i] != 0 && a[i] == b[i]; ++i) {
+    }
 
-// // utilities
-
-// int strcmp(const char *a, const char *b) {
-//     int i = 0;
-//     int diff = 0;
-
-//     for (; a[i] != 0 && b[i] != 0; ++i) {
-//         diff = a[i] - b[i];
-//         if (diff) {
-//             break;
-//         }
-//     }
-
-//     return diff;
-// }
+    return static_cast<unsigned char>(a[i]) - static_cast<unsigned char>(b[i]);
+}
 
-// // ascii to long
-// long atol(const char *s) {
-//     long v = 0;
-//     for (int i = 0; s[i] != 0; ++i) {
-//         v = v*10 + (s[i]-'0');
-//     }
+// ascii to long
+long atol(const char *s) {
+    long v = 0;
+    int i = 0;
+    bool negative = s[0] == '-';
+    if (negative) {
+        ++i;
+    }
+    for (; s[i] != 0; ++i) {
+        v = v*10 + (s[i]-'0');
+    }
 
-//     return v;
-// }
+    return negative ? -v : v;
+}
 
 
 // stack
@@ -0,0 +1,391 @@
+#include "address_space.hpp"
+
+#include <cstring>
+#include <algorithm>
+
+#include "asmfunc.h"
+#include "logger.hpp"
+#include "page_cache.hpp"
+#include "task.hpp"
+
+namespace {
+    const int kEntriesPerTable = 512;
+    // PML4 entries below this index are the kernel's
+    const int kUserPML4Start = 256;
+
+    WithError<PageMapEntry *> newPageMap() {
+        auto frame = frame_cache->Allocate();
+        if (frame.error) {
+            return {nullptr, frame.error};
+        }
+
+        auto e = reinterpret_cast<PageMapEntry *>(frame.value.Frame());
+        memset(e, 0, kBytesPerPage);
+        return {e, MAKE_ERROR(Error::kSuccess)};
+    }
+
+    void freeFrame(void *p) {
+        frame_cache->Free(FrameID{reinterpret_cast<uint64_t>(p) / kBytesPerFrame});
+    }
+
+    // freePageMap frees the table and everything below it
+    void freePageMap(PageMapEntry *table, int page_map_level) {
+        for (int i = 0; i < kEntriesPerTable; ++i) {
+            const auto &entry = table[i];
+            if (!entry.bits.present) {
+                continue;
+            }
+
+            if (page_map_level > 1) {
+                freePageMap(entry.Pointer(), page_map_level - 1);
+            } else if (!entry.bits.shared) {
+                freeFrame(entry.Pointer());
+            }
+        }
+
+        freeFrame(table);
+    }
+
+    void invalidatePage(uint64_t addr) {
+        __asm__ volatile("invlpg (%0)" :: "r"(addr) : "memory");
+    }
+
+    // address spaces alive, for DetachFile
+    std::vector<AddressSpace *> address_spaces;
+
+    // page fault error code
+    const uint64_t kPFPresent = 1u << 0; // 0: page not present
+    const uint64_t kPFWrite = 1u << 1; // 0: read access
+
+    bool overlaps(const FileRegion &region, uint64_t page_addr) {
+        return region.vaddr < page_addr + kBytesPerPage &&
+            page_addr < region.vaddr + region.memsz;
+    }
+
+    // copyRegionPage copies the file contents of `region` on the page into `page`
+    void copyRegionPage(uint8_t *page, uint64_t page_addr, const FileRegion &region) {
+        const uint64_t begin = std::max(page_addr, region.vaddr);
+        const uint64_t end = std::min(page_addr + kBytesPerPage, region.vaddr + region.filesz);
+        if (begin >= end) {
+            return;
+        }
+
+        region.file->Read(region.file_offset + (begin - region.vaddr),
+                          page + (begin - page_addr), end - begin);
+    }
+}
+
+AddressSpace::~AddressSpace() {
+    if (!pml4_) {
+        return;
+    }
+
+    address_spaces.erase(std::find(address_spaces.begin(), address_spaces.end(), this));
+
+    for (int i = kUserPML4Start; i < kEntriesPerTable; ++i) {
+        if (pml4_[i].bits.present) {
+            freePageMap(pml4_[i].Pointer(), 3);
+        }
+    }
+
+    freeFrame(pml4_);
+}
+
+Error AddressSpace::Initialize() {
+    auto [pml4, err] = newPageMap();
+    if (err) {
+        return err;
+    }
+    pml4_ = pml4;
+
+    // share the kernel half
+    const auto kernel_pml4 = KernelPML4();
+    for (int i = 0; i < kUserPML4Start; ++i) {
+        pml4_[i] = kernel_pml4[i];
+    }
+
+    address_spaces.push_back(this);
+    return MAKE_ERROR(Error::kSuccess);
+}
+
+uint64_t AddressSpace::CR3() const {
+    return reinterpret_cast<uint64_t>(pml4_);
+}
+
+WithError<PageMapEntry *> AddressSpace::setupEntry(uint64_t addr) {
+    if (addr < kUserBase) {
+        return {nullptr, MAKE_ERROR(Error::kIndexOutOfRange)};
+    }
+
+    LinearAddress4Level linear{addr};
+    PageMapEntry *table = pml4_;
+    for (int level = 4; level > 1; --level) {
+        auto &entry = table[linear.Part(level)];
+        if (!entry.bits.present) {
+            auto [child, err] = newPageMap();
+            if (err) {
+                return {nullptr, err};
+            }
+
+            entry.data = 0;
+            entry.SetPointer(child);
+            entry.bits.present = 1;
+            // permissions are decided by the last level
+            entry.bits.writable = 1;
+        }
+
+        table = entry.Pointer();
+    }
+
+    return {&table[linear.Part(1)], MAKE_ERROR(Error::kSuccess)};
+}
+
+PageMapEntry *AddressSpace::FindEntry(uint64_t addr) const {
+    if (addr < kUserBase) {
+        return nullptr;
+    }
+
+    LinearAddress4Level linear{addr};
+    PageMapEntry *table = pml4_;
+    for (int level = 4; level > 1; --level) {
+        const auto &entry = table[linear.Part(level)];
+        if (!entry.bits.present) {
+            return nullptr;
+        }
+
+        table = entry.Pointer();
+    }
+
+    auto entry = &table[linear.Part(1)];
+    return entry->bits.present ? entry : nullptr;
+}
+
+Error AddressSpace::MapPage(uint64_t addr, FrameID frame, bool writable, bool shared) {
+    auto [entry, err] = setupEntry(addr);
+    if (err) {
+        return err;
+    }
+
+    const bool remap = entry->bits.present;
+    entry->data = 0;
+    entry->SetPointer(reinterpret_cast<PageMapEntry *>(frame.Frame()));
+    entry->bits.present = 1;
+    entry->bits.writable = writable;
+    entry->bits.shared = shared;
+
+    if (remap && GetCR3() == CR3()) {
+        invalidatePage(addr);
+    }
+
+    return MAKE_ERROR(Error::kSuccess);
+}
+
+WithError<FrameID> AddressSpace::AllocatePage(uint64_t addr, bool writable) {
+    auto frame = frame_cache->Allocate();
+    if (frame.error) {
+        return frame;
+    }
+
+    memset(frame.value.Frame(), 0, kBytesPerPage);
+    if (auto err = MapPage(addr, frame.value, writable, false)) {
+        frame_cache->Free(frame.value);
+        return {kNullFrame, err};
+    }
+
+    return frame;
+}
+
+Error AddressSpace::MapFile(const FileRegion &region) {
+    if (region.vaddr < kUserBase || region.vaddr + region.memsz < region.vaddr) {
+        return MAKE_ERROR(Error::kInvalidAddress);
+    }
+
+    regions_.push_back(region);
+    return MAKE_ERROR(Error::kSuccess);
+}
+
+FrameID AddressSpace::directFrame(uint64_t page_addr) const {
+    const FileRegion *found = nullptr;
+    for (const auto &region : regions_) {
+        if (!overlaps(region, page_addr)) {
+            continue;
+        }
+        if (found) {
+            return kNullFrame; // contents of two regions are merged into one page
+        }
+        found = &region;
+    }
+
+    // the page has to be filled by the file contents only
+    if (!found || page_addr < found->vaddr ||
+        found->vaddr + found->filesz < page_addr + kBytesPerPage) {
+        return kNullFrame;
+    }
+
+    auto p = found->file->Pointer(found->file_offset + (page_addr - found->vaddr), kBytesPerPage);
+    const auto addr = reinterpret_cast<uintptr_t>(p);
+    if (!p || addr % kBytesPerFrame != 0) {
+        return kNullFrame;
+    }
+    return FrameID{addr / kBytesPerFrame};
+}
+
+WithError<FrameID> AddressSpace::loadPage(uint64_t page_addr) {
+    // the volume image stays resident, so the page can be mapped in place
+    if (auto frame = directFrame(page_addr); frame.ID() != kNullFrame.ID()) {
+        return {frame, MAKE_ERROR(Error::kSuccess)};
+    }
+
+    unsigned long file_cluster = 0;
+    bool file_backed = false;
+    for (const auto &region : regions_) {
+        if (region.vaddr < page_addr + kBytesPerPage &&
+            page_addr < region.vaddr + region.filesz) {
+            file_cluster = region.file->FirstCluster();
+            file_backed = true;
+            break;
+        }
+    }
+
+    if (file_backed) {
+        if (auto frame = page_cache->Find(file_cluster, page_addr); frame.ID() != kNullFrame.ID()) {
+            return {frame, MAKE_ERROR(Error::kSuccess)};
+        }
+    }
+
+    auto frame = frame_cache->Allocate();
+    if (frame.error) {
+        return frame;
+    }
+
+    auto page = reinterpret_cast<uint8_t *>(frame.value.Frame());
+    memset(page, 0, kBytesPerPage);
+    for (const auto &region : regions_) {
+        if (overlaps(region, page_addr)) {
+            copyRegionPage(page, page_addr, region);
+        }
+    }
+
+    if (file_backed) {
+        page_cache->Insert(file_cluster, page_addr, frame.value);
+    }
+    return frame;
+}
+
+Error AddressSpace::copyOnWrite(uint64_t page_addr, PageMapEntry &entry) {
+    auto frame = frame_cache->Allocate();
+    if (frame.error) {
+        return frame.error;
+    }
+
+    memcpy(frame.value.Frame(), entry.Pointer(), kBytesPerPage);
+    // the old frame is shared (page cache), so it's not freed here
+    return MapPage(page_addr, frame.value, true, false);
+}
+
+Error AddressSpace::HandlePageFault(uint64_t error_code, uint64_t addr) {
+    const uint64_t page_addr = addr & ~(kBytesPerPage - 1);
+    bool in_region = false, writable = false, file_backed = false;
+    for (const auto &region : regions_) {
+        if (overlaps(region, page_addr)) {
+            in_region = true;
+            writable |= region.writable;
+            file_backed |= page_addr < region.vaddr + region.filesz;
+        }
+    }
+
+    if (!in_region) {
+        return MAKE_ERROR(Error::kInvalidAddress);
+    }
+
+    const bool write = error_code & kPFWrite;
+    if (write && !writable) {
+        return MAKE_ERROR(Error::kInvalidAddress);
+    }
+
+    if (error_code & kPFPresent) {
+        // protection violation on a present page: only copy-on-write is legal
+        auto entry = FindEntry(page_addr);
+        if (!entry || !entry->bits.copy_on_write) {
+            return MAKE_ERROR(Error::kInvalidAddress);
+        }
+        return copyOnWrite(page_addr, *entry);
+    }
+
+    if (!file_backed) {
+        // bss only
+        return AllocatePage(page_addr, writable).error;
+    }
+
+    auto [frame, err] = loadPage(page_addr);
+    if (err) {
+        return err;
+    }
+    if (auto err = MapPage(page_addr, frame, false, true)) {
+        return err;
+    }
+
+    if (!writable) {
+        return MAKE_ERROR(Error::kSuccess);
+    }
+
+    auto entry = FindEntry(page_addr);
+    entry->bits.copy_on_write = 1;
+    if (write) {
+        return copyOnWrite(page_addr, *entry);
+    }
+
+    return MAKE_ERROR(Error::kSuccess);
+}
+
+void AddressSpace::DetachFile(unsigned long file_cluster) {
+    for (const auto &region : regions_) {
+        if (region.file->FirstCluster() != file_cluster) {
+            continue;
+        }
+
+        for (uint64_t page_addr = region.vaddr & ~(kBytesPerPage - 1);
+             page_addr < region.vaddr + region.filesz;
+             page_addr += kBytesPerPage) {
+            auto entry = FindEntry(page_addr);
+            if (!entry) {
+                // load the old contents while they are still there
+                if (auto err = HandlePageFault(0, page_addr)) {
+                    Log(kLogMemory, kError, "failed to detach page %lx: %s\n", page_addr, err.Name());
+                    continue;
+                }
+                entry = FindEntry(page_addr);
+            }
+
+            const auto frame = directFrame(page_addr);
+            if (frame.ID() == kNullFrame.ID() || entry->bits.addr != frame.ID()) {
+                // a copy (page cache or private), which is not affected
+                continue;
+            }
+
+            auto copy = frame_cache->Allocate();
+            if (copy.error) {
+                Log(kLogMemory, kError, "failed to detach page %lx: %s\n", page_addr, copy.error.Name());
+                continue;
+            }
+            memcpy(copy.value.Frame(), frame.Frame(), kBytesPerPage);
+            MapPage(page_addr, copy.value, region.writable, false);
+        }
+    }
+}
+
+
+Error HandlePageFault(uint64_t error_code, uint64_t addr) {
+    auto as = task_manager->CurrentTask().GetAddressSpace();
+    if (!as) {
+        return MAKE_ERROR(Error::kInvalidAddress);
+    }
+
+    return as->HandlePageFault(error_code, addr);
+}
+
+void DetachFile(unsigned long file_cluster) {
+    for (auto as : address_spaces) {
+        as->DetachFile(file_cluster);
+    }
+}
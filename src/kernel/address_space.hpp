@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <memory>
+
+#include "error.hpp"
+#include "memory_manager.hpp"
+#include "paging.hpp"
+#include "fat.hpp"
+
+// FileRegion is a part of a file mapped to an address space,
+// such as a PT_LOAD segment. Pages are loaded on the first touch.
+struct FileRegion {
+    uint64_t vaddr, memsz; // bytes after filesz are zero filled
+    uint64_t file_offset, filesz;
+    bool writable;
+    std::shared_ptr<const fat::ExtentMap> file;
+};
+
+// AddressSpace is a page map (PML4) owned by one application.
+// The lower half (PML4 entries 0-255) is shared with the kernel identity map,
+// and the upper half is private to the application.
+// Apps are linked in its top 2 GiB (0xffffffff80000000) with -mcmodel=kernel.
+class AddressSpace {
+public:
+    // start of the application half (canonical upper half)
+    static const uint64_t kUserBase = 0xffff800000000000;
+
+    AddressSpace() = default;
+    ~AddressSpace();
+    AddressSpace(const AddressSpace &) = delete;
+    AddressSpace &operator =(const AddressSpace &) = delete;
+
+    Error Initialize();
+    // CR3 returns the value to be set to CR3 to activate this address space
+    uint64_t CR3() const;
+
+    // MapPage maps `frame` at page aligned `addr`.
+    // shared frames are not freed when the address space is destroyed.
+    Error MapPage(uint64_t addr, FrameID frame, bool writable, bool shared);
+    // AllocatePage maps a newly allocated, zero filled frame at `addr`
+    WithError<FrameID> AllocatePage(uint64_t addr, bool writable);
+    // FindEntry returns the page table entry for `addr`, or nullptr if not mapped
+    PageMapEntry *FindEntry(uint64_t addr) const;
+
+    // MapFile registers the region. Nothing is loaded until it's accessed.
+    // It's only for PT_LOAD segments now: apps have no system call to map
+    // a file themselves.
+    Error MapFile(const FileRegion &region);
+    // HandlePageFault loads the page or resolves copy-on-write
+    Error HandlePageFault(uint64_t error_code, uint64_t addr);
+    // DetachFile is called before the file is written or deleted. Pages of
+    // the file mapped in place are replaced by private copies, and pages not
+    // loaded yet are loaded, so the app keeps seeing the old contents.
+    void DetachFile(unsigned long file_cluster);
+
+private:
+    PageMapEntry *pml4_{nullptr};
+    std::vector<FileRegion> regions_{};
+
+    WithError<PageMapEntry *> setupEntry(uint64_t addr);
+    // loadPage fills a page from the file regions covering it,
+    // sharing it through page_cache
+    WithError<FrameID> loadPage(uint64_t page_addr);
+    // directFrame returns the frame of the volume image holding the page,
+    // or kNullFrame if the page has to be copied
+    FrameID directFrame(uint64_t page_addr) const;
+    Error copyOnWrite(uint64_t page_addr, PageMapEntry &entry);
+};
+
+// HandlePageFault forwards a #PF to the address space of the current task
+Error HandlePageFault(uint64_t error_code, uint64_t addr);
+// DetachFile calls AddressSpace::DetachFile on every address space
+void DetachFile(unsigned long file_cluster);
@@ -16,6 +16,19 @@ IoIn32:
     in eax, dx
     ret
 
+global IoOut8 ; void IoOut8(uint16_t addr, uint8_t data)
+IoOut8:
+    mov dx, di ; dx = addr
+    mov al, sil ; al = data
+    out dx, al
+    ret
+
+global IoIn8 ; uint8_t IoIn8(uint16_t addr)
+IoIn8:
+    mov dx, di ; dx = addr
+    in al, dx
+    ret
+
 global GetCS ; uint64_t GetCS(void)
 GetCS:
     xor eax, eax
@@ -79,6 +92,11 @@ SetCSSS:
     pop rbp
     ret
 
+global LoadTR ; void LoadTR(uint16_t sel)
+LoadTR:
+    ltr di
+    ret
+
 global SetCR3 ; void SetCR3(uint64_t value)
 SetCR3:
     mov cr3, rdi
@@ -89,6 +107,43 @@ GetCR3:
     mov rax, cr3
     ret
 
+global GetCR2 ; uint64_t GetCR2()
+GetCR2:
+    mov rax, cr2
+    ret
+
+global GetCR0 ; uint64_t GetCR0()
+GetCR0:
+    mov rax, cr0
+    ret
+
+global SetCR0 ; void SetCR0(uint64_t value)
+SetCR0:
+    mov cr0, rdi
+    ret
+
+global ReadMSR ; uint64_t ReadMSR(uint32_t msr)
+ReadMSR:
+    mov ecx, edi
+    rdmsr ; edx:eax = MSR[ecx]
+    shl rdx, 32
+    or rax, rdx
+    ret
+
+global WriteMSR ; void WriteMSR(uint32_t msr, uint64_t value)
+WriteMSR:
+    mov ecx, edi
+    mov eax, esi ; lower 32bit
+    mov rdx, rsi
+    shr rdx, 32 ; upper 32bit
+    wrmsr ; MSR[ecx] = edx:eax
+    ret
+
+global WriteBackInvalidateCache ; void WriteBackInvalidateCache()
+WriteBackInvalidateCache:
+    wbinvd
+    ret
+
 global SwitchContext ; void SwitchContext(void *next_ctx, void *current_ctx)
 SwitchContext:
     ; save current context
@@ -166,3 +221,138 @@ SwitchContext:
     mov rdi, [rdi+0x60]
 
     o64 iret
+
+global CallApp ; int CallApp(int argc, char **argv, uint64_t entry, uint64_t *os_stack_ptr)
+CallApp:
+    ; callee-saved registers, restored by both return paths
+    push rbx
+    push rbp
+    push r12
+    push r13
+    push r14
+    push r15
+    sub rsp, 8 ; align stack for the call
+    mov [rcx], rsp ; ExitApp unwinds to here
+    call rdx ; entry(argc, argv)
+.exit:
+    add rsp, 8
+    pop r15
+    pop r14
+    pop r13
+    pop r12
+    pop rbp
+    pop rbx
+    ret
+
+global ExitApp ; void ExitApp(uint64_t rsp, int32_t ret_val)
+ExitApp:
+    mov rsp, rdi
+    mov eax, esi
+    jmp CallApp.exit
+
+; exception entries. the CPU pushes an error code only for some vectors,
+; push a dummy one for the others to keep the same frame layout.
+%macro EXCEPTION_ENTRY 1
+ExceptionEntry%1:
+    push 0 ; error code
+    push %1 ; vector
+    jmp ExceptionCommon
+%endmacro
+
+%macro EXCEPTION_ENTRY_ERRCODE 1
+ExceptionEntry%1:
+    push %1 ; vector
+    jmp ExceptionCommon
+%endmacro
+
+EXCEPTION_ENTRY 0 ; #DE
+EXCEPTION_ENTRY 1 ; #DB
+EXCEPTION_ENTRY 2 ; NMI
+EXCEPTION_ENTRY 3 ; #BP
+EXCEPTION_ENTRY 4 ; #OF
+EXCEPTION_ENTRY 5 ; #BR
+EXCEPTION_ENTRY 6 ; #UD
+EXCEPTION_ENTRY 7 ; #NM
+EXCEPTION_ENTRY_ERRCODE 8 ; #DF
+EXCEPTION_ENTRY 9
+EXCEPTION_ENTRY_ERRCODE 10 ; #TS
+EXCEPTION_ENTRY_ERRCODE 11 ; #NP
+EXCEPTION_ENTRY_ERRCODE 12 ; #SS
+EXCEPTION_ENTRY_ERRCODE 13 ; #GP
+EXCEPTION_ENTRY_ERRCODE 14 ; #PF
+EXCEPTION_ENTRY 15
+EXCEPTION_ENTRY 16 ; #MF
+EXCEPTION_ENTRY_ERRCODE 17 ; #AC
+EXCEPTION_ENTRY 18 ; #MC
+EXCEPTION_ENTRY 19 ; #XM
+EXCEPTION_ENTRY 20 ; #VE
+EXCEPTION_ENTRY_ERRCODE 21 ; #CP
+EXCEPTION_ENTRY 22
+EXCEPTION_ENTRY 23
+EXCEPTION_ENTRY 24
+EXCEPTION_ENTRY 25
+EXCEPTION_ENTRY 26
+EXCEPTION_ENTRY 27
+EXCEPTION_ENTRY 28 ; #HV
+EXCEPTION_ENTRY_ERRCODE 29 ; #VC
+EXCEPTION_ENTRY_ERRCODE 30 ; #SX
+EXCEPTION_ENTRY 31
+
+extern HandleException
+
+; stack: ExceptionFrame (see exception.hpp)
+ExceptionCommon:
+    push rax
+    push rbx
+    push rcx
+    push rdx
+    push rsi
+    push rdi
+    push rbp
+    push r8
+    push r9
+    push r10
+    push r11
+    push r12
+    push r13
+    push r14
+    push r15
+
+    mov rdi, rsp ; ExceptionFrame *
+    mov rbx, rsp
+    ; handlers use SSE, keep the interrupted FPU state
+    sub rsp, 512
+    and rsp, -16
+    fxsave [rsp]
+    cld
+    call HandleException ; HandleException(ExceptionFrame *)
+    fxrstor [rsp]
+    mov rsp, rbx
+
+    pop r15
+    pop r14
+    pop r13
+    pop r12
+    pop r11
+    pop r10
+    pop r9
+    pop r8
+    pop rbp
+    pop rdi
+    pop rsi
+    pop rdx
+    pop rcx
+    pop rbx
+    pop rax
+    add rsp, 16 ; vector, error code
+    o64 iret
+
+section .data
+
+global exception_entries ; uint64_t exception_entries[32]
+exception_entries:
+%assign i 0
+%rep 32
+    dq ExceptionEntry %+ i
+%assign i i+1
+%endrep
@@ -5,6 +5,8 @@
 extern "C" {
     void IoOut32(uint16_t addr, uint32_t data);
     uint32_t IoIn32(uint16_t addr);
+    void IoOut8(uint16_t addr, uint8_t data);
+    uint8_t IoIn8(uint16_t addr);
     // get current code segment selector value
     uint64_t GetCS(void);
     // load Interrupt Descriptor Table register
@@ -16,11 +18,34 @@ extern "C" {
     void SetDSAll(uint16_t value);
     // set cs and ss
     void SetCSSS(uint16_t cs, uint16_t ss);
+    // load task register
+    void LoadTR(uint16_t sel);
 
     // set page table
     void SetCR3(uint64_t value);
 
     uint64_t GetCR3();
 
+    // page fault linear address
+    uint64_t GetCR2();
+
+    uint64_t GetCR0();
+    void SetCR0(uint64_t value);
+
+    // model specific register
+    uint64_t ReadMSR(uint32_t msr);
+    void WriteMSR(uint32_t msr, uint64_t value);
+    // write back and invalidate all caches
+    void WriteBackInvalidateCache();
+
     void SwitchContext(void *next_ctx, void *current_ctx);
+
+    // CallApp calls the app entry, saving the stack pointer to `os_stack_ptr`
+    // so that ExitApp can return from it at any point of the app.
+    int CallApp(int argc, char **argv, uint64_t entry, uint64_t *os_stack_ptr);
+    // ExitApp makes the CallApp which saved `rsp` return `ret_val`
+    void ExitApp(uint64_t rsp, int32_t ret_val);
+
+    // entry points of the CPU exceptions, indexed by vector
+    extern uint64_t exception_entries[32];
 }
@@ -0,0 +1,392 @@
+#include "block.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <vector>
+
+#include "lz4.hpp"
+
+namespace block {
+
+namespace {
+    // BusyGuard takes `busy` if it's free, and never waits for it
+    class BusyGuard {
+    public:
+        explicit BusyGuard(std::atomic<bool> &busy)
+            : busy_{busy}, acquired_{!busy.exchange(true, std::memory_order_acquire)} {}
+        ~BusyGuard() {
+            if (acquired_) {
+                busy_.store(false, std::memory_order_release);
+            }
+        }
+        bool Acquired() const { return acquired_; }
+
+    private:
+        std::atomic<bool> &busy_;
+        const bool acquired_;
+    };
+}
+
+RamDisk::RamDisk(void *image, uint64_t sectors)
+    : image_{reinterpret_cast<uint8_t *>(image)}, sectors_{sectors} {}
+
+Error RamDisk::Read(uint64_t lba, void *buf, size_t sectors) {
+    auto p = Map(lba, sectors);
+    if (!p) {
+        return MAKE_ERROR(Error::kIndexOutOfRange);
+    }
+    memcpy(buf, p, sectors * kSectorBytes);
+    return MAKE_ERROR(Error::kSuccess);
+}
+
+Error RamDisk::Write(uint64_t lba, const void *buf, size_t sectors) {
+    auto p = Map(lba, sectors);
+    if (!p) {
+        return MAKE_ERROR(Error::kIndexOutOfRange);
+    }
+    memcpy(p, buf, sectors * kSectorBytes);
+    return MAKE_ERROR(Error::kSuccess);
+}
+
+uint64_t RamDisk::Sectors() const {
+    return sectors_;
+}
+
+uint8_t *RamDisk::Map(uint64_t lba, size_t sectors) {
+    if (lba > sectors_ || sectors > sectors_ - lba) {
+        return nullptr;
+    }
+    return image_ + lba * kSectorBytes;
+}
+
+CompressedDisk::CompressedDisk(const void *container)
+    : container_{reinterpret_cast<const uint8_t *>(container)},
+      header_{*reinterpret_cast<const CompressedVolumeHeader *>(container)},
+      offsets_{reinterpret_cast<const uint64_t *>(container_ + sizeof(CompressedVolumeHeader))},
+      block_buf_{new uint8_t[header_.block_bytes]} {}
+
+bool CompressedDisk::Valid() const {
+    const uint64_t bytes = header_.block_bytes;
+    if (!IsCompressedVolume(container_) || bytes == 0 || bytes % kSectorBytes != 0 ||
+        header_.image_bytes % kSectorBytes != 0 ||
+        header_.image_bytes > header_.block_count * bytes) {
+        return false;
+    }
+
+    const uint64_t data_start = sizeof(CompressedVolumeHeader) +
+        (header_.block_count + 1) * sizeof(uint64_t);
+    // the offset table must be inside the container before it's read
+    if (data_start > header_.container_bytes ||
+        offsets_[0] < data_start || offsets_[header_.block_count] > header_.container_bytes) {
+        return false;
+    }
+    for (uint32_t i = 0; i < header_.block_count; ++i) {
+        if (offsets_[i] > offsets_[i + 1]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+Error CompressedDisk::Read(uint64_t lba, void *buf, size_t sectors) {
+    if (lba > Sectors() || sectors > Sectors() - lba) {
+        return MAKE_ERROR(Error::kIndexOutOfRange);
+    }
+
+    const size_t block_bytes = header_.block_bytes;
+    auto dst = reinterpret_cast<uint8_t *>(buf);
+    uint64_t offset = lba * kSectorBytes;
+    size_t len = sectors * kSectorBytes;
+    while (len > 0) {
+        const size_t in_block = offset % block_bytes;
+        const size_t n = std::min(len, block_bytes - in_block);
+        if (n == block_bytes) {
+            // whole blocks are expanded in place
+            if (auto err = expand(offset / block_bytes, dst)) {
+                return err;
+            }
+        } else {
+            if (auto err = expand(offset / block_bytes, block_buf_.get())) {
+                return err;
+            }
+            memcpy(dst, block_buf_.get() + in_block, n);
+        }
+        dst += n;
+        offset += n;
+        len -= n;
+    }
+    return MAKE_ERROR(Error::kSuccess);
+}
+
+Error CompressedDisk::Write(uint64_t lba, const void *buf, size_t sectors) {
+    if (lba > Sectors() || sectors > Sectors() - lba) {
+        return MAKE_ERROR(Error::kIndexOutOfRange);
+    }
+
+    const size_t block_bytes = header_.block_bytes;
+    auto src = reinterpret_cast<const uint8_t *>(buf);
+    uint64_t offset = lba * kSectorBytes;
+    size_t len = sectors * kSectorBytes;
+    while (len > 0) {
+        const uint64_t index = offset / block_bytes;
+        const size_t in_block = offset % block_bytes;
+        const size_t n = std::min(len, block_bytes - in_block);
+
+        auto &block = written_[index];
+        if (!block) {
+            block.reset(new uint8_t[block_bytes]);
+            if (n != block_bytes) {
+                if (auto err = expand(index, block.get())) {
+                    written_.erase(index);
+                    return err;
+                }
+            }
+        }
+        memcpy(block.get() + in_block, src, n);
+        src += n;
+        offset += n;
+        len -= n;
+    }
+    return MAKE_ERROR(Error::kSuccess);
+}
+
+uint64_t CompressedDisk::Sectors() const {
+    return header_.image_bytes / kSectorBytes;
+}
+
+Error CompressedDisk::expand(uint64_t index, uint8_t *buf) {
+    const size_t block_bytes = header_.block_bytes;
+    if (auto it = written_.find(index); it != written_.end()) {
+        memcpy(buf, it->second.get(), block_bytes);
+        return MAKE_ERROR(Error::kSuccess);
+    }
+
+    const uint64_t size = offsets_[index + 1] - offsets_[index];
+    const uint8_t *data = container_ + offsets_[index];
+    if (size == 0) {
+        memset(buf, 0, block_bytes);
+    } else if (size == block_bytes) {
+        memcpy(buf, data, block_bytes);
+    } else {
+        auto [n, err] = lz4::Decompress(data, size, buf, block_bytes);
+        if (err) {
+            return err;
+        }
+        if (n != block_bytes) {
+            return MAKE_ERROR(Error::kInvalidFile);
+        }
+    }
+    ++expanded_blocks_;
+    return MAKE_ERROR(Error::kSuccess);
+}
+
+
+Cache::Cache(Device &device, size_t capacity_blocks, size_t read_ahead_blocks)
+    : device_{device},
+      capacity_{std::max<size_t>(capacity_blocks, 1)},
+      read_ahead_{std::clamp<size_t>(read_ahead_blocks, 1, capacity_)},
+      read_buf_{new uint8_t[read_ahead_ * kBlockBytes]} {}
+
+Error Cache::Read(uint64_t offset, void *buf, size_t len) {
+    if (auto p = Pointer(offset, len)) {
+        memcpy(buf, p, len);
+        return MAKE_ERROR(Error::kSuccess);
+    }
+
+    BusyGuard guard{busy_};
+    if (!guard.Acquired()) {
+        return MAKE_ERROR(Error::kDeadlock); // reentered, see Cache in block.hpp
+    }
+    auto dst = reinterpret_cast<uint8_t *>(buf);
+    while (len > 0) {
+        const size_t in_block = offset % kBlockBytes;
+        const size_t n = std::min(len, kBlockBytes - in_block);
+        auto [block, err] = getBlock(offset / kBlockBytes);
+        if (err) {
+            return err;
+        }
+
+        memcpy(dst, block->data.get() + in_block, n);
+        dst += n;
+        offset += n;
+        len -= n;
+    }
+
+    return MAKE_ERROR(Error::kSuccess);
+}
+
+Error Cache::Write(uint64_t offset, const void *buf, size_t len) {
+    if (auto p = Pointer(offset, len)) {
+        memcpy(p, buf, len);
+        return MAKE_ERROR(Error::kSuccess);
+    }
+
+    BusyGuard guard{busy_};
+    if (!guard.Acquired()) {
+        return MAKE_ERROR(Error::kDeadlock);
+    }
+    auto src = reinterpret_cast<const uint8_t *>(buf);
+    while (len > 0) {
+        const size_t in_block = offset % kBlockBytes;
+        const size_t n = std::min(len, kBlockBytes - in_block);
+        auto [block, err] = getBlock(offset / kBlockBytes);
+        if (err) {
+            return err;
+        }
+
+        memcpy(block->data.get() + in_block, src, n);
+        if (!block->dirty) {
+            block->dirty = true;
+            ++dirty_blocks_;
+        }
+        src += n;
+        offset += n;
+        len -= n;
+    }
+
+    return MAKE_ERROR(Error::kSuccess);
+}
+
+Error Cache::Flush() {
+    if (dirty_blocks_ == 0) {
+        return MAKE_ERROR(Error::kSuccess);
+    }
+
+    BusyGuard guard{busy_};
+    if (!guard.Acquired()) {
+        return MAKE_ERROR(Error::kDeadlock);
+    }
+    std::vector<Block *> dirty;
+    for (auto &block : lru_) {
+        if (block.dirty) {
+            dirty.push_back(&block);
+        }
+    }
+    std::sort(dirty.begin(), dirty.end(), [](const Block *a, const Block *b) {
+        return a->index < b->index;
+    });
+
+    for (auto block : dirty) {
+        if (auto err = writeBack(*block)) {
+            return err;
+        }
+    }
+    return MAKE_ERROR(Error::kSuccess);
+}
+
+bool Cache::Prefetch(uint64_t offset, size_t len) {
+    if (len == 0 || Pointer(offset, len)) {
+        return true; // resident
+    }
+    BusyGuard guard{busy_};
+    if (!guard.Acquired()) {
+        ++prefetch_busy_;
+        return false;
+    }
+    for (uint64_t index = offset / kBlockBytes; index <= (offset + len - 1) / kBlockBytes; ++index) {
+        if (blocks_.count(index) != 0) {
+            continue;
+        }
+
+        const auto misses = misses_;
+        const auto read_ahead_blocks = read_ahead_blocks_;
+        if (getBlock(index).error) {
+            break;
+        }
+        // count them as prefetched, not as misses of readers
+        prefetched_blocks_ += 1 + (read_ahead_blocks_ - read_ahead_blocks);
+        misses_ = misses;
+        read_ahead_blocks_ = read_ahead_blocks;
+    }
+    return true;
+}
+
+uint8_t *Cache::Pointer(uint64_t offset, size_t len) const {
+    const uint64_t lba = offset / kSectorBytes;
+    const uint64_t lba_end = (offset + len + kSectorBytes - 1) / kSectorBytes;
+    auto p = device_.Map(lba, lba_end - lba);
+    return p ? p + offset % kSectorBytes : nullptr;
+}
+
+CacheStat Cache::Stat() const {
+    return {lru_.size(), capacity_, dirty_blocks_, hits_, misses_, read_ahead_blocks_, evictions_,
+            prefetched_blocks_, prefetch_busy_};
+}
+
+WithError<Cache::Block *> Cache::getBlock(uint64_t index) {
+    if (auto it = blocks_.find(index); it != blocks_.end()) {
+        ++hits_;
+        lru_.splice(lru_.begin(), lru_, it->second);
+        return {&*it->second, MAKE_ERROR(Error::kSuccess)};
+    }
+
+    ++misses_;
+    const uint64_t num_blocks = (device_.Sectors() + kSectorsPerBlock - 1) / kSectorsPerBlock;
+    if (index >= num_blocks) {
+        return {nullptr, MAKE_ERROR(Error::kIndexOutOfRange)};
+    }
+
+    // read ahead the following blocks not cached yet, in one request
+    size_t count = 1;
+    while (count < read_ahead_ && index + count < num_blocks &&
+           blocks_.count(index + count) == 0) {
+        ++count;
+    }
+
+    const uint64_t lba = index * kSectorsPerBlock;
+    const size_t sectors = std::min<uint64_t>(count * kSectorsPerBlock, device_.Sectors() - lba);
+    if (auto err = device_.Read(lba, read_buf_.get(), sectors)) {
+        return {nullptr, err};
+    }
+    memset(read_buf_.get() + sectors * kSectorBytes, 0, count * kBlockBytes - sectors * kSectorBytes);
+
+    // insert the requested block last to make it the most recently used
+    for (size_t i = count; i-- > 0;) {
+        if (auto err = insert(index + i, read_buf_.get() + i * kBlockBytes)) {
+            return {nullptr, err};
+        }
+    }
+    read_ahead_blocks_ += count - 1;
+
+    return {&lru_.front(), MAKE_ERROR(Error::kSuccess)};
+}
+
+Error Cache::insert(uint64_t index, const uint8_t *data) {
+    if (lru_.size() >= capacity_) {
+        // reuse the buffer of the least recently used block
+        if (auto err = writeBack(lru_.back())) {
+            return err;
+        }
+        lru_.splice(lru_.begin(), lru_, std::prev(lru_.end()));
+        blocks_.erase(lru_.front().index);
+        ++evictions_;
+    } else {
+        lru_.push_front({0, std::unique_ptr<uint8_t[]>{new uint8_t[kBlockBytes]}, false});
+    }
+
+    auto &block = lru_.front();
+    block.index = index;
+    block.dirty = false;
+    memcpy(block.data.get(), data, kBlockBytes);
+    blocks_[index] = lru_.begin();
+    return MAKE_ERROR(Error::kSuccess);
+}
+
+Error Cache::writeBack(Block &block) {
+    if (!block.dirty) {
+        return MAKE_ERROR(Error::kSuccess);
+    }
+
+    const uint64_t lba = block.index * kSectorsPerBlock;
+    const size_t sectors = std::min<uint64_t>(kSectorsPerBlock, device_.Sectors() - lba);
+    if (auto err = device_.Write(lba, block.data.get(), sectors)) {
+        return err;
+    }
+
+    block.dirty = false;
+    --dirty_blocks_;
+    return MAKE_ERROR(Error::kSuccess);
+}
+
+} // namespace block
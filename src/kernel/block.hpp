@@ -0,0 +1,137 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <unordered_map>
+
+#include "compressed_volume.hpp"
+#include "error.hpp"
+
+namespace block {
+
+const size_t kSectorBytes = 512;
+
+// Device is a disk addressed by 512 byte sectors
+class Device {
+public:
+    virtual ~Device() = default;
+
+    virtual Error Read(uint64_t lba, void *buf, size_t sectors) = 0;
+    virtual Error Write(uint64_t lba, const void *buf, size_t sectors) = 0;
+    virtual uint64_t Sectors() const = 0;
+    // Map returns the memory holding the sectors if the device is resident, or nullptr
+    virtual uint8_t *Map(uint64_t lba, size_t sectors) { return nullptr; }
+};
+
+// RamDisk is a device on memory, such as the volume image read by the loader
+class RamDisk : public Device {
+public:
+    RamDisk(void *image, uint64_t sectors);
+
+    Error Read(uint64_t lba, void *buf, size_t sectors) override;
+    Error Write(uint64_t lba, const void *buf, size_t sectors) override;
+    uint64_t Sectors() const override;
+    uint8_t *Map(uint64_t lba, size_t sectors) override;
+
+private:
+    uint8_t *image_;
+    uint64_t sectors_;
+};
+
+// CompressedDisk is a device on a compressed volume (compressed_volume.hpp).
+// A block is expanded on each read, so the device is used under a Cache.
+// Written blocks are kept expanded in memory, since the container can't grow.
+class CompressedDisk : public Device {
+public:
+    explicit CompressedDisk(const void *container);
+
+    // Valid checks the header and the block offsets
+    bool Valid() const;
+    Error Read(uint64_t lba, void *buf, size_t sectors) override;
+    Error Write(uint64_t lba, const void *buf, size_t sectors) override;
+    uint64_t Sectors() const override;
+
+    uint64_t ExpandedBlocks() const { return expanded_blocks_; }
+    size_t WrittenBlocks() const { return written_.size(); }
+
+private:
+    const uint8_t *container_;
+    const CompressedVolumeHeader &header_;
+    const uint64_t *offsets_;
+    std::unordered_map<uint64_t, std::unique_ptr<uint8_t[]>> written_{};
+    std::unique_ptr<uint8_t[]> block_buf_;
+    uint64_t expanded_blocks_{0};
+
+    // expand writes the block `index` to `buf` of header_.block_bytes
+    Error expand(uint64_t index, uint8_t *buf);
+};
+
+struct CacheStat {
+    size_t cached_blocks, capacity_blocks, dirty_blocks;
+    uint64_t hits, misses, read_ahead_blocks, evictions;
+    uint64_t prefetched_blocks, prefetch_busy;
+};
+
+// Cache keeps recently used blocks of a device in memory, evicting the least
+// recently used one when full. A miss reads the following blocks together.
+// Writes are kept in the cache until Flush or eviction (write-back).
+// Resident devices are read and written directly without caching.
+//
+// A Cache is not reentrant. Read, Write and Flush are called by one task,
+// and Prefetch by another one with interrupts disabled. busy_ is taken
+// without waiting: an operation started while another one is in progress
+// fails with kDeadlock (Prefetch returns false) and leaves the cache as is.
+// That happens if a #PF raised while copying to the caller's buffer loads
+// the page through fat, so buffers have to be mapped beforehand.
+class Cache {
+public:
+    static constexpr size_t kBlockBytes = 4096;
+    static constexpr size_t kSectorsPerBlock = kBlockBytes / kSectorBytes;
+
+    Cache(Device &device, size_t capacity_blocks, size_t read_ahead_blocks);
+    Cache(const Cache &) = delete;
+    Cache &operator =(const Cache &) = delete;
+
+    // Read copies `len` bytes from the byte `offset` of the device
+    Error Read(uint64_t offset, void *buf, size_t len);
+    // Write copies `len` bytes to the byte `offset` of the device
+    Error Write(uint64_t offset, const void *buf, size_t len);
+    // Flush writes all dirty blocks back to the device, in the order of the address
+    Error Flush();
+    // Prefetch loads the blocks of [offset, offset + len) for later reads.
+    // It's for a background task which runs it without being preempted:
+    // it returns false without loading if another operation is in progress.
+    bool Prefetch(uint64_t offset, size_t len);
+    // Pointer returns the resident memory of [offset, offset + len), or nullptr
+    uint8_t *Pointer(uint64_t offset, size_t len) const;
+
+    Device &GetDevice() const { return device_; }
+    CacheStat Stat() const;
+
+private:
+    struct Block {
+        uint64_t index;
+        std::unique_ptr<uint8_t[]> data;
+        bool dirty;
+    };
+
+    Device &device_;
+    const size_t capacity_, read_ahead_;
+    std::list<Block> lru_{}; // most recently used first
+    std::unordered_map<uint64_t, std::list<Block>::iterator> blocks_{};
+    std::unique_ptr<uint8_t[]> read_buf_;
+    size_t dirty_blocks_{0};
+    uint64_t hits_{0}, misses_{0}, read_ahead_blocks_{0}, evictions_{0};
+    uint64_t prefetched_blocks_{0}, prefetch_busy_{0};
+    // held while an operation uses read_buf_ or updates the cache
+    std::atomic<bool> busy_{false};
+
+    WithError<Block *> getBlock(uint64_t index);
+    Error insert(uint64_t index, const uint8_t *data);
+    Error writeBack(Block &block);
+};
+
+} // namespace block
@@ -0,0 +1,126 @@
+#include "channel.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include "message.hpp"
+#include "task.hpp"
+
+namespace {
+    std::atomic<uint64_t> next_channel_id{1};
+
+    size_t recordBytes(size_t len) {
+        return sizeof(ChannelRecord) + ((len + 7) & ~size_t{7});
+    }
+}
+
+WithError<std::shared_ptr<Channel>> Channel::Create(size_t num_frames, uint64_t reader) {
+    if (num_frames == 0) {
+        return {nullptr, MAKE_ERROR(Error::kBufferTooSmall)};
+    }
+
+    auto [frame, err] = memory_manager->Allocate(num_frames);
+    if (err) {
+        return {nullptr, err};
+    }
+    return {std::make_shared<Channel>(frame, num_frames, reader), MAKE_ERROR(Error::kSuccess)};
+}
+
+Channel::Channel(FrameID frame, size_t num_frames, uint64_t reader)
+    : id_{next_channel_id.fetch_add(1)},
+      frame_{frame}, num_frames_{num_frames}, reader_{reader},
+      capacity_{num_frames * kBytesPerFrame - sizeof(ChannelRing)},
+      ring_{*reinterpret_cast<ChannelRing *>(frame.Frame())},
+      records_{reinterpret_cast<uint8_t *>(frame.Frame()) + sizeof(ChannelRing)} {
+    memset(frame.Frame(), 0, num_frames * kBytesPerFrame);
+    ring_.capacity = capacity_;
+    ring_.doorbell_armed = 1; // the reader has nothing yet
+}
+
+Channel::~Channel() {
+    memory_manager->Free(frame_, num_frames_);
+}
+
+Error Channel::Write(const void *data, size_t len) {
+    const uint64_t capacity = capacity_;
+    const size_t bytes = recordBytes(len);
+    if (bytes > capacity) {
+        return MAKE_ERROR(Error::kBufferTooSmall);
+    }
+
+    uint64_t head = ring_.head.load(std::memory_order_relaxed);
+    const uint64_t tail = ring_.tail.load(std::memory_order_acquire);
+    const size_t to_end = capacity - head % capacity;
+    const size_t skip = bytes > to_end ? to_end : 0;
+    if (head + skip + bytes - tail > capacity) {
+        return MAKE_ERROR(Error::kFull);
+    }
+
+    if (skip) {
+        auto pad = reinterpret_cast<ChannelRecord *>(records_ + head % capacity);
+        *pad = {0, ChannelRecord::kPadding};
+        head += skip;
+    }
+    auto record = reinterpret_cast<ChannelRecord *>(records_ + head % capacity);
+    *record = {static_cast<uint32_t>(len), 0};
+    memcpy(record + 1, data, len);
+    ring_.head.store(head + bytes, std::memory_order_release);
+
+    if (ring_.doorbell_armed.exchange(0)) {
+        Message msg{Message::kChannel};
+        msg.arg.channel.id = id_;
+        task_manager->SendMessage(reader_, msg);
+    }
+    return MAKE_ERROR(Error::kSuccess);
+}
+
+void Channel::Reset() {
+    // the next Read finds it empty and arms the doorbell
+    ring_.tail.store(ring_.head.load(std::memory_order_acquire), std::memory_order_release);
+}
+
+WithError<size_t> Channel::Read(void *buf, size_t len) {
+    const uint64_t capacity = capacity_;
+    uint64_t tail = ring_.tail.load(std::memory_order_relaxed);
+
+    while (true) {
+        uint64_t head = ring_.head.load(std::memory_order_acquire);
+        if (tail == head) {
+            // arm, then look again: a record written before arming rings no doorbell
+            ring_.doorbell_armed.store(1);
+            head = ring_.head.load();
+            if (tail == head) {
+                return {0, MAKE_ERROR(Error::kEmpty)};
+            }
+        }
+
+        // records are within [tail, head), and never wrap around the end
+        const uint64_t used = head - tail;
+        const size_t to_end = capacity - tail % capacity;
+        if (used > capacity || tail % 8 != 0) {
+            return {0, MAKE_ERROR(Error::kIndexOutOfRange)};
+        }
+
+        const auto record = reinterpret_cast<const ChannelRecord *>(records_ + tail % capacity);
+        const ChannelRecord header = *record;
+        if (header.flags & ChannelRecord::kPadding) {
+            if (to_end > used) {
+                return {0, MAKE_ERROR(Error::kIndexOutOfRange)};
+            }
+            tail += to_end;
+            ring_.tail.store(tail, std::memory_order_release);
+            continue;
+        }
+
+        const size_t size = header.len;
+        if (recordBytes(size) > std::min<uint64_t>(used, to_end)) {
+            return {0, MAKE_ERROR(Error::kIndexOutOfRange)};
+        }
+        if (size > len) {
+            return {size, MAKE_ERROR(Error::kBufferTooSmall)};
+        }
+        memcpy(buf, record + 1, size);
+        ring_.tail.store(tail + recordBytes(size), std::memory_order_release);
+        return {size, MAKE_ERROR(Error::kSuccess)};
+    }
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "error.hpp"
+#include "memory_manager.hpp"
+
+// ChannelRing is the head of the shared frames of a channel.
+// Records follow it: a ChannelRecord and the payload padded to 8 bytes.
+// A record which doesn't fit before the end is put at the start, after
+// a padding record filling the rest.
+struct ChannelRing {
+    std::atomic<uint64_t> head; // bytes written, advanced by the writer
+    std::atomic<uint64_t> tail; // bytes read, advanced by the reader
+    // set by the reader when it found the ring empty;
+    // the writer clears it and rings the doorbell
+    std::atomic<uint32_t> doorbell_armed;
+    uint32_t reserved;
+    uint64_t capacity; // bytes of the record area, for information only
+    uint8_t padding[32];
+};
+static_assert(sizeof(ChannelRing) == 64);
+
+struct ChannelRecord {
+    static const uint32_t kPadding = 1;
+
+    uint32_t len;
+    uint32_t flags;
+};
+
+// Channel moves variable size records from one writer to one reader through
+// a ring in kernel frames. Only kernel code touches it: writers copy into it
+// and the reader copies out of it, the ring isn't mapped into apps.
+// When the reader has drained it, the next write sends a kChannel message
+// (the doorbell) to the reader task, which wakes it up.
+// Read checks the ring before trusting it, and never reads ChannelRing::capacity.
+class Channel {
+public:
+    // Create makes a channel of `num_frames` frames read by the task `reader`
+    static WithError<std::shared_ptr<Channel>> Create(size_t num_frames, uint64_t reader);
+
+    Channel(FrameID frame, size_t num_frames, uint64_t reader);
+    ~Channel();
+    Channel(const Channel &) = delete;
+    Channel &operator =(const Channel &) = delete;
+
+    uint64_t ID() const { return id_; }
+    uint64_t Reader() const { return reader_; }
+
+    // Write appends a record. kFull if there is no room for it now,
+    // kBufferTooSmall if it's larger than the ring.
+    Error Write(const void *data, size_t len);
+    // Read copies the oldest record to `buf` and returns its size.
+    // kEmpty arms the doorbell. kBufferTooSmall leaves the record and returns its size.
+    // kIndexOutOfRange if the ring is broken, which stays until Reset.
+    WithError<size_t> Read(void *buf, size_t len);
+    // Reset drops all the records, for the reader to go on after kIndexOutOfRange.
+    void Reset();
+
+private:
+    const uint64_t id_;
+    const FrameID frame_;
+    const size_t num_frames_;
+    const uint64_t reader_;
+    const uint64_t capacity_; // bytes of the record area
+    ChannelRing &ring_;
+    uint8_t *const records_;
+};
@@ -9,6 +9,15 @@ Console::Console(const PixelColor& fg_color, const PixelColor& bg_color)
 }
 
 void Console::PutString(const char* s) {
+    Render(s);
+
+    // if global layer_manager is available, refresh desktop
+    if (layer_manager) {
+        layer_manager->Draw(layer_id_);
+    }
+}
+
+void Console::Render(const char* s) {
     while (*s) {
         if (*s == '\n') {
             newLine();
@@ -20,11 +29,6 @@ void Console::PutString(const char* s) {
 
         ++s;
     }
-
-    // if global layer_manager is available, refresh desktop
-    if (layer_manager) {
-        layer_manager->Draw(layer_id_);
-    }
 }
 
 void Console::SetWriter(PixelWriter *writer) {
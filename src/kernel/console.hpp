@@ -12,6 +12,10 @@ public:
             const PixelColor& bg_color);
     
     void PutString(const char* s);
+    // Render writes s into the console window like PutString, but doesn't
+    // draw the layer. Tasks other than the main task use it and ask the main
+    // task to draw, since only the main task may touch the layer manager.
+    void Render(const char* s);
     void SetWriter(PixelWriter *writer);
     void SetWindow(const std::shared_ptr<Window> &window);
     void SetLayerID(unsigned int layer_id);
@@ -30,6 +30,9 @@ public:
         kNoPCIMSI,
         kUnknownPixelFormat,
         kNoSuchTask,
+        kInvalidFile,
+        kInvalidAddress,
+        kDeadlock,
         kLastOfCode,
     };
 
@@ -85,6 +88,9 @@ private:
         "kNoPCIMSI",
         "kUnknownPixelFormat",
         "kNoSuchTask",
+        "kInvalidFile",
+        "kInvalidAddress",
+        "kDeadlock",
     };
     static_assert(kLastOfCode == code_names_.size());
 };
@@ -0,0 +1,235 @@
+#include "exception.hpp"
+
+#include <algorithm>
+#include <vector>
+
+#include "asmfunc.h"
+#include "interrupt.hpp"
+#include "segment.hpp"
+#include "address_space.hpp"
+#include "task.hpp"
+#include "fat.hpp"
+#include "logger.hpp"
+#include "elf.hpp"
+
+// end of the kernel code, defined by the linker
+extern "C" const char _etext[];
+
+namespace {
+    // same as --image-base in Makefile
+    const uintptr_t kKernelBase = 0x100000;
+    const int kMaxBacktrace = 16;
+    // a frame further than this from the previous one is not trusted
+    const uint64_t kMaxFrameBytes = 1024 * 1024;
+
+    const char *exception_names[32] = {
+        "#DE divide error", "#DB debug", "NMI", "#BP breakpoint",
+        "#OF overflow", "#BR bound range", "#UD invalid opcode", "#NM device not available",
+        "#DF double fault", "coprocessor segment overrun", "#TS invalid TSS", "#NP segment not present",
+        "#SS stack fault", "#GP general protection", "#PF page fault", "reserved (15)",
+        "#MF x87 floating point", "#AC alignment check", "#MC machine check", "#XM SIMD floating point",
+        "#VE virtualization", "#CP control protection", "reserved (22)", "reserved (23)",
+        "reserved (24)", "reserved (25)", "reserved (26)", "reserved (27)",
+        "#HV hypervisor injection", "#VC VMM communication", "#SX security", "reserved (31)",
+    };
+
+    struct KernelSymbol {
+        uintptr_t addr;
+        uint64_t size;
+        uint32_t name; // offset in symbol_names
+    };
+
+    // sorted by addr
+    std::vector<KernelSymbol> symbols;
+    std::vector<char> symbol_names;
+
+    bool inKernelCode(uint64_t addr) {
+        return kKernelBase <= addr && addr < reinterpret_cast<uintptr_t>(_etext);
+    }
+
+    void printAddress(int index, uint64_t addr) {
+        uint64_t offset;
+        if (auto name = FindKernelSymbol(addr, &offset)) {
+            Log(kError, "  #%-2d %016lx %s+0x%lx\n", index, addr, name, offset);
+            return;
+        }
+        Log(kError, "  #%-2d %016lx %s\n", index, addr, inKernelCode(addr) ? "?" : "(app)");
+    }
+
+    // backtrace follows the rbp chain: [rbp] is the caller's rbp and
+    // [rbp+8] the return address. It stops at anything that doesn't look like
+    // a frame on the same stack, so a broken chain can't fault again.
+    void backtrace(const ExceptionFrame &frame) {
+        Log(kError, "backtrace:\n");
+        printAddress(0, frame.rip);
+
+        uint64_t prev = frame.rsp;
+        uint64_t rbp = frame.rbp;
+        for (int i = 1; i < kMaxBacktrace; ++i) {
+            if (rbp == 0 || rbp % 8 != 0 || rbp < prev || rbp - prev > kMaxFrameBytes) {
+                break;
+            }
+            const auto p = reinterpret_cast<const uint64_t *>(rbp);
+            const uint64_t ret_addr = p[1];
+            if (ret_addr == 0) {
+                break;
+            }
+            printAddress(i, ret_addr);
+            prev = rbp + 16;
+            rbp = p[0];
+        }
+    }
+
+    void dump(const ExceptionFrame &frame, Task *task) {
+        Log(kError, "\n%s (vector %lu, error %lx)",
+            exception_names[frame.vector], frame.vector, frame.error_code);
+        if (task) {
+            Log(kError, " on task %lu%s", task->ID(), task->GetAddressSpace() ? " (app)" : "");
+        }
+        Log(kError, "\n");
+        Log(kError, "RIP %016lx CS %04lx RFLAGS %08lx\n", frame.rip, frame.cs, frame.rflags);
+        Log(kError, "RSP %016lx SS %04lx CR2 %016lx CR3 %016lx\n",
+            frame.rsp, frame.ss, GetCR2(), GetCR3());
+        Log(kError, "RAX %016lx RBX %016lx RCX %016lx RDX %016lx\n",
+            frame.rax, frame.rbx, frame.rcx, frame.rdx);
+        Log(kError, "RSI %016lx RDI %016lx RBP %016lx R8  %016lx\n",
+            frame.rsi, frame.rdi, frame.rbp, frame.r8);
+        Log(kError, "R9  %016lx R10 %016lx R11 %016lx R12 %016lx\n",
+            frame.r9, frame.r10, frame.r11, frame.r12);
+        Log(kError, "R13 %016lx R14 %016lx R15 %016lx\n",
+            frame.r13, frame.r14, frame.r15);
+        backtrace(frame);
+    }
+
+    // killApp rewrites the frame to return to ExitApp, as if the app returned.
+    // Only faults in the app's own code are handled so; the kernel state
+    // is unknown after a fault in the kernel.
+    bool killApp(ExceptionFrame &frame, Task *task) {
+        if (!task || task->OSStackPointer() == 0 || inKernelCode(frame.rip)) {
+            return false;
+        }
+
+        Log(kError, "killed the app on task %lu\n", task->ID());
+        frame.rip = reinterpret_cast<uint64_t>(ExitApp);
+        frame.rdi = task->OSStackPointer();
+        frame.rsi = 128 + frame.vector;
+        frame.rsp = task->OSStackPointer();
+        frame.cs = kKernelCS;
+        frame.ss = kKernelSS;
+        frame.rflags = 0x202; // IF
+        return true;
+    }
+
+    void halt() {
+        // the log task won't run again
+        FlushLog();
+        while (true) {
+            __asm__("cli\n\thlt");
+        }
+    }
+
+    int istOf(int vector) {
+        switch (vector) {
+            case 2: case 8: case 18: // NMI, #DF, #MC
+                return kISTCritical;
+            case InterruptVector::kPageFault:
+                // demand paging is a normal path; it may nest in the others.
+                // it runs on the faulting task's stack (see kTerminalStackBytes)
+                return 0;
+            default:
+                return kISTFault;
+        }
+    }
+}
+
+const char *FindKernelSymbol(uintptr_t addr, uint64_t *offset) {
+    auto it = std::upper_bound(
+        symbols.begin(), symbols.end(), addr,
+        [](uintptr_t a, const KernelSymbol &sym) { return a < sym.addr; });
+    if (it == symbols.begin()) {
+        return nullptr;
+    }
+    --it;
+    if (addr >= it->addr + std::max<uint64_t>(it->size, 1)) {
+        return nullptr;
+    }
+    *offset = addr - it->addr;
+    return &symbol_names[it->name];
+}
+
+extern "C" void HandleException(ExceptionFrame *frame) {
+    IRQStatScope stat{static_cast<uint8_t>(frame->vector)};
+    if (frame->vector == InterruptVector::kPageFault) {
+        const auto addr = GetCR2();
+        auto err = HandlePageFault(frame->error_code, addr);
+        if (!err) {
+            return;
+        }
+        Log(kError, "#PF at %lx: %s\n", addr, err.Name());
+    }
+
+    Task *task = task_manager ? &task_manager->CurrentTask() : nullptr;
+    dump(*frame, task);
+
+    switch (frame->vector) {
+        case 1: case 2: case 3: // #DB, NMI, #BP: report and continue
+            return;
+    }
+    if (killApp(*frame, task)) {
+        return;
+    }
+    halt();
+}
+
+void InitializeExceptions() {
+    for (int vector = 0; vector < 32; ++vector) {
+        SetIDTEntry(idt[vector],
+                    MakeIDTAttr(DescriptorType::kInterruptGate, 0, true, istOf(vector)),
+                    exception_entries[vector], kKernelCS);
+    }
+}
+
+void LoadKernelSymbols() {
+    auto entry = fat::FindFile("/kernel.elf");
+    if (!entry) {
+        Log(kWarn, "kernel.elf not found, backtraces are not symbolized\n");
+        return;
+    }
+
+    Elf64_Ehdr ehdr;
+    if (fat::ReadFile(*entry, 0, &ehdr, sizeof(ehdr)) != sizeof(ehdr) ||
+        ehdr.e_shentsize != sizeof(Elf64_Shdr)) {
+        return;
+    }
+    std::vector<Elf64_Shdr> shdrs(ehdr.e_shnum);
+    const size_t shdrs_bytes = sizeof(Elf64_Shdr) * shdrs.size();
+    if (fat::ReadFile(*entry, ehdr.e_shoff, &shdrs[0], shdrs_bytes) != shdrs_bytes) {
+        return;
+    }
+
+    auto symtab = std::find_if(shdrs.begin(), shdrs.end(),
+                               [](const Elf64_Shdr &sh) { return sh.sh_type == SHT_SYMTAB; });
+    if (symtab == shdrs.end() || symtab->sh_link >= shdrs.size()) {
+        return;
+    }
+    const auto &strtab = shdrs[symtab->sh_link];
+
+    std::vector<Elf64_Sym> syms(symtab->sh_size / sizeof(Elf64_Sym));
+    if (syms.empty()) {
+        return;
+    }
+    symbol_names.resize(strtab.sh_size + 1);
+    fat::ReadFile(*entry, symtab->sh_offset, &syms[0], sizeof(Elf64_Sym) * syms.size());
+    fat::ReadFile(*entry, strtab.sh_offset, &symbol_names[0], strtab.sh_size);
+    symbol_names.back() = '\0';
+
+    for (const auto &sym : syms) {
+        if (ELF64_ST_TYPE(sym.st_info) == STT_FUNC && sym.st_value != 0 &&
+            sym.st_name < strtab.sh_size) {
+            symbols.push_back({sym.st_value, sym.st_size, sym.st_name});
+        }
+    }
+    std::sort(symbols.begin(), symbols.end(),
+              [](const KernelSymbol &a, const KernelSymbol &b) { return a.addr < b.addr; });
+    Log(kInfo, "%lu kernel symbols loaded\n", symbols.size());
+}
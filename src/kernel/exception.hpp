@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdint>
+
+// ExceptionFrame is the stack built by the exception entries in asmfunc.asm
+struct ExceptionFrame {
+    uint64_t r15, r14, r13, r12, r11, r10, r9, r8;
+    uint64_t rbp, rdi, rsi, rdx, rcx, rbx, rax;
+    uint64_t vector, error_code;
+    // pushed by the CPU
+    uint64_t rip, cs, rflags, rsp, ss;
+} __attribute__((packed));
+
+// InitializeExceptions installs the handlers of all CPU exceptions (0-31).
+// #PF runs on the current stack, the others on IST stacks.
+void InitializeExceptions();
+
+// LoadKernelSymbols reads the function symbols of /kernel.elf
+// to symbolize crash backtraces. Without them, addresses are printed raw.
+void LoadKernelSymbols();
+// FindKernelSymbol returns the name of the kernel function containing `addr`
+// and the offset in it, or nullptr.
+const char *FindKernelSymbol(uintptr_t addr, uint64_t *offset);
+
+extern "C" void HandleException(ExceptionFrame *frame);
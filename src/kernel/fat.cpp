@@ -2,27 +2,799 @@
 
 #include <cstring>
 #include <cctype>
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <set>
+#include <unordered_map>
 
 #include "logger.hpp"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 namespace fat {
 
+void updateDescriptors(const DirectoryEntry &entry, bool deleted);
+
 BPB *boot_volume_image;
 unsigned long bytes_per_cluster;
 
-void Initialize(void *volume_image) {
-    boot_volume_image = reinterpret_cast<fat::BPB *>(volume_image);
+namespace {
+    // 1 MiB of cache, and 32 KiB read at once on a miss
+    const size_t kCacheBlocks = 256;
+    const size_t kReadAheadBlocks = 8;
+    // read-ahead window of sequential readers, in clusters
+    const size_t kMinReadAheadClusters = 4;
+    const size_t kMaxReadAheadClusters = 64;
+    // the loader reads at most this much of the boot volume
+    const uint64_t kMaxImageBytes = 16 * 1024 * 1024;
+
+    block::Cache *cache;
+
+    // computed once in Initialize
+    uint8_t boot_sector[block::kSectorBytes];
+    uint64_t fat_offset; // fat #1
+    uint64_t data_offset; // cluster #2
+    // fat #1 if the device is resident, otherwise nullptr
+    const uint32_t *fat_table;
+
+    // FNV-1a of the upper cased name
+    uint32_t hashName(const char *name, size_t len) {
+        uint32_t hash = 2166136261u;
+        for (size_t i = 0; i < len; ++i) {
+            hash ^= static_cast<uint8_t>(toupper(name[i]));
+            hash *= 16777619u;
+        }
+        return hash;
+    }
+
+    bool nameEquals(const std::string &a, const char *b, size_t len) {
+        if (a.size() != len) {
+            return false;
+        }
+        for (size_t i = 0; i < len; ++i) {
+            if (toupper(a[i]) != toupper(b[i])) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    uint8_t shortNameChecksum(const DirectoryEntry &entry) {
+        uint8_t sum = 0;
+        for (int i = 0; i < 11; ++i) {
+            sum = ((sum & 1) ? 0x80 : 0) + (sum >> 1) + entry.name[i];
+        }
+        return sum;
+    }
+
+    // collects the parts of a long name while scanning entries
+    class LongNameBuilder {
+    public:
+        void Add(const LongNameEntry &lfn) {
+            const int index = (lfn.ord & 0x1f) - 1;
+            if (index < 0 || index >= kMaxEntries) {
+                // ord is corrupt
+                Reset();
+                return;
+            }
+            if (lfn.ord & 0x40) {
+                // the last part comes first
+                Reset();
+                length_ = index + 1;
+                checksum_ = lfn.checksum;
+            }
+            if (index >= length_ || lfn.checksum != checksum_) {
+                Reset();
+                return;
+            }
+
+            uint16_t chars[13];
+            memcpy(&chars[0], lfn.name1, sizeof(lfn.name1));
+            memcpy(&chars[5], lfn.name2, sizeof(lfn.name2));
+            memcpy(&chars[11], lfn.name3, sizeof(lfn.name3));
+            for (int i = 0; i < 13; ++i) {
+                // only ascii is supported
+                chars_[index * 13 + i] = chars[i] < 0x80 ? chars[i] : '?';
+                if (chars[i] == 0) {
+                    break;
+                }
+            }
+            filled_ |= 1u << index;
+        }
+
+        // Take returns the long name for the short entry, or empty string
+        std::string Take(const DirectoryEntry &entry) {
+            std::string name;
+            if (length_ > 0 && filled_ == (1u << length_) - 1 &&
+                checksum_ == shortNameChecksum(entry)) {
+                name.assign(chars_, strnlen(chars_, length_ * 13));
+            }
+            Reset();
+            return name;
+        }
+
+        void Reset() {
+            length_ = 0;
+            filled_ = 0;
+            memset(chars_, 0, sizeof(chars_));
+        }
+
+    private:
+        static const int kMaxEntries = 20; // 255 chars
+        char chars_[kMaxEntries * 13 + 1]{};
+        int length_{0};
+        uint32_t filled_{0};
+        uint8_t checksum_{0};
+    };
+
+    bool isDirectory(const DirectoryEntry &entry) {
+        return (static_cast<uint8_t>(entry.attr) & static_cast<uint8_t>(Attribute::kDirectory)) != 0;
+    }
+
+    std::string shortName(const DirectoryEntry &entry) {
+        char base[9], ext[4];
+        ReadName(entry, base, ext);
+        std::string name = base;
+        if (ext[0]) {
+            name = name + "." + ext;
+        }
+        return name;
+    }
+
+    // makeShortName converts "name.ext" to the 8.3 form. Returns false if it doesn't fit.
+    bool makeShortName(const char *name, unsigned char *short_name) {
+        const char *dot = strrchr(name, '.');
+        const size_t base_len = dot ? dot - name : strlen(name);
+        const size_t ext_len = dot ? strlen(dot + 1) : 0;
+        if (base_len == 0 || base_len > 8 || ext_len > 3) {
+            return false;
+        }
+
+        auto valid = [](char c) {
+            return isalnum(c) || (c != 0 && strchr("!#$%&'()-@^_`{}~", c));
+        };
+        memset(short_name, 0x20, 11);
+        for (size_t i = 0; i < base_len; ++i) {
+            if (!valid(name[i])) {
+                return false;
+            }
+            short_name[i] = toupper(name[i]);
+        }
+        for (size_t i = 0; i < ext_len; ++i) {
+            if (!valid(dot[1 + i])) {
+                return false;
+            }
+            short_name[8 + i] = toupper(dot[1 + i]);
+        }
+        return true;
+    }
+
+    // Directory is the cached contents of a directory,
+    // with an index keyed by the name hash
+    struct Directory {
+        std::vector<unsigned long> clusters;
+        // copies of the entries read from the clusters.
+        // items point into it, and a deque keeps them valid as the directory grows.
+        std::deque<DirectoryEntry> entries;
+        std::vector<DirectoryItem> items;
+        std::unordered_multimap<uint32_t, size_t> index;
+    };
+
+    // where a cached entry is placed: (directory cluster, index in the directory)
+    struct EntryLocation {
+        unsigned long dir_cluster;
+        size_t index;
+    };
+
+    // dentry cache, keyed by the directory cluster
+    std::unordered_map<unsigned long, Directory> *directory_cache;
+    std::unordered_map<const DirectoryEntry *, EntryLocation> *entry_locations;
+
+    void addItem(Directory &dir, DirectoryEntry &entry, std::string name) {
+        const auto short_name = shortName(entry);
+        const size_t index = dir.items.size();
+        dir.index.emplace(hashName(short_name.c_str(), short_name.size()), index);
+        if (!name.empty()) {
+            dir.index.emplace(hashName(name.c_str(), name.size()), index);
+        } else {
+            name = short_name;
+        }
+        dir.items.push_back({&entry, name});
+    }
+
+    void appendCluster(Directory &dir, unsigned long dir_cluster,
+                       unsigned long cluster, const DirectoryEntry *entries) {
+        const auto entries_per_cluster = bytes_per_cluster / sizeof(DirectoryEntry);
+        dir.clusters.push_back(cluster);
+        for (size_t i = 0; i < entries_per_cluster; ++i) {
+            dir.entries.push_back(entries[i]);
+            (*entry_locations)[&dir.entries.back()] = {dir_cluster, dir.entries.size() - 1};
+        }
+    }
+
+    Directory &cachedDirectory(unsigned long dir_cluster) {
+        if (dir_cluster == 0) {
+            dir_cluster = boot_volume_image->root_cluster;
+        }
+        if (!directory_cache) {
+            directory_cache = new std::unordered_map<unsigned long, Directory>;
+            entry_locations = new std::unordered_map<const DirectoryEntry *, EntryLocation>;
+        }
+
+        auto [it, inserted] = directory_cache->try_emplace(dir_cluster);
+        auto &dir = it->second;
+        if (!inserted) {
+            return dir;
+        }
+
+        // read all clusters once
+        std::vector<DirectoryEntry> buf(bytes_per_cluster / sizeof(DirectoryEntry));
+        for (auto cluster = dir_cluster;
+             cluster != 0 && cluster != kEndOfClusterChain;
+             cluster = NextCluster(cluster)) {
+            if (auto err = cache->Read(ClusterOffset(cluster), &buf[0], bytes_per_cluster)) {
+                Log(kLogFS, kError, "failed to read directory cluster %lu: %s\n", cluster, err.Name());
+                break;
+            }
+            appendCluster(dir, dir_cluster, cluster, &buf[0]);
+        }
+
+        LongNameBuilder long_name;
+        for (auto &entry : dir.entries) {
+            if (entry.name[0] == 0x00) {
+                // empty, and no entries follow
+                return dir;
+            } else if (entry.name[0] == 0xe5) {
+                long_name.Reset();
+                continue;
+            } else if (entry.attr == Attribute::kLongName) {
+                long_name.Add(reinterpret_cast<const LongNameEntry &>(entry));
+                continue;
+            } else if ((static_cast<uint8_t>(entry.attr) &
+                        static_cast<uint8_t>(Attribute::kVolumeID)) != 0) {
+                long_name.Reset();
+                continue;
+            }
+
+            addItem(dir, entry, long_name.Take(entry));
+        }
+
+        return dir;
+    }
+
+    DirectoryEntry *findInDirectory(unsigned long dir_cluster, const char *name, size_t len) {
+        auto &dir = cachedDirectory(dir_cluster);
+        auto [begin, end] = dir.index.equal_range(hashName(name, len));
+        for (auto it = begin; it != end; ++it) {
+            const auto &item = dir.items[it->second];
+            if (nameEquals(item.name, name, len) || nameEquals(shortName(*item.entry), name, len)) {
+                return item.entry;
+            }
+        }
+
+        return nullptr;
+    }
+
+    // mount time index of the fat, kept in sync by writeFAT.
+    // free cluster bitmap, a set bit means free
+    std::vector<uint64_t> *free_clusters;
+    unsigned long cluster_count; // valid clusters are 2 .. cluster_count + 1
+    unsigned long free_count;
+    unsigned long next_free = 2; // where the search for a free cluster starts
+    // runs of chains: [start, start + length) are clusters each linked to the next one.
+    // only runs of 2 or more clusters are kept.
+    std::map<unsigned long, unsigned long> *chain_runs;
+    // sectors of the fat modified since the last Sync
+    std::set<uint64_t> *dirty_fat_sectors;
+    void (*change_handler)(unsigned long first_cluster);
+    // open descriptors, see updateDescriptors
+    std::vector<FileDescriptor *> open_descriptors;
+
+    // DescriptorUpdate calls updateDescriptors when it goes out of scope,
+    // on any path after the chain or the size may have changed
+    class DescriptorUpdate {
+    public:
+        explicit DescriptorUpdate(const DirectoryEntry &entry) : entry_{entry} {}
+        ~DescriptorUpdate() { updateDescriptors(entry_, false); }
+
+    private:
+        const DirectoryEntry &entry_;
+    };
+    void (*read_ahead_handler)(uint64_t offset, size_t len);
+
+    // requestReadAhead hands the device ranges of [offset, offset + len) of the file
+    // to the read-ahead handler, skipping resident ones
+    void requestReadAhead(const ExtentMap &map, size_t offset, size_t len) {
+        while (read_ahead_handler && len > 0) {
+            const auto extent = map.Find(offset);
+            if (!extent) {
+                return;
+            }
+
+            const size_t extent_begin = extent->file_cluster * bytes_per_cluster;
+            const size_t extent_end = extent_begin + extent->length * bytes_per_cluster;
+            const size_t n = std::min(len, extent_end - offset);
+            const uint64_t dev_offset = ClusterOffset(extent->cluster) + (offset - extent_begin);
+            if (!cache->Pointer(dev_offset, n)) {
+                read_ahead_handler(dev_offset, n);
+            }
+
+            offset += n;
+            len -= n;
+        }
+    }
+
+    bool isFree(unsigned long cluster) {
+        return ((*free_clusters)[cluster / 64] >> (cluster % 64)) & 1;
+    }
+
+    void setFree(unsigned long cluster, bool free) {
+        auto &word = (*free_clusters)[cluster / 64];
+        const uint64_t bit = uint64_t{1} << (cluster % 64);
+        if (free && (word & bit) == 0) {
+            word |= bit;
+            ++free_count;
+        } else if (!free && (word & bit) != 0) {
+            word &= ~bit;
+            --free_count;
+        }
+    }
+
+    // runContaining returns (start, length) of the run holding `cluster`
+    std::pair<unsigned long, unsigned long> runContaining(unsigned long cluster) {
+        auto it = chain_runs->upper_bound(cluster);
+        if (it != chain_runs->begin()) {
+            --it;
+            if (cluster < it->first + it->second) {
+                return *it;
+            }
+        }
+        return {cluster, 1};
+    }
+
+    void setRun(unsigned long start, unsigned long length) {
+        if (length >= 2) {
+            (*chain_runs)[start] = length;
+        }
+    }
+
+    // updateRuns splits or joins runs when the link from `cluster` changes
+    void updateRuns(unsigned long cluster, uint32_t old_next, uint32_t new_next) {
+        const bool was_linked = old_next == cluster + 1;
+        const bool linked = new_next == cluster + 1;
+        if (was_linked == linked) {
+            return;
+        }
+
+        if (was_linked) {
+            const auto [start, length] = runContaining(cluster);
+            chain_runs->erase(start);
+            setRun(start, cluster + 1 - start);
+            setRun(cluster + 1, start + length - (cluster + 1));
+        } else {
+            // `cluster` ends a run, and `cluster + 1` starts one
+            const auto [start, length] = runContaining(cluster);
+            const auto [next_start, next_length] = runContaining(cluster + 1);
+            chain_runs->erase(start);
+            chain_runs->erase(next_start);
+            setRun(start, length + next_length);
+        }
+    }
+
+    // scanEntries sets the bits of free entries and of entries linked to the next cluster.
+    // `first` is a multiple of 4, so a group of 4 never spans words.
+    void scanEntries(const uint32_t *entries, unsigned long first, size_t n,
+                     std::vector<uint64_t> &free_bits, std::vector<uint64_t> &link_bits) {
+        size_t i = 0;
+#ifdef __SSE2__
+        const __m128i mask = _mm_set1_epi32(0x0fffffff);
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i four = _mm_set1_epi32(4);
+        __m128i next = _mm_setr_epi32(first + 1, first + 2, first + 3, first + 4);
+        for (; i + 4 <= n; i += 4) {
+            const __m128i v = _mm_and_si128(
+                _mm_loadu_si128(reinterpret_cast<const __m128i *>(&entries[i])), mask);
+            const uint64_t f = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(v, zero)));
+            const uint64_t l = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(v, next)));
+            const unsigned long c = first + i;
+            free_bits[c / 64] |= f << (c % 64);
+            link_bits[c / 64] |= l << (c % 64);
+            next = _mm_add_epi32(next, four);
+        }
+#endif
+        for (; i < n; ++i) {
+            const unsigned long c = first + i;
+            const uint32_t v = entries[i] & 0x0ffffffful;
+            free_bits[c / 64] |= uint64_t{v == 0} << (c % 64);
+            link_bits[c / 64] |= uint64_t{v == c + 1} << (c % 64);
+        }
+    }
+
+    // buildIndex scans the whole fat once
+    void buildIndex() {
+        const unsigned long num_entries = cluster_count + 2;
+        free_clusters = new std::vector<uint64_t>((num_entries + 63) / 64);
+        chain_runs = new std::map<unsigned long, unsigned long>;
+        std::vector<uint64_t> link_bits(free_clusters->size());
+
+        uint32_t chunk[1024];
+        for (unsigned long c = 0; c < num_entries; c += 1024) {
+            const size_t n = std::min<unsigned long>(1024, num_entries - c);
+            if (auto err = cache->Read(fat_offset + c * sizeof(uint32_t), chunk, n * sizeof(uint32_t))) {
+                Log(kLogFS, kError, "failed to read fat: %s\n", err.Name());
+                break;
+            }
+            scanEntries(chunk, c, n, *free_clusters, link_bits);
+        }
+
+        // entries 0 and 1 are reserved
+        (*free_clusters)[0] &= ~uint64_t{3};
+        link_bits[0] &= ~uint64_t{3};
+        // the last cluster can't link to the next
+        link_bits[(num_entries - 1) / 64] &= ~(uint64_t{1} << ((num_entries - 1) % 64));
+
+        free_count = 0;
+        for (auto word : *free_clusters) {
+            free_count += __builtin_popcountll(word);
+        }
+
+        // a run is a sequence of linked clusters and the one after them
+        unsigned long start = 0, length = 0;
+        for (unsigned long c = 0; c < num_entries; ++c) {
+            if (c % 64 == 0 && link_bits[c / 64] == 0 && length == 0) {
+                c += 63;
+                continue;
+            }
+            if ((link_bits[c / 64] >> (c % 64)) & 1) {
+                if (length == 0) {
+                    start = c;
+                }
+                ++length;
+            } else if (length > 0) {
+                setRun(start, length + 1);
+                length = 0;
+            }
+        }
+    }
+
+    // findFreeRun returns the first cluster of `count` contiguous free clusters, or 0
+    unsigned long findFreeRun(unsigned long count) {
+        const auto &bitmap = *free_clusters;
+        unsigned long start = 0, length = 0;
+        for (unsigned long c = 2; c < cluster_count + 2; ++c) {
+            const auto word = bitmap[c / 64];
+            if (c % 64 == 0 && word == 0) {
+                length = 0;
+                c += 63;
+                continue;
+            }
+            if (c % 64 == 0 && word == ~uint64_t{0}) {
+                if (length == 0) {
+                    start = c;
+                }
+                length += 64;
+                c += 63;
+            } else if (isFree(c)) {
+                if (length == 0) {
+                    start = c;
+                }
+                ++length;
+            } else {
+                length = 0;
+            }
+
+            if (length >= count) {
+                return start;
+            }
+        }
+        return 0;
+    }
+
+    Error writeFAT(unsigned long cluster, uint32_t value) {
+        const uint64_t offset = fat_offset + cluster * sizeof(uint32_t);
+        uint32_t entry;
+        if (auto err = cache->Read(offset, &entry, sizeof(entry))) {
+            return err;
+        }
+
+        // upper 4 bits are reserved
+        const uint32_t old_value = entry & 0x0ffffffful;
+        entry = (entry & 0xf0000000ul) | (value & 0x0ffffffful);
+        if (auto err = cache->Write(offset, &entry, sizeof(entry))) {
+            return err;
+        }
+
+        dirty_fat_sectors->insert(offset / boot_volume_image->bytes_per_sector);
+        setFree(cluster, (value & 0x0ffffffful) == 0);
+        updateRuns(cluster, old_value, value & 0x0ffffffful);
+        return MAKE_ERROR(Error::kSuccess);
+    }
+
+    Error writeZeros(uint64_t offset, size_t len) {
+        static const uint8_t zeros[512] = {};
+        while (len > 0) {
+            const size_t n = std::min(len, sizeof(zeros));
+            if (auto err = cache->Write(offset, zeros, n)) {
+                return err;
+            }
+            offset += n;
+            len -= n;
+        }
+        return MAKE_ERROR(Error::kSuccess);
+    }
+
+    // allocateCluster takes a free cluster, zero fills it and links it after `last` (if not 0)
+    WithError<unsigned long> allocateCluster(unsigned long last) {
+        auto &bitmap = *free_clusters;
+        const size_t start = next_free / 64;
+        // the start word is visited twice: from next_free first, all of it
+        // after wrapping around
+        for (size_t i = 0; i <= bitmap.size(); ++i) {
+            const size_t w = (start + i) % bitmap.size();
+            uint64_t word = bitmap[w];
+            if (i == 0) {
+                word &= ~uint64_t{0} << (next_free % 64);
+            }
+            if (word == 0) {
+                continue;
+            }
+
+            // keep the chain contiguous if possible
+            unsigned long cluster = w * 64 + __builtin_ctzll(word);
+            if (last != 0 && last + 1 < cluster_count + 2 && isFree(last + 1)) {
+                cluster = last + 1;
+            }
+            if (auto err = writeZeros(ClusterOffset(cluster), bytes_per_cluster)) {
+                return {0, err};
+            }
+            if (auto err = writeFAT(cluster, kEndOfClusterChain)) {
+                return {0, err};
+            }
+            if (last != 0) {
+                if (auto err = writeFAT(last, cluster)) {
+                    return {0, err};
+                }
+            }
+
+            next_free = cluster + 1;
+            return {cluster, MAKE_ERROR(Error::kSuccess)};
+        }
+
+        return {0, MAKE_ERROR(Error::kFull)};
+    }
+
+    Error freeChain(unsigned long cluster) {
+        while (cluster != 0 && cluster != kEndOfClusterChain) {
+            const auto next = NextCluster(cluster);
+            if (auto err = writeFAT(cluster, 0)) {
+                return err;
+            }
+            cluster = next;
+        }
+        return MAKE_ERROR(Error::kSuccess);
+    }
+
+    void setFirstCluster(DirectoryEntry &entry, unsigned long cluster) {
+        entry.first_cluster_low = cluster & 0xffff;
+        entry.first_cluster_high = cluster >> 16;
+    }
+
+    // reserveClusters extends the chain of the file to hold `size` bytes
+    Error reserveClusters(DirectoryEntry &entry, size_t size) {
+        const size_t needed = (size + bytes_per_cluster - 1) / bytes_per_cluster;
+        size_t count = 0;
+        unsigned long last = 0;
+        for (auto c = entry.FirstCluster(); c != 0 && c != kEndOfClusterChain; c = NextCluster(c)) {
+            last = c;
+            ++count;
+        }
+
+        if (last == 0 && needed > 1) {
+            // place a new file on contiguous clusters if there is room
+            if (auto start = findFreeRun(needed)) {
+                next_free = start;
+            }
+        }
+
+        for (; count < needed; ++count) {
+            auto [cluster, err] = allocateCluster(last);
+            if (err) {
+                return err;
+            }
+            if (last == 0) {
+                setFirstCluster(entry, cluster);
+            }
+            last = cluster;
+        }
+        return MAKE_ERROR(Error::kSuccess);
+    }
+
+    // writeRange writes to the allocated clusters of the file. buf == nullptr writes zeros.
+    Error writeRange(const ExtentMap &map, size_t offset, const void *buf, size_t len) {
+        auto p = reinterpret_cast<const uint8_t *>(buf);
+        while (len > 0) {
+            const auto extent = map.Find(offset);
+            if (!extent) {
+                return MAKE_ERROR(Error::kIndexOutOfRange);
+            }
+
+            const size_t extent_begin = extent->file_cluster * bytes_per_cluster;
+            const size_t extent_end = extent_begin + extent->length * bytes_per_cluster;
+            const size_t n = std::min(len, extent_end - offset);
+            const uint64_t dev_offset = ClusterOffset(extent->cluster) + (offset - extent_begin);
+            if (auto err = p ? cache->Write(dev_offset, p, n) : writeZeros(dev_offset, n)) {
+                return err;
+            }
+
+            if (p) {
+                p += n;
+            }
+            offset += n;
+            len -= n;
+        }
+        return MAKE_ERROR(Error::kSuccess);
+    }
+
+    uint64_t entryOffset(const EntryLocation &loc) {
+        const auto entries_per_cluster = bytes_per_cluster / sizeof(DirectoryEntry);
+        const auto &dir = directory_cache->at(loc.dir_cluster);
+        return ClusterOffset(dir.clusters[loc.index / entries_per_cluster]) +
+            (loc.index % entries_per_cluster) * sizeof(DirectoryEntry);
+    }
+
+    // writeEntry writes the cached entry back to its directory
+    Error writeEntry(const DirectoryEntry &entry) {
+        auto it = entry_locations->find(&entry);
+        if (it == entry_locations->end()) {
+            return MAKE_ERROR(Error::kInvalidFile);
+        }
+        return cache->Write(entryOffset(it->second), &entry, sizeof(entry));
+    }
+
+    // allocateEntry returns an unused entry of the directory, growing it if full
+    WithError<DirectoryEntry *> allocateEntry(Directory &dir) {
+        for (auto &entry : dir.entries) {
+            if (entry.name[0] == 0x00 || entry.name[0] == 0xe5) {
+                return {&entry, MAKE_ERROR(Error::kSuccess)};
+            }
+        }
+
+        auto [cluster, err] = allocateCluster(dir.clusters.back());
+        if (err) {
+            return {nullptr, err};
+        }
+
+        const size_t n = dir.entries.size();
+        std::vector<DirectoryEntry> zeros(bytes_per_cluster / sizeof(DirectoryEntry));
+        appendCluster(dir, dir.clusters.front(), cluster, &zeros[0]);
+        return {&dir.entries[n], MAKE_ERROR(Error::kSuccess)};
+    }
+
+    void notifyChange(unsigned long first_cluster) {
+        if (change_handler && first_cluster != 0) {
+            change_handler(first_cluster);
+        }
+    }
+
+    // FSInfo sector, which caches the free cluster count
+    struct FSInfo {
+        uint32_t lead_signature; // 0x41615252
+        uint8_t reserved1[480];
+        uint32_t struct_signature; // 0x61417272
+        uint32_t free_count;
+        uint32_t next_free;
+        uint8_t reserved2[12];
+        uint32_t trail_signature; // 0xaa550000
+    } __attribute__((packed));
+
+    Error updateFSInfo() {
+        const uint16_t sector = boot_volume_image->fs_info;
+        if (sector == 0 || sector == 0xffff) {
+            return MAKE_ERROR(Error::kSuccess); // no fsinfo
+        }
+
+        const uint64_t offset = sector * static_cast<uint64_t>(boot_volume_image->bytes_per_sector);
+        FSInfo info;
+        if (auto err = cache->Read(offset, &info, sizeof(info))) {
+            return err;
+        }
+        if (info.lead_signature != 0x41615252 || info.struct_signature != 0x61417272) {
+            return MAKE_ERROR(Error::kSuccess);
+        }
+
+        info.free_count = free_count;
+        info.next_free = next_free;
+        return cache->Write(offset, &info, sizeof(info));
+    }
+}
+
+void Initialize(block::Device &device) {
+    // forget the previous volume if mounted again
+    delete cache;
+    delete directory_cache;
+    delete entry_locations;
+    delete free_clusters;
+    delete chain_runs;
+    delete dirty_fat_sectors;
+    directory_cache = nullptr;
+    entry_locations = nullptr;
+    next_free = 2;
+
+    cache = new block::Cache{device, kCacheBlocks, kReadAheadBlocks};
+    if (auto err = device.Read(0, boot_sector, 1)) {
+        Log(kLogFS, kError, "failed to read boot sector: %s\n", err.Name());
+        return;
+    }
+
+    boot_volume_image = reinterpret_cast<fat::BPB *>(boot_sector);
     bytes_per_cluster = static_cast<unsigned long>(boot_volume_image->bytes_per_sector) *
         boot_volume_image->sectors_per_cluster;
-}
 
-uintptr_t GetClusterAddr(unsigned long cluster) {
-    unsigned long sector_num =
+    const uint64_t bytes_per_sector = boot_volume_image->bytes_per_sector;
+    // when mirroring is disabled (bit 7), only the active fat is used
+    const unsigned int active_fat = (boot_volume_image->ext_flags & 0x80) ?
+        (boot_volume_image->ext_flags & 0x0f) : 0;
+    fat_offset = (
+        boot_volume_image->reserved_sector_count +
+        active_fat * boot_volume_image->fat_size_32
+    ) * bytes_per_sector;
+    data_offset = (
         boot_volume_image->reserved_sector_count +
-        boot_volume_image->num_fats * boot_volume_image->fat_size_32 +
-        (cluster - 2) * boot_volume_image->sectors_per_cluster;
-    uintptr_t offset = sector_num * boot_volume_image->bytes_per_sector;
-    return reinterpret_cast<uintptr_t>(boot_volume_image) + offset;
+        boot_volume_image->num_fats * boot_volume_image->fat_size_32
+    ) * bytes_per_sector;
+
+    fat_table = reinterpret_cast<const uint32_t *>(
+        cache->Pointer(fat_offset, boot_volume_image->fat_size_32 * bytes_per_sector)
+    );
+
+    const uint64_t total_sectors = boot_volume_image->total_sectors_32 ?
+        boot_volume_image->total_sectors_32 : boot_volume_image->total_sectors_16;
+    cluster_count = (total_sectors - data_offset / bytes_per_sector) /
+        boot_volume_image->sectors_per_cluster;
+    // the fat may be shorter than the data area
+    cluster_count = std::min<uint64_t>(
+        cluster_count, boot_volume_image->fat_size_32 * bytes_per_sector / sizeof(uint32_t) - 2
+    );
+    dirty_fat_sectors = new std::set<uint64_t>;
+    buildIndex();
+}
+
+void Initialize(void *volume_image) {
+    if (IsCompressedVolume(volume_image)) {
+        // only the blocks read are expanded, into the block cache
+        static block::CompressedDisk *compressed_disk;
+        delete compressed_disk;
+        compressed_disk = new block::CompressedDisk{volume_image};
+        if (!compressed_disk->Valid()) {
+            Log(kLogFS, kError, "broken compressed volume\n");
+            return;
+        }
+        const auto header = reinterpret_cast<const CompressedVolumeHeader *>(volume_image);
+        Log(kLogFS, kInfo, "compressed volume: %lu bytes for %lu bytes image\n",
+            header->container_bytes, header->image_bytes);
+        Initialize(*compressed_disk);
+        return;
+    }
+
+    const auto bpb = reinterpret_cast<const BPB *>(volume_image);
+    const uint64_t total_sectors = bpb->total_sectors_32 ? bpb->total_sectors_32 : bpb->total_sectors_16;
+    const uint64_t bytes = std::min(total_sectors * bpb->bytes_per_sector, kMaxImageBytes);
+
+    static block::RamDisk *ram_disk;
+    delete ram_disk;
+    ram_disk = new block::RamDisk{volume_image, bytes / block::kSectorBytes};
+    Initialize(*ram_disk);
+}
+
+uint64_t ClusterOffset(unsigned long cluster) {
+    return data_offset + (cluster - 2) * static_cast<uint64_t>(bytes_per_cluster);
+}
+
+block::CacheStat CacheStat() {
+    return cache->Stat();
 }
 
 void ReadName(const DirectoryEntry &entry, char *base, char *ext) {
@@ -41,15 +813,14 @@ void ReadName(const DirectoryEntry &entry, char *base, char *ext) {
 }
 
 unsigned long NextCluster(unsigned long cluster) {
-    // use fat #1
-    uintptr_t fat_offset =
-        boot_volume_image->reserved_sector_count *
-        boot_volume_image->bytes_per_sector;
-    uint32_t *fat = reinterpret_cast<uint32_t *>(
-        reinterpret_cast<uintptr_t>(boot_volume_image) + fat_offset
-    );
+    uint32_t next;
+    if (fat_table) {
+        next = fat_table[cluster];
+    } else if (cache->Read(fat_offset + cluster * sizeof(uint32_t), &next, sizeof(next))) {
+        return kEndOfClusterChain;
+    }
 
-    uint32_t next = fat[cluster];
+    next &= 0x0ffffffful; // upper 4 bits are reserved
     if (next >= 0x0ffffff8ul) {
         return kEndOfClusterChain;
     }
@@ -57,25 +828,442 @@ unsigned long NextCluster(unsigned long cluster) {
     return next;
 }
 
-DirectoryEntry *FindFile(const char *name, unsigned long dir_cluster) {
-    if (dir_cluster == 0) {
-        dir_cluster = boot_volume_image->root_cluster;
-        Log(kWarn, "fat::FindFile: dir_cluster changed to %lx\n", dir_cluster);
+size_t ReadFile(const DirectoryEntry &entry, size_t offset, void *buf, size_t len) {
+    return ExtentMap{entry}.Read(offset, buf, len);
+}
+
+WithError<DirectoryEntry *> CreateFile(const char *path) {
+    if (auto entry = FindFile(path)) {
+        if (isDirectory(*entry)) {
+            return {nullptr, MAKE_ERROR(Error::kInvalidFile)};
+        }
+        return {entry, MAKE_ERROR(Error::kSuccess)};
     }
 
-    while (dir_cluster != kEndOfClusterChain) {
-        // Log(kWarn, "fat::FindFile: reading cluster %lx\n", dir_cluster);
-        auto dir = GetSectorByCluster<DirectoryEntry>(dir_cluster);
-        for (int i = 0; i < bytes_per_cluster/sizeof(DirectoryEntry); ++i) {
-            if (NameIsEqual(dir[i], name)) {
-                return &dir[i];
+    // split into the parent directory and the name
+    unsigned long dir_cluster = 0;
+    const char *name = path;
+    if (const char *slash = strrchr(path, '/')) {
+        name = slash + 1;
+        if (slash != path) {
+            const std::string dir_path(path, slash - path);
+            auto dir = FindFile(dir_path.c_str());
+            if (!dir || !isDirectory(*dir)) {
+                return {nullptr, MAKE_ERROR(Error::kInvalidFile)};
             }
+            dir_cluster = dir->FirstCluster();
         }
+    }
+
+    unsigned char short_name[11];
+    if (!makeShortName(name, short_name)) {
+        return {nullptr, MAKE_ERROR(Error::kInvalidFile)};
+    }
+
+    auto &dir = cachedDirectory(dir_cluster);
+    auto [entry, err] = allocateEntry(dir);
+    if (err) {
+        return {nullptr, err};
+    }
+
+    memset(entry, 0, sizeof(*entry));
+    memcpy(entry->name, short_name, sizeof(short_name));
+    entry->attr = Attribute::kArchive;
+    if (auto err = writeEntry(*entry)) {
+        return {nullptr, err};
+    }
+
+    addItem(dir, *entry, "");
+    return {entry, MAKE_ERROR(Error::kSuccess)};
+}
 
-        dir_cluster = NextCluster(dir_cluster);
+WithError<size_t> WriteFile(DirectoryEntry &entry, size_t offset, const void *buf, size_t len) {
+    if (len == 0) {
+        return {0, MAKE_ERROR(Error::kSuccess)};
     }
+    const uint64_t end = static_cast<uint64_t>(offset) + len;
+    if (end > 0xfffffffful) {
+        return {0, MAKE_ERROR(Error::kIndexOutOfRange)}; // file_size is 32 bit
+    }
+
+    // before any cluster is touched, so that the old contents can be saved
+    notifyChange(entry.FirstCluster());
+    DescriptorUpdate update{entry};
+
+    const size_t old_size = entry.file_size;
+    if (auto err = reserveClusters(entry, end)) {
+        return {0, err};
+    }
+
+    const ExtentMap map{entry};
+    if (offset > old_size) {
+        // new clusters are zero filled already, only the tail of the last one is left
+        const size_t tail_end = std::min<size_t>(
+            offset, (old_size + bytes_per_cluster - 1) / bytes_per_cluster * bytes_per_cluster
+        );
+        if (old_size < tail_end) {
+            if (auto err = writeRange(map, old_size, nullptr, tail_end - old_size)) {
+                return {0, err};
+            }
+        }
+    }
+    if (auto err = writeRange(map, offset, buf, len)) {
+        return {0, err};
+    }
+
+    entry.file_size = std::max<uint64_t>(old_size, end);
+    if (auto err = writeEntry(entry)) {
+        return {0, err};
+    }
+
+    return {len, MAKE_ERROR(Error::kSuccess)};
+}
+
+Error TruncateFile(DirectoryEntry &entry, size_t size) {
+    if (size > 0xfffffffful) {
+        return MAKE_ERROR(Error::kIndexOutOfRange);
+    }
+
+    notifyChange(entry.FirstCluster());
+    DescriptorUpdate update{entry};
+    if (size > entry.file_size) {
+        const size_t old_size = entry.file_size;
+        if (auto err = reserveClusters(entry, size)) {
+            return err;
+        }
+        if (auto err = writeRange(ExtentMap{entry}, old_size, nullptr, size - old_size)) {
+            return err;
+        }
+    } else {
+        const size_t keep = (size + bytes_per_cluster - 1) / bytes_per_cluster;
+        if (keep == 0) {
+            if (auto err = freeChain(entry.FirstCluster())) {
+                return err;
+            }
+            setFirstCluster(entry, 0);
+        } else {
+            auto last = entry.FirstCluster();
+            for (size_t i = 1; i < keep; ++i) {
+                last = NextCluster(last);
+            }
+            const auto next = NextCluster(last);
+            if (next != kEndOfClusterChain) {
+                if (auto err = writeFAT(last, kEndOfClusterChain)) {
+                    return err;
+                }
+                if (auto err = freeChain(next)) {
+                    return err;
+                }
+            }
+        }
+    }
+
+    entry.file_size = size;
+    return writeEntry(entry);
+}
+
+Error DeleteFile(const char *path) {
+    auto entry = FindFile(path);
+    if (!entry || isDirectory(*entry)) {
+        return MAKE_ERROR(Error::kInvalidFile);
+    }
+
+    notifyChange(entry->FirstCluster());
+    updateDescriptors(*entry, true);
+    if (auto err = freeChain(entry->FirstCluster())) {
+        return err;
+    }
+
+    // mark the entry and its long name entries deleted
+    const auto loc = entry_locations->at(entry);
+    auto &dir = directory_cache->at(loc.dir_cluster);
+    for (size_t i = loc.index + 1; i-- > 0;) {
+        auto &e = dir.entries[i];
+        if (i != loc.index && (e.attr != Attribute::kLongName || e.name[0] == 0xe5)) {
+            break;
+        }
+        e.name[0] = 0xe5;
+        if (auto err = writeEntry(e)) {
+            return err;
+        }
+    }
+
+    // drop it from the dentry cache, and rebuild the index
+    dir.items.erase(std::remove_if(dir.items.begin(), dir.items.end(),
+        [entry](const DirectoryItem &item) { return item.entry == entry; }), dir.items.end());
+    dir.index.clear();
+    for (size_t i = 0; i < dir.items.size(); ++i) {
+        const auto &item = dir.items[i];
+        const auto short_name = shortName(*item.entry);
+        dir.index.emplace(hashName(short_name.c_str(), short_name.size()), i);
+        if (item.name != short_name) {
+            dir.index.emplace(hashName(item.name.c_str(), item.name.size()), i);
+        }
+    }
+
+    return MAKE_ERROR(Error::kSuccess);
+}
+
+Error Sync() {
+    // copy modified sectors of the fat to the mirrors
+    const uint64_t bytes_per_sector = boot_volume_image->bytes_per_sector;
+    if ((boot_volume_image->ext_flags & 0x80) == 0 && !dirty_fat_sectors->empty()) {
+        std::vector<uint8_t> sector(bytes_per_sector);
+        for (const auto s : *dirty_fat_sectors) {
+            if (auto err = cache->Read(s * bytes_per_sector, &sector[0], bytes_per_sector)) {
+                return err;
+            }
+            for (int i = 1; i < boot_volume_image->num_fats; ++i) {
+                const uint64_t mirror = s + i * static_cast<uint64_t>(boot_volume_image->fat_size_32);
+                if (auto err = cache->Write(mirror * bytes_per_sector, &sector[0], bytes_per_sector)) {
+                    return err;
+                }
+            }
+        }
+    }
+
+    if (!dirty_fat_sectors->empty()) {
+        dirty_fat_sectors->clear();
+        if (auto err = updateFSInfo()) {
+            return err;
+        }
+    }
+
+    return cache->Flush();
+}
+
+VolumeStat GetVolumeStat() {
+    return {cluster_count, free_count, chain_runs->size()};
+}
+
+unsigned long ContiguousClusters(unsigned long cluster) {
+    const auto [start, length] = runContaining(cluster);
+    return start + length - cluster;
+}
+
+void SetReadAheadHandler(void (*handler)(uint64_t offset, size_t len)) {
+    read_ahead_handler = handler;
+}
+
+bool Prefetch(uint64_t offset, size_t len) {
+    return cache->Prefetch(offset, len);
+}
+
+void SetChangeHandler(void (*handler)(unsigned long first_cluster)) {
+    change_handler = handler;
+}
+
+
+ExtentMap::ExtentMap(const DirectoryEntry &entry)
+    : file_size_{entry.file_size}, first_cluster_{entry.FirstCluster()} {
+    // jump over contiguous runs with the index, following the chain only between them
+    auto cluster = first_cluster_;
+    size_t i = 0;
+    while (cluster != 0 && cluster != kEndOfClusterChain) {
+        const auto length = ContiguousClusters(cluster);
+        extents_.push_back({i, cluster, length});
+        i += length;
+        cluster = NextCluster(cluster + length - 1);
+    }
+}
+
+const Extent *ExtentMap::Find(size_t offset) const {
+    const size_t file_cluster = offset / bytes_per_cluster;
+    // first extent starting after file_cluster
+    auto it = std::upper_bound(extents_.begin(), extents_.end(), file_cluster,
+        [](size_t c, const Extent &e) {
+            return c < e.file_cluster;
+        }
+    );
+    if (it == extents_.begin()) {
+        return nullptr;
+    }
+
+    --it;
+    if (file_cluster >= it->file_cluster + it->length) {
+        return nullptr;
+    }
+
+    return &*it;
+}
+
+size_t ExtentMap::Read(size_t offset, void *buf, size_t len) const {
+    if (offset >= file_size_) {
+        return 0;
+    }
+    len = std::min<size_t>(len, file_size_ - offset);
+
+    auto p = reinterpret_cast<uint8_t *>(buf);
+    size_t read_bytes = 0;
+    while (read_bytes < len) {
+        const auto extent = Find(offset);
+        if (!extent) {
+            break; // chain is shorter than file_size
+        }
+
+        const size_t extent_begin = extent->file_cluster * bytes_per_cluster;
+        const size_t extent_end = extent_begin + extent->length * bytes_per_cluster;
+        const size_t n = std::min(len - read_bytes, extent_end - offset);
+        if (cache->Read(ClusterOffset(extent->cluster) + (offset - extent_begin), p + read_bytes, n)) {
+            break;
+        }
+
+        read_bytes += n;
+        offset += n;
+    }
+
+    return read_bytes;
+}
+
+const uint8_t *ExtentMap::Pointer(size_t offset, size_t len) const {
+    if (len == 0 || offset + len > file_size_ || offset + len < offset) {
+        return nullptr;
+    }
+
+    const auto extent = Find(offset);
+    if (!extent) {
+        return nullptr;
+    }
+
+    const size_t extent_begin = extent->file_cluster * bytes_per_cluster;
+    const size_t extent_end = extent_begin + extent->length * bytes_per_cluster;
+    if (offset + len > extent_end) {
+        return nullptr;
+    }
+
+    return cache->Pointer(ClusterOffset(extent->cluster) + (offset - extent_begin), len);
+}
+
+DirectoryEntry *FindFile(const char *path, unsigned long dir_cluster) {
+    if (path[0] == '/') {
+        dir_cluster = 0;
+        while (path[0] == '/') {
+            ++path;
+        }
+    }
+
+    while (true) {
+        // split a path component
+        const char *slash = strchr(path, '/');
+        const size_t len = slash ? slash - path : strlen(path);
+        if (len == 0) {
+            return nullptr;
+        }
+
+        auto entry = findInDirectory(dir_cluster, path, len);
+        if (!entry || !slash) {
+            return entry;
+        }
+
+        if ((static_cast<uint8_t>(entry->attr) & static_cast<uint8_t>(Attribute::kDirectory)) == 0) {
+            return nullptr; // not a directory
+        }
+        dir_cluster = entry->FirstCluster(); // ".." to root is 0, same as ours
+
+        path = slash;
+        while (path[0] == '/') {
+            ++path;
+        }
+        if (path[0] == 0) {
+            return entry; // trailing slash
+        }
+    }
+}
+
+const std::vector<DirectoryItem> &ReadDirectory(unsigned long dir_cluster) {
+    return cachedDirectory(dir_cluster).items;
+}
+
+void updateDescriptors(const DirectoryEntry &entry, bool deleted) {
+    for (auto fd : open_descriptors) {
+        if (&fd->entry_ != &entry || fd->deleted_) {
+            continue;
+        }
+        fd->deleted_ = deleted;
+        fd->map_ = deleted ? ExtentMap{} : ExtentMap{entry};
+    }
+}
+
+FileDescriptor::FileDescriptor(DirectoryEntry &entry)
+    : entry_{entry}, map_{entry} {
+    open_descriptors.push_back(this);
+}
+
+FileDescriptor::~FileDescriptor() {
+    open_descriptors.erase(
+        std::find(open_descriptors.begin(), open_descriptors.end(), this));
+}
+
+size_t FileDescriptor::Read(void *buf, size_t len) {
+    const auto n = map_.Read(pos_, buf, len);
+    readAhead(pos_, n);
+    pos_ += n;
+    return n;
+}
+
+void FileDescriptor::readAhead(size_t offset, size_t len) {
+    if (offset != next_read_) {
+        // random access, stop until reads become sequential again
+        ra_window_ = 0;
+        ra_end_ = 0;
+    } else if (ra_window_ == 0) {
+        ra_window_ = kMinReadAheadClusters * bytes_per_cluster;
+    }
+    next_read_ = offset + len;
+    if (ra_window_ == 0 || len == 0) {
+        return;
+    }
+
+    // request the next window when less than half of the current one is left
+    ra_end_ = std::max(ra_end_, next_read_);
+    if (ra_end_ - next_read_ > ra_window_ / 2) {
+        return;
+    }
+
+    const size_t end = std::min(next_read_ + ra_window_, map_.FileSize());
+    if (ra_end_ < end) {
+        requestReadAhead(map_, ra_end_, end - ra_end_);
+        ra_end_ = end;
+    }
+    ra_window_ = std::min(ra_window_ * 2, kMaxReadAheadClusters * bytes_per_cluster);
+}
+
+size_t FileDescriptor::PRead(void *buf, size_t len, size_t offset) const {
+    return map_.Read(offset, buf, len);
+}
+
+WithError<size_t> FileDescriptor::Write(const void *buf, size_t len) {
+    if (deleted_) {
+        return {0, MAKE_ERROR(Error::kInvalidFile)};
+    }
+
+    // map_ is updated by WriteFile
+    auto [n, err] = WriteFile(entry_, pos_, buf, len);
+    pos_ += n;
+    return {n, err};
+}
+
+WithError<size_t> FileDescriptor::Seek(int64_t offset, Whence whence) {
+    int64_t base = 0;
+    switch (whence) {
+    case kSeekSet: base = 0; break;
+    case kSeekCur: base = pos_; break;
+    case kSeekEnd: base = map_.FileSize(); break;
+    default:
+        return {pos_, MAKE_ERROR(Error::kIndexOutOfRange)};
+    }
+
+    if (base + offset < 0) {
+        return {pos_, MAKE_ERROR(Error::kIndexOutOfRange)};
+    }
+
+    // seeking beyond the end is allowed, reads there return 0
+    pos_ = base + offset;
+    return {pos_, MAKE_ERROR(Error::kSuccess)};
+}
 
-    return nullptr;
+size_t FileDescriptor::Size() const {
+    return map_.FileSize();
 }
 
 bool NameIsEqual(const DirectoryEntry &entry, const char *name) {
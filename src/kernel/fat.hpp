@@ -1,6 +1,12 @@
 #pragma once
 
 #include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <string>
+
+#include "block.hpp"
+#include "file.hpp"
 
 namespace fat {
 
@@ -67,20 +73,151 @@ struct DirectoryEntry {
     }
 } __attribute__((packed));
 
+// VFAT long file name entry, placed before the short (8.3) entry in reverse order
+struct LongNameEntry {
+    uint8_t ord; // sequence number, 0x40 marks the last (first placed) one
+    uint16_t name1[5];
+    Attribute attr; // kLongName
+    uint8_t type;
+    uint8_t checksum; // of the short name
+    uint16_t name2[6];
+    uint16_t first_cluster_low; // always 0
+    uint16_t name3[2];
+} __attribute__((packed));
+
+// DirectoryItem is a cached, valid entry of a directory
+struct DirectoryItem {
+    DirectoryEntry *entry;
+    std::string name; // long name if any, otherwise "BASE.EXT"
+};
+
+// Extent is a run of contiguous clusters in a file
+struct Extent {
+    size_t file_cluster; // index of the first cluster in the file
+    unsigned long cluster; // first cluster on the volume
+    size_t length; // in clusters
+};
+
+// ExtentMap collapses the cluster chain of a file into contiguous runs,
+// built once per open file. Reads of a run are single memcpy,
+// and seeking is a binary search over runs.
+class ExtentMap {
+public:
+    ExtentMap() = default;
+    explicit ExtentMap(const DirectoryEntry &entry);
+
+    // Read copies up to `len` bytes from `offset` into `buf`. Returns bytes copied.
+    size_t Read(size_t offset, void *buf, size_t len) const;
+    // Find returns the extent containing the byte `offset`, or nullptr
+    const Extent *Find(size_t offset) const;
+    // Pointer returns the file contents [offset, offset + len) in the volume image,
+    // or nullptr if the range is not in the file or spans fragmented clusters.
+    const uint8_t *Pointer(size_t offset, size_t len) const;
+
+    size_t FileSize() const { return file_size_; }
+    unsigned long FirstCluster() const { return first_cluster_; }
+    const std::vector<Extent> &Extents() const { return extents_; }
+
+private:
+    std::vector<Extent> extents_{};
+    size_t file_size_{0};
+    unsigned long first_cluster_{0};
+};
+
+// FileDescriptor reads a file through its extent map
+// Changes made through other descriptors are seen. A descriptor whose file
+// is deleted reads nothing and fails to write.
+class FileDescriptor : public ::FileDescriptor {
+public:
+    explicit FileDescriptor(DirectoryEntry &entry);
+    ~FileDescriptor();
+    FileDescriptor(const FileDescriptor &) = delete;
+    FileDescriptor &operator =(const FileDescriptor &) = delete;
+
+    size_t Read(void *buf, size_t len) override;
+    size_t PRead(void *buf, size_t len, size_t offset) const override;
+    WithError<size_t> Write(const void *buf, size_t len) override;
+    WithError<size_t> Seek(int64_t offset, Whence whence) override;
+    size_t Size() const override;
+
+private:
+    DirectoryEntry &entry_;
+    ExtentMap map_;
+    size_t pos_{0};
+    bool deleted_{false}; // entry_ may be reused by another file
+
+    // updates map_ of the descriptors of `entry` after it's written,
+    // truncated or deleted through any descriptor
+    friend void updateDescriptors(const DirectoryEntry &entry, bool deleted);
+
+    // read-ahead state. the window grows while reads are sequential.
+    size_t next_read_{0}; // where a sequential read starts
+    size_t ra_window_{0}; // in bytes, 0 while reads are random
+    size_t ra_end_{0}; // prefetch has been requested up to here
+
+    void readAhead(size_t offset, size_t len);
+};
+
+// boot sector of the mounted volume
 extern BPB *boot_volume_image;
 extern unsigned long bytes_per_cluster;
 
+// Initialize mounts the volume on `device`. Sectors are read through a block cache.
+void Initialize(block::Device &device);
+// Initialize mounts the volume image read by the loader, as a RAM disk,
+// or a compressed volume (compressed_volume.hpp) expanded on demand
 void Initialize(void *volume_image);
-uintptr_t GetClusterAddr(unsigned long cluster);
-
-template <class T>
-T *GetSectorByCluster(unsigned long cluster) {
-    return reinterpret_cast<T *>(GetClusterAddr(cluster));
-}
+// ClusterOffset returns the byte offset of the cluster on the device
+uint64_t ClusterOffset(unsigned long cluster);
+block::CacheStat CacheStat();
 
 void ReadName(const DirectoryEntry &entry, char *base, char *ext);
 unsigned long NextCluster(unsigned long cluster);
-DirectoryEntry *FindFile(const char *name, unsigned long dir_cluster=0);
+// ReadDirectory returns valid entries of the directory (0 means root).
+// The result is cached, following calls won't scan clusters again.
+const std::vector<DirectoryItem> &ReadDirectory(unsigned long dir_cluster=0);
+// ReadFile copies up to `len` bytes from `offset` of the file into `buf`.
+// Returns bytes copied.
+size_t ReadFile(const DirectoryEntry &entry, size_t offset, void *buf, size_t len);
+
+// the functions below update the volume. Changes are kept in the block cache
+// and written to the device by Sync (write-back).
+
+// CreateFile creates an empty file at `path`, or returns the existing one.
+// The parent directory must exist, and the name must fit in 8.3.
+WithError<DirectoryEntry *> CreateFile(const char *path);
+// WriteFile writes `len` bytes at `offset`, allocating clusters as needed.
+// A gap after the current end is zero filled.
+WithError<size_t> WriteFile(DirectoryEntry &entry, size_t offset, const void *buf, size_t len);
+// TruncateFile shrinks or zero extends the file to `size` bytes
+Error TruncateFile(DirectoryEntry &entry, size_t size);
+// DeleteFile removes the file and frees its clusters. Directories can't be removed.
+Error DeleteFile(const char *path);
+// Sync updates the fat mirrors and FSInfo, and flushes the block cache
+Error Sync();
+// VolumeStat is the space usage, from the fat index built at mount
+struct VolumeStat {
+    unsigned long total_clusters, free_clusters;
+    size_t chain_runs; // runs of 2 or more contiguous clusters in chains
+};
+
+VolumeStat GetVolumeStat();
+// ContiguousClusters returns how many clusters from `cluster` are contiguous
+// in its chain, counting itself
+unsigned long ContiguousClusters(unsigned long cluster);
+// SetReadAheadHandler registers a function to which sequential readers hand
+// device byte ranges to prefetch, usually queueing them to a background task
+void SetReadAheadHandler(void (*handler)(uint64_t offset, size_t len));
+// Prefetch loads the device range into the block cache. It must not be preempted
+// by other fat calls, and returns false if it interrupted one.
+bool Prefetch(uint64_t offset, size_t len);
+// SetChangeHandler registers a function called before the contents of a file
+// (identified by its first cluster) are modified
+void SetChangeHandler(void (*handler)(unsigned long first_cluster));
+// FindFile resolves `path` relative to `dir_cluster` (0 means root),
+// such as "a/b/file.txt" or "/dir/long file name.txt".
+// Names are compared case insensitively to both long and 8.3 names.
+DirectoryEntry *FindFile(const char *path, unsigned long dir_cluster=0);
 bool NameIsEqual(const DirectoryEntry &entry, const char *name);
 
 } // namespace fat
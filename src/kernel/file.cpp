@@ -0,0 +1,159 @@
+#include "file.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <memory>
+
+#include "channel.hpp"
+#include "fat.hpp"
+#include "task.hpp"
+#include "terminal.hpp"
+
+namespace {
+    // fd 0-2 are reserved for stdin, stdout and stderr
+    const int kFirstFD = 3;
+    // bytes per terminal_output record
+    const size_t kOutputRecordBytes = 256;
+
+    std::shared_ptr<FileDescriptor> findFD(int fd) {
+        auto &files = task_manager->CurrentTask().Files();
+        if (fd < kFirstFD || fd >= static_cast<int>(files.size())) {
+            return nullptr;
+        }
+        return files[fd];
+    }
+
+    // writeOutput sends stdout and stderr to the terminal. The terminal prints
+    // them when it handles the doorbell, which is after the app returns
+    // while the app runs on the terminal task, or when the ring gets full.
+    long writeOutput(const void *buf, size_t len) {
+        if (!terminal_output) {
+            return -EBADF;
+        }
+
+        auto p = reinterpret_cast<const char *>(buf);
+        size_t written = 0;
+        while (written < len) {
+            const size_t n = std::min(len - written, kOutputRecordBytes);
+            auto err = terminal_output->Write(p + written, n);
+            if (err.Cause() == Error::kFull) {
+                // no one else drains it while the app runs on the terminal task
+                FlushTerminalOutput();
+                err = terminal_output->Write(p + written, n);
+            }
+            if (err) {
+                // the terminal hasn't caught up
+                return written > 0 ? written : -EAGAIN;
+            }
+            written += n;
+        }
+        return written;
+    }
+}
+
+extern "C" int OpenFD(const char *path, int flags) {
+    auto entry = fat::FindFile(path);
+    if (!entry && (flags & kOpenCreate)) {
+        auto [created, err] = fat::CreateFile(path);
+        if (err) {
+            return err.Cause() == Error::kFull ? -ENOSPC : -EINVAL;
+        }
+        entry = created;
+    }
+    if (!entry) {
+        return -ENOENT;
+    }
+    if ((static_cast<uint8_t>(entry->attr) & static_cast<uint8_t>(fat::Attribute::kDirectory)) != 0) {
+        return -EISDIR;
+    }
+    if ((flags & kOpenTruncate) && (flags & kOpenWrite)) {
+        if (auto err = fat::TruncateFile(*entry, 0)) {
+            return -EIO;
+        }
+    }
+
+    auto &files = task_manager->CurrentTask().Files();
+    if (files.size() < kFirstFD) {
+        files.resize(kFirstFD);
+    }
+
+    // reuse the lowest closed slot
+    int fd = kFirstFD;
+    while (fd < static_cast<int>(files.size()) && files[fd]) {
+        ++fd;
+    }
+    if (fd == static_cast<int>(files.size())) {
+        files.emplace_back();
+    }
+
+    files[fd] = std::make_shared<fat::FileDescriptor>(*entry);
+    files[fd]->SetOpenFlags(flags);
+    return fd;
+}
+
+extern "C" long ReadFD(int fd, void *buf, size_t len) {
+    auto file = findFD(fd);
+    if (!file || !(file->OpenFlags() & kOpenRead)) {
+        return -EBADF;
+    }
+    return file->Read(buf, len);
+}
+
+extern "C" long WriteFD(int fd, const void *buf, size_t len) {
+    if (fd == 1 || fd == 2) {
+        return writeOutput(buf, len);
+    }
+
+    auto file = findFD(fd);
+    if (!file || !(file->OpenFlags() & kOpenWrite)) {
+        return -EBADF;
+    }
+    if (file->OpenFlags() & kOpenAppend) {
+        file->Seek(0, FileDescriptor::kSeekEnd);
+    }
+
+    auto [n, err] = file->Write(buf, len);
+    if (err && n == 0) {
+        return err.Cause() == Error::kFull ? -ENOSPC : -EIO;
+    }
+    return n;
+}
+
+extern "C" long PReadFD(int fd, void *buf, size_t len, size_t offset) {
+    auto file = findFD(fd);
+    if (!file || !(file->OpenFlags() & kOpenRead)) {
+        return -EBADF;
+    }
+    return file->PRead(buf, len, offset);
+}
+
+extern "C" long SeekFD(int fd, long offset, int whence) {
+    auto file = findFD(fd);
+    if (!file) {
+        return -EBADF;
+    }
+
+    auto [pos, err] = file->Seek(offset, static_cast<FileDescriptor::Whence>(whence));
+    if (err) {
+        return -EINVAL;
+    }
+    return pos;
+}
+
+extern "C" long SizeFD(int fd) {
+    auto file = findFD(fd);
+    if (!file) {
+        return -EBADF;
+    }
+    return file->Size();
+}
+
+extern "C" int CloseFD(int fd) {
+    auto file = findFD(fd);
+    if (!file) {
+        return -EBADF;
+    }
+
+    task_manager->CurrentTask().Files()[fd].reset();
+    return 0;
+}
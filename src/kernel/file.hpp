@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "error.hpp"
+#include "file_flags.h"
+
+// FileDescriptor is an open file, read through a current position
+class FileDescriptor {
+public:
+    enum Whence {
+        kSeekSet = 0,
+        kSeekCur = 1,
+        kSeekEnd = 2,
+    };
+
+    virtual ~FileDescriptor() = default;
+
+    // Read copies up to `len` bytes from the current position, and advances it
+    virtual size_t Read(void *buf, size_t len) = 0;
+    // PRead copies up to `len` bytes from `offset`. The position is unchanged.
+    virtual size_t PRead(void *buf, size_t len, size_t offset) const = 0;
+    // Write copies `len` bytes at the current position, and advances it
+    virtual WithError<size_t> Write(const void *buf, size_t len) = 0;
+    // Seek moves the position and returns the new one
+    virtual WithError<size_t> Seek(int64_t offset, Whence whence) = 0;
+    virtual size_t Size() const = 0;
+
+    // OpenFlags are the kOpen* flags given to OpenFD
+    int OpenFlags() const { return open_flags_; }
+    void SetOpenFlags(int flags) { open_flags_ = flags; }
+
+private:
+    int open_flags_{0};
+};
+
+// the calls below work on the descriptor table of the current task,
+// returning negative errno on failure
+
+// OpenFD opens the file at `path` and returns the fd
+extern "C" int OpenFD(const char *path, int flags);
+extern "C" long ReadFD(int fd, void *buf, size_t len);
+extern "C" long WriteFD(int fd, const void *buf, size_t len);
+extern "C" long PReadFD(int fd, void *buf, size_t len, size_t offset);
+extern "C" long SeekFD(int fd, long offset, int whence);
+extern "C" long SizeFD(int fd);
+extern "C" int CloseFD(int fd);
@@ -0,0 +1,10 @@
+#pragma once
+
+// flags of OpenFD (file.hpp). C compatible, also used by newlib_support.c
+enum {
+    kOpenCreate = 1, // create the file if not exists
+    kOpenTruncate = 2, // truncate to 0 bytes, if opened for writing
+    kOpenRead = 4,
+    kOpenWrite = 8,
+    kOpenAppend = 16, // every write goes to the end
+};
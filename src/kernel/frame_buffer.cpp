@@ -1,4 +1,5 @@
 #include <cstring>
+#include <emmintrin.h>
 
 #include "frame_buffer.hpp"
 
@@ -41,6 +42,35 @@ namespace {
         return config.frame_buffer + bytesPerPixel(config.pixel_format) *
             (pos.x + config.pixels_per_scan_line * pos.y);
     }
+
+    // streamCopy copies with non-temporal stores that bypass the cache.
+    // The frame buffer is mapped write-combining, so this fills whole
+    // WC lines instead of reading VRAM back into the cache.
+    // Caller must issue _mm_sfence() after the last streamCopy.
+    void streamCopy(uint8_t *dst, const uint8_t *src, size_t bytes) {
+        // 4 byte (1 pixel) stores until dst is 16 byte aligned
+        while ((reinterpret_cast<uintptr_t>(dst) & 0xf) != 0 && bytes >= 4) {
+            int v;
+            memcpy(&v, src, 4);
+            _mm_stream_si32(reinterpret_cast<int *>(dst), v);
+            dst += 4;
+            src += 4;
+            bytes -= 4;
+        }
+
+        for (; bytes >= 16; dst += 16, src += 16, bytes -= 16) {
+            const auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+            _mm_stream_si128(reinterpret_cast<__m128i *>(dst), v);
+        }
+
+        for (; bytes >= 4; dst += 4, src += 4, bytes -= 4) {
+            int v;
+            memcpy(&v, src, 4);
+            _mm_stream_si32(reinterpret_cast<int *>(dst), v);
+        }
+
+        memcpy(dst, src, bytes);
+    }
 }
 
 
@@ -96,10 +126,11 @@ Error FrameBuffer::Copy(Vector2D<int> pos, const FrameBuffer &src) {
     const uint8_t *src_buf = frameAddrAt({0, 0}, src.config_);
 
     for (int dy = dst_start.y; dy < dst_end.y; ++dy) {
-        memcpy(dst_buf, src_buf, bytes_per_pixel * (dst_end.x - dst_start.x));
+        copyLine(dst_buf, src_buf, bytes_per_pixel * (dst_end.x - dst_start.x));
         dst_buf += bytesPerScanLine(config_);
         src_buf += bytesPerScanLine(src.config_);
     }
+    finishCopy();
 
     return MAKE_ERROR(Error::kSuccess);
 }
@@ -126,14 +157,30 @@ Error FrameBuffer::Copy(Vector2D<int> pos, const FrameBuffer &src, const Rectang
     const uint8_t *src_buf = frameAddrAt(src_start_pos, src.config_);
 
     for (int dy = 0; dy < copy_area.size.y; ++dy) {
-        memcpy(dst_buf, src_buf, bytes_per_pixel * copy_area.size.x);
+        copyLine(dst_buf, src_buf, bytes_per_pixel * copy_area.size.x);
         dst_buf += bytesPerScanLine(config_);
         src_buf += bytesPerScanLine(src.config_);
     }
+    finishCopy();
 
     return MAKE_ERROR(Error::kSuccess);
 }
 
+void FrameBuffer::copyLine(uint8_t *dst, const uint8_t *src, size_t bytes) const {
+    if (IsDeviceMemory()) {
+        streamCopy(dst, src, bytes);
+    } else {
+        memcpy(dst, src, bytes);
+    }
+}
+
+void FrameBuffer::finishCopy() const {
+    if (IsDeviceMemory()) {
+        // make streaming stores globally visible
+        _mm_sfence();
+    }
+}
+
 void FrameBuffer::Move(Vector2D<int> dst_pos, const Rectangle<int> &src) {
     const auto bytes_per_pixel = bytesPerPixel(config_.pixel_format);
     const auto bytes_per_scan_line = bytesPerScanLine(config_);
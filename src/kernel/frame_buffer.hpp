@@ -14,6 +14,9 @@ private:
     std::vector<uint8_t> buffer_{};
     std::unique_ptr<FrameBufferWriter> writer_{};
 
+    void copyLine(uint8_t *dst, const uint8_t *src, size_t bytes) const;
+    void finishCopy() const;
+
 public:
     Error Initialize(const FrameBufferConfig &config);
     Error Copy(Vector2D<int> pos, const FrameBuffer &src);
@@ -27,4 +30,15 @@ public:
     const FrameBufferConfig &Config() const {
         return config_;
     }
+
+    // IsDeviceMemory reports whether this buffer is the real (GOP) frame buffer
+    // rather than a memory-backed one like back buffers
+    bool IsDeviceMemory() const {
+        return buffer_.empty();
+    }
+
+    // BufferBytes returns bytes of memory owned by this buffer
+    size_t BufferBytes() const {
+        return buffer_.size();
+    }
 };
@@ -3,6 +3,10 @@
 #include "asmfunc.h"
 #include "timer.hpp"
 #include "task.hpp"
+#include "logger.hpp"
+#include "address_space.hpp"
+#include "softirq.hpp"
+#include "exception.hpp"
 
 std::array<InterruptDescriptor, 256> idt;
 
@@ -23,11 +27,28 @@ void NotifyEndOfInterrupt() {
 }
 
 
+uint32_t LocalAPICID() {
+    return *reinterpret_cast<volatile uint32_t *>(0xfee00020) >> 24;
+}
+
+
 namespace {
     __attribute__((interrupt))
     void intHandlerXHCI(InterruptFrame* frame) {
-        task_manager->SendMessage(1, Message{Message::kInterruptXHCI});
+        IRQStatScope stat{InterruptVector::kXHCI};
+        RaiseSoftirq(Softirq::kXHCI);
+        NotifyEndOfInterrupt();
+        stat.Stop();
+        PreemptForSoftirq();
+    }
+
+    __attribute__((interrupt))
+    void intHandlerXHCIInput(InterruptFrame* frame) {
+        IRQStatScope stat{InterruptVector::kXHCIInput};
+        RaiseSoftirq(Softirq::kXHCIInput);
         NotifyEndOfInterrupt();
+        stat.Stop();
+        PreemptForSoftirq();
     }
 
     __attribute__((interrupt))
@@ -37,9 +58,13 @@ namespace {
 }
 
 void InitializeInterrupt() {
+    // CPU exceptions, including page fault
+    InitializeExceptions();
     // USB
     SetIDTEntry(idt[InterruptVector::kXHCI], MakeIDTAttr(DescriptorType::kInterruptGate, 0),
         reinterpret_cast<uint64_t>(intHandlerXHCI), kKernelCS);
+    SetIDTEntry(idt[InterruptVector::kXHCIInput], MakeIDTAttr(DescriptorType::kInterruptGate, 0),
+        reinterpret_cast<uint64_t>(intHandlerXHCIInput), kKernelCS);
     // Timer
     SetIDTEntry(idt[InterruptVector::kLAPICTimer], MakeIDTAttr(DescriptorType::kInterruptGate, 0),
         reinterpret_cast<uint64_t>(intHandlerLAPICTimer), kKernelCS);
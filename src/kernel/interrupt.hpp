@@ -6,6 +6,7 @@
 
 #include "x86_descriptor.hpp"
 #include "message.hpp"
+#include "irqstat.hpp"
 
 struct InterruptFrame {
     uint64_t rip;
@@ -39,8 +40,11 @@ struct InterruptDescriptor {
 class InterruptVector {
 public:
     enum Number {
+        kPageFault = 0x0e,
         kXHCI = 0x40,
         kLAPICTimer = 0x41,
+        // xHCI interrupter for HID input, with MSI-X
+        kXHCIInput = 0x42,
     };
 };
 
@@ -52,6 +56,36 @@ void SetIDTEntry(InterruptDescriptor& desc,
                  uint16_t segment_selector);
 // Write to mem directly, to tell CPU interrupt end
 void NotifyEndOfInterrupt();
+// LocalAPICID returns the local APIC ID of the current CPU
+uint32_t LocalAPICID();
+
+// InterruptGuard disables interrupts on the current CPU while it's alive,
+// then restores the previous interrupt flag (so it can be nested).
+class InterruptGuard {
+public:
+    InterruptGuard() {
+        __asm__ volatile("pushfq\n\tpopq %0\n\tcli" : "=r"(rflags_) :: "memory");
+        if (rflags_ & 0x200) {
+            irq_off_start = ReadTSC();
+        }
+    }
+
+    // always inlined: the window is recorded at the RIP of the guard's scope
+    __attribute__((always_inline)) ~InterruptGuard() {
+        if (rflags_ & 0x200) { // IF
+            uintptr_t rip;
+            __asm__ volatile("leaq (%%rip), %0" : "=r"(rip));
+            RecordIRQOffWindow(rip);
+            __asm__ volatile("sti" ::: "memory");
+        }
+    }
+
+    InterruptGuard(const InterruptGuard &) = delete;
+    InterruptGuard &operator =(const InterruptGuard &) = delete;
+
+private:
+    uint64_t rflags_;
+};
 
 constexpr InterruptDescriptorAttribute MakeIDTAttr(
     DescriptorType type,
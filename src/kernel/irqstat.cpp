@@ -0,0 +1,62 @@
+#include "irqstat.hpp"
+
+#include <algorithm>
+
+uint64_t irq_off_start;
+
+namespace {
+    std::array<IRQStat, 256> irq_stats;
+    std::array<IRQOffWindow, kIRQOffWindows> irq_off_windows;
+
+    int log2Bucket(uint64_t cycles) {
+        if (cycles == 0) {
+            return 0;
+        }
+        return std::min(63 - __builtin_clzll(cycles), kIRQHistogramBuckets - 1);
+    }
+}
+
+void RecordIRQ(uint8_t vector, uint64_t cycles) {
+    auto &stat = irq_stats[vector];
+    ++stat.count;
+    stat.total_cycles += cycles;
+    stat.max_cycles = std::max(stat.max_cycles, cycles);
+    ++stat.histogram[log2Bucket(cycles)];
+}
+
+const IRQStat &GetIRQStat(uint8_t vector) {
+    return irq_stats[vector];
+}
+
+void RecordIRQOffWindow(uintptr_t rip) {
+    if (irq_off_start == 0) {
+        return;
+    }
+    const uint64_t cycles = ReadTSC() - irq_off_start;
+    irq_off_start = 0;
+
+    // keep the longest one of each place, so a frequent one doesn't fill all
+    auto it = std::find_if(irq_off_windows.begin(), irq_off_windows.end(),
+                           [rip](const IRQOffWindow &w) { return w.rip == rip; });
+    if (it == irq_off_windows.end()) {
+        it = std::min_element(irq_off_windows.begin(), irq_off_windows.end(),
+                              [](const IRQOffWindow &a, const IRQOffWindow &b) {
+                                  return a.cycles < b.cycles;
+                              });
+    }
+    if (cycles > it->cycles) {
+        *it = {cycles, rip};
+    }
+}
+
+std::array<IRQOffWindow, kIRQOffWindows> IRQOffWindows() {
+    auto windows = irq_off_windows;
+    std::sort(windows.begin(), windows.end(),
+              [](const IRQOffWindow &a, const IRQOffWindow &b) { return a.cycles > b.cycles; });
+    return windows;
+}
+
+void ResetIRQStats() {
+    irq_stats = {};
+    irq_off_windows = {};
+}
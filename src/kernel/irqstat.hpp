@@ -0,0 +1,66 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Interrupt statistics: how often each vector fires and how long its
+// handler runs, and the longest windows with interrupts disabled by
+// InterruptGuard. Durations are in TSC cycles.
+
+inline uint64_t ReadTSC() {
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return (static_cast<uint64_t>(hi) << 32) | lo;
+}
+
+// bucket i counts durations in [2^i, 2^(i+1)) cycles
+const int kIRQHistogramBuckets = 32;
+const size_t kIRQOffWindows = 8;
+
+struct IRQStat {
+    uint64_t count;
+    uint64_t total_cycles;
+    uint64_t max_cycles;
+    std::array<uint32_t, kIRQHistogramBuckets> histogram;
+};
+
+struct IRQOffWindow {
+    uint64_t cycles;
+    uintptr_t rip; // where interrupts were enabled again
+};
+
+// RecordIRQ adds a run of the handler of `vector`. Called with interrupts disabled.
+void RecordIRQ(uint8_t vector, uint64_t cycles);
+const IRQStat &GetIRQStat(uint8_t vector);
+// IRQOffWindows returns the longest windows, one per place, longest first
+std::array<IRQOffWindow, kIRQOffWindows> IRQOffWindows();
+void ResetIRQStats();
+
+// start of the current interrupts-disabled window, 0 when not tracked.
+// A task switch drops it, as the next task runs with its own interrupt flag.
+extern uint64_t irq_off_start;
+// RecordIRQOffWindow ends the window from irq_off_start, just before sti
+void RecordIRQOffWindow(uintptr_t rip);
+
+// IRQStatScope measures an interrupt handler until Stop or the end of the scope.
+// Handlers which may switch tasks call Stop before that.
+class IRQStatScope {
+public:
+    explicit IRQStatScope(uint8_t vector) : vector_{vector}, start_{ReadTSC()} {}
+    ~IRQStatScope() { Stop(); }
+
+    void Stop() {
+        if (start_ != 0) {
+            RecordIRQ(vector_, ReadTSC() - start_);
+            start_ = 0;
+        }
+    }
+
+    IRQStatScope(const IRQStatScope &) = delete;
+    IRQStatScope &operator =(const IRQStatScope &) = delete;
+
+private:
+    uint8_t vector_;
+    uint64_t start_;
+};
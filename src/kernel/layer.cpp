@@ -1,6 +1,16 @@
 #include "layer.hpp"
 #include "console.hpp"
 #include "logger.hpp"
+#include "trace.hpp"
+
+namespace {
+    const uint32_t kTraceAreaID = ~0u;
+
+    uint64_t traceSize(const Rectangle<int> &area) {
+        return static_cast<uint64_t>(static_cast<uint32_t>(area.size.x)) << 32 |
+               static_cast<uint32_t>(area.size.y);
+    }
+}
 
 extern int printk(const char* format, ...);
 
@@ -79,12 +89,14 @@ Layer &LayerManager::NewLayer() {
 }
 
 void LayerManager::Draw(const Rectangle<int> &area) const {
+    Trace(TraceEvent::kDrawBegin, kTraceAreaID, traceSize(area));
     for (auto layer: layer_stack_) {
         layer->DrawTo(back_buffer_, area);
     }
 
     // copy to front
     screen_->Copy(area.pos, back_buffer_, area);
+    Trace(TraceEvent::kDrawEnd, kTraceAreaID);
 }
 
 void LayerManager::Draw(unsigned int id) const {
@@ -92,6 +104,7 @@ void LayerManager::Draw(unsigned int id) const {
 }
 
 void LayerManager::Draw(unsigned int id, Rectangle<int> area) const {
+    Trace(TraceEvent::kDrawBegin, id, traceSize(area));
     bool draw = false;
     Rectangle<int> window_area;
 
@@ -117,6 +130,7 @@ void LayerManager::Draw(unsigned int id, Rectangle<int> area) const {
 
     // copy to front
     screen_->Copy(window_area.pos, back_buffer_, window_area);
+    Trace(TraceEvent::kDrawEnd, id);
 }
 
 void LayerManager::Move(unsigned int id, Vector2D<int> new_position) {
@@ -215,6 +229,17 @@ Layer *LayerManager::FindLayerByPosition(Vector2D<int> pos, unsigned int exclude
     return *it;
 }
 
+size_t LayerManager::MemoryBytes() const {
+    size_t bytes = back_buffer_.BufferBytes();
+    for (const auto &layer : layers_) {
+        if (auto window = layer->GetWindow()) {
+            bytes += window->MemoryBytes();
+        }
+    }
+
+    return bytes;
+}
+
 void LayerManager::dumpLayerStack() const {
     printk("layer_stack_ (", layer_stack_.size());
     for (auto l : layer_stack_) {
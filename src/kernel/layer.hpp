@@ -74,6 +74,8 @@ public:
     int GetHeight(unsigned int id);
 
     Layer* FindLayer(unsigned int id);
+    // MemoryBytes returns bytes used by windows of all layers and the back buffer
+    size_t MemoryBytes() const;
     Layer *FindLayerByPosition(Vector2D<int> pos, unsigned int exclude_id) const;
 };
 
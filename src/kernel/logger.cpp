@@ -1,31 +1,199 @@
 #include <cstdio>
+#include <cstring>
+#include <cstdarg>
+#include <atomic>
+#include <array>
 
 #include "logger.hpp"
 #include "console.hpp"
+#include "queue.hpp"
+#include "interrupt.hpp"
+#include "layer.hpp"
+#include "task.hpp"
+#include "timer.hpp"
 
 extern Console* console;
 
 namespace {
-    LogLevel log_level = kWarn;
-}
+    // messages per second of each subsystem
+    const uint32_t kLogRateLimit = 50;
+    const size_t kLogEntryBytes = 192;
+    const size_t kLogQueueCapacity = 128;
+    // console output of the log task is batched up to this, then drawn once
+    const size_t kLogBatchBytes = 2048;
+    // the batch buffer and rendering need more than the default stack
+    const size_t kLogTaskStackBytes = 16 * 1024;
 
-void SetLogLevel(LogLevel level) {
-    log_level = level;
+    struct LogEntry {
+        char text[kLogEntryBytes];
+    };
+
+    struct SubsystemState {
+        LogLevel level{kWarn};
+        // fixed window rate limit: messages logged in the current second
+        std::atomic<uint64_t> window{0};
+        std::atomic<uint32_t> count{0};
+        // dropped since the log task last reported
+        std::atomic<uint32_t> suppressed{0};
+    };
+
+    const char *subsystem_names[kLogSubsystemCount] = {"kernel", "usb", "fs", "memory"};
+
+    std::array<SubsystemState, kLogSubsystemCount> subsystems;
+    MPSCQueue<LogEntry, kLogQueueCapacity> log_queue;
+    std::atomic<uint64_t> queued{0}, dropped_full{0}, dropped_rate{0};
+    Task *log_task;
+
+    bool withinRate(SubsystemState &state) {
+        if (!timer_manager) {
+            return true;
+        }
+        const uint64_t window = timer_manager->CurrentTick() / kTimerFreq;
+        if (state.window.load(std::memory_order_relaxed) != window) {
+            // racy, at worst a few more messages pass in the new second
+            state.window.store(window, std::memory_order_relaxed);
+            state.count.store(0, std::memory_order_relaxed);
+        }
+        return state.count.fetch_add(1, std::memory_order_relaxed) < kLogRateLimit;
+    }
+
+    // drain renders up to kLogBatchBytes of queued messages into the console
+    // window at once, and returns false if the queue was empty.
+    // The layer is not drawn.
+    bool drain() {
+        char buf[kLogBatchBytes + 1];
+        size_t len = 0;
+
+        for (size_t i = 0; i < kLogSubsystemCount; ++i) {
+            if (auto n = subsystems[i].suppressed.exchange(0)) {
+                len += snprintf(buf + len, sizeof(buf) - len,
+                                "[%s: %u messages suppressed]\n", subsystem_names[i], n);
+            }
+        }
+        while (!log_queue.Empty()) {
+            const auto &text = log_queue.Front().text;
+            const size_t n = strnlen(text, kLogEntryBytes);
+            if (len + n > kLogBatchBytes) {
+                break;
+            }
+            memcpy(buf + len, text, n);
+            len += n;
+            log_queue.Pop();
+        }
+        if (len == 0) {
+            return false;
+        }
+
+        buf[len] = '\0';
+        console->Render(buf);
+        return true;
+    }
+
+    void LogTask(uint64_t task_id, int64_t data) {
+        Task &task = task_manager->CurrentTask();
+        while (true) {
+            if (drain()) {
+                // layers are drawn by the main task only. waiting for it keeps
+                // the next batch from being rendered while the window is drawn.
+                const auto msg = MakeLayerMessage(
+                    task_id, console->LayerID(), LayerOperation::Draw, {});
+                if (auto err = task_manager->Call(1, msg).error) {
+                    // logging it would come back here
+                    console->Render("log: failed to draw the console\n");
+                }
+                continue;
+            }
+            // check again with interrupts disabled, then sleep until Log wakes us
+            InterruptGuard guard;
+            if (log_queue.Empty()) {
+                task.Sleep();
+            }
+        }
+    }
 }
 
-int Log(LogLevel level, const char* format, ...) {
-    if (level > log_level) {
+int VLog(LogSubsystem subsystem, LogLevel level, const char *format, va_list ap) {
+    auto &state = subsystems[subsystem];
+    if (level > state.level) {
         return 0;
     }
 
-    va_list ap;
-    int result;
-    char s[1024];
+    if (!log_task) {
+        char s[1024];
+        const int result = vsnprintf(s, sizeof(s), format, ap);
+        console->PutString(s);
+        return result;
+    }
+
+    if (level != kError && !withinRate(state)) {
+        ++state.suppressed;
+        ++dropped_rate;
+        return 0;
+    }
+
+    LogEntry entry;
+    const int result = vsnprintf(entry.text, sizeof(entry.text), format, ap);
+    if (log_queue.Push(entry)) {
+        ++state.suppressed;
+        ++dropped_full;
+        return 0;
+    }
+    ++queued;
+
+    InterruptGuard guard;
+    log_task->Wakeup();
+    return result;
+}
 
+void SetLogLevel(LogLevel level) {
+    for (auto &state : subsystems) {
+        state.level = level;
+    }
+}
+
+void SetLogLevel(LogSubsystem subsystem, LogLevel level) {
+    subsystems[subsystem].level = level;
+}
+
+LogLevel GetLogLevel(LogSubsystem subsystem) {
+    return subsystems[subsystem].level;
+}
+
+const char *LogSubsystemName(LogSubsystem subsystem) {
+    return subsystem_names[subsystem];
+}
+
+int Log(LogLevel level, const char* format, ...) {
+    va_list ap;
     va_start(ap, format);
-    result = vsprintf(s, format, ap);
+    const int result = VLog(kLogKernel, level, format, ap);
     va_end(ap);
+    return result;
+}
 
-    console->PutString(s);
+int Log(LogSubsystem subsystem, LogLevel level, const char* format, ...) {
+    va_list ap;
+    va_start(ap, format);
+    const int result = VLog(subsystem, level, format, ap);
+    va_end(ap);
     return result;
 }
+
+LogStat GetLogStat() {
+    return {queued.load(), dropped_full.load(), dropped_rate.load()};
+}
+
+void FlushLog() {
+    // only on a crash: no other task draws layers again
+    while (drain()) {}
+    if (layer_manager) {
+        layer_manager->Draw(console->LayerID());
+    }
+}
+
+void InitializeLogTask() {
+    log_task = &task_manager->NewTask()
+        .InitContext(LogTask, 0, kLogTaskStackBytes);
+    // level 0, with the idle task: logging doesn't take time from others
+    task_manager->Wakeup(log_task, 0);
+}
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <cstdarg>
+#include <cstdint>
+
 enum LogLevel {
     kError = 3,
     kWarn = 4,
@@ -7,5 +10,38 @@ enum LogLevel {
     kDebug = 7,
 };
 
+// LogSubsystem has its own level and rate limit
+enum LogSubsystem {
+    kLogKernel,
+    kLogUSB,
+    kLogFS,
+    kLogMemory,
+    kLogSubsystemCount,
+};
+
+// SetLogLevel sets the level of all subsystems
 void SetLogLevel(LogLevel level);
+void SetLogLevel(LogSubsystem subsystem, LogLevel level);
+LogLevel GetLogLevel(LogSubsystem subsystem);
+const char *LogSubsystemName(LogSubsystem subsystem);
+
+// Log formats a message and queues it for the log task, which renders it
+// to the console later. Messages beyond the rate limit of the subsystem are
+// dropped and counted, except errors. Before the log task starts,
+// messages are rendered right away.
 int Log(LogLevel level, const char* format, ...);
+int Log(LogSubsystem subsystem, LogLevel level, const char* format, ...);
+int VLog(LogSubsystem subsystem, LogLevel level, const char* format, va_list ap);
+
+struct LogStat {
+    uint64_t queued;
+    uint64_t dropped_full; // the queue was full
+    uint64_t dropped_rate; // over the rate limit
+};
+LogStat GetLogStat();
+
+// FlushLog renders the queued messages and draws the console layer on the
+// caller. Only for a crash, which never returns to other tasks.
+void FlushLog();
+// InitializeLogTask starts the low priority task rendering the messages
+void InitializeLogTask();
@@ -0,0 +1,78 @@
+#include "lz4.hpp"
+
+#include <cstring>
+
+namespace lz4 {
+
+namespace {
+    const size_t kMinMatch = 4;
+
+    // readLength adds the extension bytes that follow a nibble of 15
+    bool readLength(const uint8_t *&p, const uint8_t *end, size_t &len) {
+        if (len != 15) {
+            return true;
+        }
+        uint8_t b;
+        do {
+            if (p == end) {
+                return false;
+            }
+            b = *p++;
+            len += b;
+        } while (b == 255);
+        return true;
+    }
+}
+
+WithError<size_t> Decompress(const uint8_t *src, size_t src_len, uint8_t *dst, size_t dst_len) {
+    const uint8_t *p = src;
+    const uint8_t *const end = src + src_len;
+    uint8_t *q = dst;
+    uint8_t *const dst_end = dst + dst_len;
+
+    while (p < end) {
+        const uint8_t token = *p++;
+
+        size_t literals = token >> 4;
+        if (!readLength(p, end, literals) ||
+            literals > static_cast<size_t>(end - p) || literals > static_cast<size_t>(dst_end - q)) {
+            return {0, MAKE_ERROR(Error::kInvalidFile)};
+        }
+        memcpy(q, p, literals);
+        p += literals;
+        q += literals;
+        if (p == end) {
+            break; // the last sequence has literals only
+        }
+
+        if (end - p < 2) {
+            return {0, MAKE_ERROR(Error::kInvalidFile)};
+        }
+        const size_t offset = p[0] | (p[1] << 8);
+        p += 2;
+        size_t match = token & 0x0f;
+        if (!readLength(p, end, match)) {
+            return {0, MAKE_ERROR(Error::kInvalidFile)};
+        }
+        match += kMinMatch;
+        if (offset == 0 || offset > static_cast<size_t>(q - dst) ||
+            match > static_cast<size_t>(dst_end - q)) {
+            return {0, MAKE_ERROR(Error::kInvalidFile)};
+        }
+
+        // the match may overlap the output, which repeats the last `offset` bytes
+        const uint8_t *m = q - offset;
+        if (offset >= match) {
+            memcpy(q, m, match);
+            q += match;
+        } else {
+            for (size_t i = 0; i < match; ++i) {
+                *q++ = *m++;
+            }
+        }
+    }
+
+    return {static_cast<size_t>(q - dst), MAKE_ERROR(Error::kSuccess)};
+}
+
+} // namespace lz4
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "error.hpp"
+
+namespace lz4 {
+
+// Decompress expands `src` in the LZ4 block format (without a frame) into `dst`,
+// and returns the number of bytes written
+WithError<size_t> Decompress(const uint8_t *src, size_t src_len, uint8_t *dst, size_t dst_len);
+
+} // namespace lz4
@@ -2,6 +2,8 @@
 #include <cstddef>
 #include <cstdio>
 #include <deque>
+#include <array>
+#include <algorithm>
 
 #include "frame_buffer_config.hpp"
 #include "memory_map.hpp"
@@ -26,6 +28,10 @@
 #include "task.hpp"
 #include "terminal.hpp"
 #include "fat.hpp"
+#include "page_cache.hpp"
+#include "readahead.hpp"
+#include "softirq.hpp"
+#include "exception.hpp"
 
 #include "usb/device.hpp"
 #include "usb/memory.hpp"
@@ -39,16 +45,16 @@ int printk(const char* format, ...);
 void operator delete(void* obj) noexcept {}
 
 
+// printk always prints. It goes through the log task as errors do,
+// which is the only one rendering into the console once it runs.
 int printk(const char* format, ...) {
     va_list ap;
     int result;
-    char s[1024];
 
     va_start(ap, format);
-    result = vsprintf(s, format, ap);
+    result = VLog(kLogKernel, kError, format, ap);
     va_end(ap);
 
-    console->PutString(s);
     return result;
 }
 
@@ -134,6 +140,46 @@ void InputTextWindow(char c) {
 }
 
 
+// CoalesceMessages merges consecutive messages of a batch which one handling
+// covers, and returns the new count:
+// - mouse moves with the same buttons, into the sum of the moves
+// - DrawArea requests of a task for the same layer, into the bounding box.
+//   The one kLayerFinish then acknowledges all of them.
+size_t CoalesceMessages(Message *msgs, size_t count) {
+    auto mergeable_draw = [](const Message &a, const Message &b) {
+        return a.type == Message::kLayer && b.type == Message::kLayer &&
+            a.arg.layer.op == LayerOperation::DrawArea && b.arg.layer.op == LayerOperation::DrawArea &&
+            a.src_task == b.src_task && a.arg.layer.layer_id == b.arg.layer.layer_id;
+    };
+
+    size_t n = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const auto &msg = msgs[i];
+        if (n > 0 && msg.type == Message::kMouseMove && msgs[n - 1].type == Message::kMouseMove &&
+            msg.arg.mouse.buttons == msgs[n - 1].arg.mouse.buttons) {
+            msgs[n - 1].arg.mouse.dx += msg.arg.mouse.dx;
+            msgs[n - 1].arg.mouse.dy += msg.arg.mouse.dy;
+            continue;
+        }
+
+        if (n > 0 && mergeable_draw(msgs[n - 1], msg)) {
+            auto &to = msgs[n - 1].arg.layer;
+            const auto &from = msg.arg.layer;
+            const int x = std::min(to.x, from.x);
+            const int y = std::min(to.y, from.y);
+            to.w = std::max(to.x + to.w, from.x + from.w) - x;
+            to.h = std::max(to.y + to.h, from.y + from.h) - y;
+            to.x = x;
+            to.y = y;
+            continue;
+        }
+
+        msgs[n++] = msg;
+    }
+    return n;
+}
+
+
 alignas(16) uint8_t kernel_main_stack[1024*1024];
 
 extern "C"
@@ -150,17 +196,23 @@ void KernelMainNewStack(
     InitializeConsole();
 
     printk("Welcome to MikanOS!\n");
-    SetLogLevel(kDebug);
 
     InitializeSegmentation();
     InitializePaging();
+    // VRAM is uncached by default, which makes every front buffer copy slow
+    SetWriteCombining(
+        reinterpret_cast<uintptr_t>(frame_buffer_config_ref.frame_buffer),
+        4 * frame_buffer_config_ref.pixels_per_scan_line * frame_buffer_config_ref.vertical_resolution
+    );
     InitializeMemoryManager(memory_map);
+    InitializePageCache();
 
     SetLogLevel(kWarn);
 
     InitializeInterrupt();
 
     fat::Initialize(volume_image);
+    LoadKernelSymbols();
     InitializePCI();
 
     InitializeLayer();
@@ -182,16 +234,29 @@ void KernelMainNewStack(
 
     InitializeTask();
     Task& main_task = task_manager->CurrentTask();
+    // before other tasks, which must not log synchronously (that draws layers)
+    InitializeLogTask();
+    InitializeSoftirq();
 
     const auto task_terminal_id = task_manager->NewTask()
-        .InitContext(TerminalTask, 0)
+        .InitContext(TerminalTask, 0, kTerminalStackBytes)
         .Wakeup()
         .ID();
+    InitializeReadAhead();
 
     // pci devices
     usb::xhci::Initialize();
     InitializeKeyboard();
     InitializeMouse();
+    // usb events are processed by the softirq once the observers are set,
+    // including the ones arrived so far
+    RegisterSoftirq(Softirq::kXHCIInput, usb::xhci::ProcessInputEvents);
+    RegisterSoftirq(Softirq::kXHCI, usb::xhci::ProcessEvents);
+    {
+        InterruptGuard guard;
+        RaiseSoftirq(Softirq::kXHCIInput);
+        RaiseSoftirq(Softirq::kXHCI);
+    }
 
     // dump 256B from head of the volume_image
     // uint8_t *p = reinterpret_cast<uint8_t *>(volume_image);
@@ -215,76 +280,70 @@ void KernelMainNewStack(
 
     // counter
     char str[128];
+    // messages handled per iteration, so a flood of them costs one redraw of the counter
+    const size_t kMessageBatch = 32;
+    std::array<Message, kMessageBatch> msgs;
 
     while (true) {
         // update counter window
-        __asm__("cli");
-        const auto tick = timer_manager->CurrentTick();
-        __asm__("sti");
+        const auto tick = [] {
+            InterruptGuard guard;
+            return timer_manager->CurrentTick();
+        }();
 
         sprintf(str, "%010lu", tick);
         FillRectangle(*main_window->InnerWriter(), {20, 4}, {8*10, 16}, {0xc6, 0xc6, 0xc6});
         WriteString(*main_window->InnerWriter(), {20, 4}, str, {0, 0, 0});
         layer_manager->Draw(main_window_layer_id); // only refresh main window
 
-        __asm__("cli"); // Clear interrupt flag
-
-        auto rmsg = main_task.ReceiveMessage();
-        if (!rmsg) {
-            main_task.Sleep();
-            __asm__("sti"); // set interrupt flag
-            continue;
-        }
-
-        __asm__("sti");
-
-        auto& msg = *rmsg;
-        switch (msg.type) {
-        case Message::kInterruptXHCI:
-            usb::xhci::ProcessEvents();
-            break;
-        case Message::kTimerTimeout:
-            if (msg.arg.timer.value == kTextboxCursorTimer) {
-                __asm__("cli");
-                timer_manager->AddTimer(Timer{msg.arg.timer.timeout + kTimer05Sec, kTextboxCursorTimer});
-                __asm__("sti");
-
-                textbox_cursor_visible = !textbox_cursor_visible;
-                DrawTextCursor(textbox_cursor_visible);
-                layer_manager->Draw(text_window_layer_id);
-
-                __asm__("cli");
-                task_manager->SendMessage(task_terminal_id, msg);
-                __asm__("sti");
-            }
-            break;
-        case Message::kKeyPush:
-            if (auto act = active_layer->GetActive(); act == text_window_layer_id) {
-                InputTextWindow(msg.arg.keyboard.ascii);
-            } else {
-                // send key event to the task of active layer (window)
-                __asm__("cli");
-                auto task_it = layer_task_map->find(act);
-                __asm__("sti");
-
-                if (task_it != layer_task_map->end()) {
-                    __asm__("cli");
-                    task_manager->SendMessage(task_it->second, msg);
-                    __asm__("sti");
+        const size_t count = CoalesceMessages(
+            msgs.data(), main_task.WaitMessages(msgs.data(), msgs.size())
+        );
+        for (size_t i = 0; i < count; ++i) {
+            const auto &msg = msgs[i];
+            switch (msg.type) {
+            case Message::kMouseMove:
+                ProcessMouseMessage(msg);
+                break;
+            case Message::kTimerTimeout:
+                if (msg.arg.timer.value == kTextboxCursorTimer) {
+                    {
+                        InterruptGuard guard;
+                        timer_manager->AddTimer(Timer{msg.arg.timer.timeout + kTimer05Sec, kTextboxCursorTimer});
+                    }
+
+                    textbox_cursor_visible = !textbox_cursor_visible;
+                    DrawTextCursor(textbox_cursor_visible);
+                    layer_manager->Draw(text_window_layer_id);
+
+                    task_manager->SendMessage(task_terminal_id, msg);
+                }
+                break;
+            case Message::kKeyPush:
+                if (auto act = active_layer->GetActive(); act == text_window_layer_id) {
+                    InputTextWindow(msg.arg.keyboard.ascii);
                 } else {
-                    printk("Keypush not handled (keycode: %02x, ascii: %02x)\n", msg.arg.keyboard.keycode, msg.arg.keyboard.ascii);
+                    // send key event to the task of active layer (window)
+                    auto task_it = [act] {
+                        InterruptGuard guard;
+                        return layer_task_map->find(act);
+                    }();
+
+                    if (task_it != layer_task_map->end()) {
+                        task_manager->SendMessage(task_it->second, msg);
+                    } else {
+                        printk("Keypush not handled (keycode: %02x, ascii: %02x)\n", msg.arg.keyboard.keycode, msg.arg.keyboard.ascii);
+                    }
                 }
-            }
 
-            break;
-        case Message::kLayer:
-            ProcessLayerMessage(msg);
-            __asm__("cli");
-            task_manager->SendMessage(msg.src_task, Message{Message::kLayerFinish});
-            __asm__("sti");
-            break;
-        default:
-            Log(kError, "Unknown interrupt message (%d)\n", msg.type);
+                break;
+            case Message::kLayer:
+                ProcessLayerMessage(msg);
+                task_manager->Reply(msg.src_task, Message{Message::kLayerFinish});
+                break;
+            default:
+                Log(kError, "Unknown interrupt message (%d)\n", msg.type);
+            }
         }
     }
 }
@@ -1,20 +1,47 @@
 
 #include <sys/types.h> // ???
+#include <algorithm>
 
 #include "memory_manager.hpp"
 #include "logger.hpp"
+#include "interrupt.hpp"
+
+namespace {
+    // SpinLockGuard holds `flag` with local interrupts disabled
+    class SpinLockGuard {
+    public:
+        explicit SpinLockGuard(std::atomic_flag &flag) : flag_{flag} {
+            while (flag_.test_and_set(std::memory_order_acquire)) {
+                __asm__ volatile("pause");
+            }
+        }
+
+        ~SpinLockGuard() {
+            flag_.clear(std::memory_order_release);
+        }
+
+        SpinLockGuard(const SpinLockGuard &) = delete;
+        SpinLockGuard &operator =(const SpinLockGuard &) = delete;
+
+    private:
+        InterruptGuard interrupt_guard_; // taken before the lock
+        std::atomic_flag &flag_;
+    };
+}
 
 BitmapMemoryManager::BitmapMemoryManager()
     : alloc_map_{}, range_begin_{FrameID{0}}, range_end_{FrameID{kFrameCount}} {}
 
 // first fit
 WithError<FrameID> BitmapMemoryManager::Allocate(size_t num_frames) {
+    SpinLockGuard lock{lock_};
     size_t start_frame_id = range_begin_.ID();
     while (true) {
         size_t i = 0;
         for (; i < num_frames; ++i) {
             if (start_frame_id+i >= range_end_.ID()) {
                 // memory range exceeded
+                ++failed_count_;
                 return {kNullFrame, MAKE_ERROR(Error::kNoEnoughMemory)};
             }
 
@@ -25,7 +52,8 @@ WithError<FrameID> BitmapMemoryManager::Allocate(size_t num_frames) {
         }
 
         if (i == num_frames) {
-            MarkAllocated(FrameID{start_frame_id}, num_frames);
+            markAllocated(FrameID{start_frame_id}, num_frames);
+            ++alloc_count_;
             return {
                 FrameID{start_frame_id},
                 MAKE_ERROR(Error::kSuccess)
@@ -37,16 +65,23 @@ WithError<FrameID> BitmapMemoryManager::Allocate(size_t num_frames) {
 }
 
 Error BitmapMemoryManager::Free(FrameID start_frame, size_t num_frames) {
+    SpinLockGuard lock{lock_};
     for (size_t i = 0; i < num_frames; ++i) {
         setBit(FrameID{start_frame.ID()+i}, false);
     }
+    ++free_count_;
 
     return MAKE_ERROR(Error::kSuccess);
 }
 
 void BitmapMemoryManager::MarkAllocated(FrameID start_frame, size_t num_frames) {
+    SpinLockGuard lock{lock_};
+    markAllocated(start_frame, num_frames);
+}
+
+void BitmapMemoryManager::markAllocated(FrameID start_frame, size_t num_frames) {
     for (size_t i = 0; i < num_frames; ++i) {
-        setBit(FrameID{start_frame.ID()}, true);
+        setBit(FrameID{start_frame.ID()+i}, true);
     }
 }
 
@@ -55,11 +90,46 @@ void BitmapMemoryManager::SetMemoryRange(FrameID range_begin, FrameID range_end)
     range_end_ = range_end;
 }
 
+MemoryStat BitmapMemoryManager::Stat() const {
+    SpinLockGuard lock{lock_};
+    MemoryStat stat{};
+    stat.total_frames = range_end_.ID() - range_begin_.ID();
+    stat.alloc_count = alloc_count_;
+    stat.free_count = free_count_;
+    stat.failed_count = failed_count_;
+
+    size_t run = 0;
+    for (size_t id = range_begin_.ID(); id < range_end_.ID(); ++id) {
+        // skip fully allocated lines
+        if (id % kBitsPerMapLine == 0 && id + kBitsPerMapLine <= range_end_.ID() &&
+            alloc_map_[id / kBitsPerMapLine] == ~static_cast<MapLineType>(0)) {
+            stat.allocated_frames += kBitsPerMapLine;
+            run = 0;
+            id += kBitsPerMapLine - 1;
+            continue;
+        }
+
+        if (getBit(FrameID{id})) {
+            ++stat.allocated_frames;
+            run = 0;
+            continue;
+        }
+
+        if (run == 0) {
+            ++stat.free_runs;
+        }
+        ++run;
+        stat.largest_free_run = std::max(stat.largest_free_run, run);
+    }
+
+    return stat;
+}
+
 bool BitmapMemoryManager::getBit(FrameID frame) const {
     auto line_index = frame.ID() / kBitsPerMapLine;
     auto bit_index = frame.ID() % kBitsPerMapLine;
 
-    return (alloc_map_[line_index] & static_cast<MapLineType>(1) << bit_index) == 1;
+    return (alloc_map_[line_index] & (static_cast<MapLineType>(1) << bit_index)) != 0;
 }
 
 void BitmapMemoryManager::setBit(FrameID frame, bool allocated) {
@@ -74,11 +144,129 @@ void BitmapMemoryManager::setBit(FrameID frame, bool allocated) {
 }
 
 
-extern "C" caddr_t program_break, program_break_end;
+
+FrameCache::FrameCache(BitmapMemoryManager &backend)
+    : backend_{backend} {}
+
+WithError<FrameID> FrameCache::Allocate() {
+    InterruptGuard guard;
+
+    const auto cpu = LocalAPICID();
+    if (cpu >= kMaxCPUs) {
+        return backend_.Allocate(1);
+    }
+
+    auto &cache = cpus_[cpu];
+    if (cache.Loaded().count == 0) {
+        if (cache.Previous().count == kMagazineSize) {
+            cache.Swap();
+        } else {
+            lockDepot();
+            refill(cache.Loaded());
+            unlockDepot();
+
+            if (cache.Loaded().count == 0) {
+                return {kNullFrame, MAKE_ERROR(Error::kNoEnoughMemory)};
+            }
+        }
+    }
+
+    auto &mag = cache.Loaded();
+    return {FrameID{mag.frames[--mag.count]}, MAKE_ERROR(Error::kSuccess)};
+}
+
+Error FrameCache::Free(FrameID frame) {
+    InterruptGuard guard;
+
+    const auto cpu = LocalAPICID();
+    if (cpu >= kMaxCPUs) {
+        return backend_.Free(frame, 1);
+    }
+
+    auto &cache = cpus_[cpu];
+    if (cache.Loaded().count == kMagazineSize) {
+        if (cache.Previous().count != 0) {
+            lockDepot();
+            drain(cache.Previous());
+            unlockDepot();
+        }
+        cache.Swap();
+    }
+
+    auto &mag = cache.Loaded();
+    mag.frames[mag.count++] = frame.ID();
+    return MAKE_ERROR(Error::kSuccess);
+}
+
+size_t FrameCache::CachedFrames() const {
+    size_t frames = 0;
+    for (const auto &cache : cpus_) {
+        frames += cache.magazines[0].count + cache.magazines[1].count;
+    }
+
+    return frames + depot_frames_;
+}
+
+void FrameCache::lockDepot() {
+    while (depot_lock_.test_and_set(std::memory_order_acquire)) {
+        __asm__ volatile("pause");
+    }
+}
+
+void FrameCache::unlockDepot() {
+    depot_lock_.clear(std::memory_order_release);
+}
+
+void FrameCache::refill(Magazine &mag) {
+    if (depot_count_ > 0) {
+        mag = depot_[--depot_count_];
+        depot_frames_ -= mag.count;
+        return;
+    }
+
+    // take a contiguous batch if possible, one first-fit scan for all
+    if (auto batch = backend_.Allocate(kMagazineSize); !batch.error) {
+        for (size_t i = 0; i < kMagazineSize; ++i) {
+            mag.frames[i] = batch.value.ID() + i;
+        }
+        mag.count = kMagazineSize;
+        return;
+    }
+
+    // fragmented, or running out of memory
+    mag.count = 0;
+    while (mag.count < kMagazineSize) {
+        auto frame = backend_.Allocate(1);
+        if (frame.error) {
+            break;
+        }
+        mag.frames[mag.count++] = frame.value.ID();
+    }
+}
+
+void FrameCache::drain(Magazine &mag) {
+    if (depot_count_ < kDepotMagazines) {
+        depot_[depot_count_++] = mag;
+        depot_frames_ += mag.count;
+    } else {
+        for (size_t i = 0; i < mag.count; ++i) {
+            backend_.Free(FrameID{mag.frames[i]}, 1);
+        }
+    }
+
+    mag.count = 0;
+}
+
+
+extern "C" caddr_t program_break, program_break_end, program_break_max;
+
+BitmapMemoryManager* memory_manager;
+FrameCache* frame_cache;
 
 namespace {
     char memory_manager_buf[sizeof(BitmapMemoryManager)];
-    BitmapMemoryManager* memory_manager;
+    char frame_cache_buf[sizeof(FrameCache)];
+    caddr_t program_break_start;
 
     Error initializeHeap(BitmapMemoryManager &memory_manager) {
         const int kHeapFrames = 64 * 512; // 128 MiB
@@ -88,6 +276,8 @@ namespace {
         }
 
         program_break = reinterpret_cast<caddr_t>(heap_start.value.ID() * kBytesPerFrame);
+        program_break_start = program_break;
+        program_break_max = program_break;
         program_break_end = program_break + kHeapFrames*kBytesPerFrame;
         return MAKE_ERROR(Error::kSuccess);
     }
@@ -122,10 +312,19 @@ void InitializeMemoryManager(const MemoryMap &memory_map) {
     }
 
     memory_manager->SetMemoryRange(FrameID{ 1 }, FrameID{ available_end / kBytesPerFrame });
+    ::frame_cache = new(frame_cache_buf) FrameCache{*memory_manager};
 
     // initialize heap
     if (auto err = initializeHeap(*memory_manager)) {
-        Log(kError, "failed to allocate heap (%s) at %s:%d\n", err.Name(), err.File(), err.Line());
+        Log(kLogMemory, kError, "failed to allocate heap (%s) at %s:%d\n", err.Name(), err.File(), err.Line());
         exit(1); // is exit() work?
     }
 }
+
+HeapStat GetHeapStat() {
+    return {
+        static_cast<size_t>(program_break_end - program_break_start),
+        static_cast<size_t>(program_break - program_break_start),
+        static_cast<size_t>(program_break_max - program_break_start),
+    };
+}
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <cstdint>
+#include <array>
+#include <atomic>
 #include <limits>
 
 #include "error.hpp"
@@ -39,6 +41,20 @@ public:
 
 static const FrameID kNullFrame{std::numeric_limits<size_t>::max()};
 
+struct MemoryStat {
+    size_t total_frames; // frames in the managed range
+    size_t allocated_frames;
+    size_t free_runs; // number of contiguous free ranges
+    size_t largest_free_run; // frames
+    size_t alloc_count, free_count, failed_count;
+};
+
+struct HeapStat {
+    size_t total_bytes;
+    size_t used_bytes;
+    size_t high_water_bytes;
+};
+
 class BitmapMemoryManager {
 public:
     // max memory size this class can manage
@@ -53,19 +69,84 @@ public:
 
     BitmapMemoryManager();
 
+    // Allocate, Free, MarkAllocated and Stat may be called from any CPU
     WithError<FrameID> Allocate(size_t num_frames);
     Error Free(FrameID start_frame, size_t num_frames);
     void MarkAllocated(FrameID start_frame, size_t num_frames);
     void SetMemoryRange(FrameID range_begin, FrameID range_end);
+    // Stat scans the bitmap to measure fragmentation
+    MemoryStat Stat() const;
 
 private:
     std::array<MapLineType, kFrameCount/kBitsPerMapLine> alloc_map_;
     FrameID range_begin_;
     FrameID range_end_;
 
+    // counters
+    size_t alloc_count_{0}, free_count_{0}, failed_count_{0};
+    // lock_ serializes all bitmap access
+    mutable std::atomic_flag lock_ = ATOMIC_FLAG_INIT;
+
+    // markAllocated is MarkAllocated without taking lock_
+    void markAllocated(FrameID start_frame, size_t num_frames);
     bool getBit(FrameID frame) const;
     void setBit(FrameID frame, bool allocalted);
 };
 
+// FrameCache is a per-CPU magazine cache of free frames in front of
+// BitmapMemoryManager, for single frame allocations (page tables, app pages).
+// The per-CPU fast path only disables local interrupts. Magazines are
+// refilled from / drained to the global depot in batches under depot_lock_.
+// The bitmap has its own lock, so multi-frame allocations may bypass this cache.
+class FrameCache {
+public:
+    // frames per magazine
+    static const size_t kMagazineSize = 32;
+    // full magazines kept in the global depot
+    static const size_t kDepotMagazines = 8;
+    // CPUs with local APIC ID beyond this go straight to the bitmap
+    static const uint32_t kMaxCPUs = 16;
+
+    FrameCache(BitmapMemoryManager &backend);
+
+    WithError<FrameID> Allocate();
+    Error Free(FrameID frame);
+    // CachedFrames returns frames held by magazines (allocated in the bitmap)
+    size_t CachedFrames() const;
+
+private:
+    struct Magazine {
+        size_t count;
+        std::array<size_t, kMagazineSize> frames;
+    };
+
+    struct CPUCache {
+        std::array<Magazine, 2> magazines;
+        int loaded; // index of the loaded magazine, the other is previous one
+
+        Magazine &Loaded() { return magazines[loaded]; }
+        Magazine &Previous() { return magazines[1 - loaded]; }
+        void Swap() { loaded = 1 - loaded; }
+    };
+
+    BitmapMemoryManager &backend_;
+    std::array<CPUCache, kMaxCPUs> cpus_{};
+    std::array<Magazine, kDepotMagazines> depot_{};
+    size_t depot_count_{0}; // magazines in depot_, may be partially filled
+    size_t depot_frames_{0}; // frames held by them
+    std::atomic_flag depot_lock_ = ATOMIC_FLAG_INIT;
+
+    void lockDepot();
+    void unlockDepot();
+    // refill fills the empty magazine. requires depot_lock_
+    void refill(Magazine &mag);
+    // drain empties the magazine. requires depot_lock_
+    void drain(Magazine &mag);
+};
+
+extern BitmapMemoryManager* memory_manager;
+extern FrameCache* frame_cache;
+
 // allocates new heap, set up newlib_support:sbrk()
 void InitializeMemoryManager(const MemoryMap &memory_map);
+HeapStat GetHeapStat();
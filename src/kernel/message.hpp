@@ -15,6 +15,9 @@ struct Message {
         kKeyPush,
         kLayer,
         kLayerFinish,
+        kReadAhead,
+        kChannel,
+        kMouseMove,
     } type;
 
     uint64_t src_task;
@@ -37,5 +40,19 @@ struct Message {
             int x, y;
             int w, h;
         } layer; // kLayer
+
+        struct {
+            uint64_t offset; // on the device
+            size_t len;
+        } read_ahead; // kReadAhead
+
+        struct {
+            uint64_t id;
+        } channel; // kChannel, the doorbell
+
+        struct {
+            uint8_t buttons;
+            int dx, dy;
+        } mouse; // kMouseMove
     } arg;
 };
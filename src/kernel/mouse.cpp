@@ -3,10 +3,13 @@
 #include "mouse.hpp"
 #include "window.hpp"
 #include "layer.hpp"
+#include "task.hpp"
 #include "usb/classdriver/mouse.hpp"
 
 namespace {
 
+std::shared_ptr<Mouse> mouse;
+
 const char mouse_cursor_shape[kMouseCursorHeight][kMouseCursorWidth + 1] = {
     "@              ",
     "@@             ",
@@ -39,7 +42,7 @@ const char mouse_cursor_shape[kMouseCursorHeight][kMouseCursorWidth + 1] = {
 
 Mouse::Mouse(unsigned int layer_id): layer_id_{layer_id} {}
 
-void Mouse::OnInterrupt(uint8_t buttons, int8_t delta_x, int8_t delta_y) {
+void Mouse::OnInterrupt(uint8_t buttons, int delta_x, int delta_y) {
     const auto oldpos = position_;
     auto newpos = position_ + Vector2D<int>{delta_x, delta_y};
     newpos = ElementMin(newpos, ScreenSize() + Vector2D<int>{-1, -1});
@@ -114,16 +117,25 @@ void InitializeMouse() {
         .SetWindow(mouse_window)
         .ID();
 
-    auto mouse = std::make_shared<Mouse>(mouse_layer_id);
+    mouse = std::make_shared<Mouse>(mouse_layer_id);
     mouse->SetPosition({200, 200});
     layer_manager->UpDown(mouse->LayerID(), std::numeric_limits<int>::max());
 
-    // register USB event handler
+    // register USB event handler. it runs in the softirq task,
+    // so the layers are moved by the main task.
     usb::HIDMouseDriver::default_observer =
-        [mouse](uint8_t buttons, int8_t delta_x, int8_t delta_y) {
-            mouse->OnInterrupt(buttons, delta_x, delta_y);
+        [](uint8_t buttons, int8_t delta_x, int8_t delta_y) {
+            Message msg{Message::kMouseMove};
+            msg.arg.mouse.buttons = buttons;
+            msg.arg.mouse.dx = delta_x;
+            msg.arg.mouse.dy = delta_y;
+            task_manager->SendMessage(1, msg);
         };
 
     // register mouse to activelayer manager
     active_layer->SetMouseLayer(mouse_layer_id);
 }
+
+void ProcessMouseMessage(const Message &msg) {
+    mouse->OnInterrupt(msg.arg.mouse.buttons, msg.arg.mouse.dx, msg.arg.mouse.dy);
+}
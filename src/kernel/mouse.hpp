@@ -1,6 +1,7 @@
 #pragma once
 
 #include "graphics.hpp"
+#include "message.hpp"
 
 
 class Mouse {
@@ -12,7 +13,7 @@ private:
 
 public:
     Mouse(unsigned int layer_id);
-    void OnInterrupt(uint8_t buttons, int8_t delta_x, int8_t delta_y);
+    void OnInterrupt(uint8_t buttons, int delta_x, int delta_y);
 
     unsigned int LayerID() const;
     void SetPosition(Vector2D<int> position);
@@ -26,3 +27,5 @@ const PixelColor kMouseTransparentColor{0, 0, 1};
 
 void DrawMouseCursor(PixelWriter *writer, Vector2D<int> position);
 void InitializeMouse();
+// ProcessMouseMessage moves the cursor and drags windows, in the main task
+void ProcessMouseMessage(const Message &msg);
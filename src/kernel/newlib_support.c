@@ -1,7 +1,18 @@
 #include <errno.h>
+#include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 
+#include "file_flags.h"
+
+// implemented in file.cpp, returning negative errno on failure
+int OpenFD(const char *path, int flags);
+long ReadFD(int fd, void *buf, size_t len);
+long WriteFD(int fd, const void *buf, size_t len);
+long SeekFD(int fd, long offset, int whence);
+long SizeFD(int fd);
+int CloseFD(int fd);
+
 void _exit(void) {
     while (1) {
         __asm__("hlt");
@@ -9,6 +20,8 @@ void _exit(void) {
 }
 
 caddr_t program_break, program_break_end;
+// high-water mark of program_break
+caddr_t program_break_max;
 
 caddr_t sbrk(int incr) {
     if (program_break == 0 || program_break + incr >= program_break_end) {
@@ -18,6 +31,9 @@ caddr_t sbrk(int incr) {
 
     caddr_t prev_break = program_break;
     program_break += incr;
+    if (program_break > program_break_max) {
+        program_break_max = program_break;
+    }
     return prev_break;
 }
 
@@ -30,29 +46,64 @@ int kill(int pid, int sig) {
     return -1;
 }
 
+int open(const char *path, int flags, ...) {
+    const int mode = flags & O_ACCMODE;
+    int fd = OpenFD(path,
+        ((flags & O_CREAT) ? kOpenCreate : 0) | ((flags & O_TRUNC) ? kOpenTruncate : 0) |
+        (mode != O_WRONLY ? kOpenRead : 0) | (mode != O_RDONLY ? kOpenWrite : 0) |
+        ((flags & O_APPEND) ? kOpenAppend : 0));
+    if (fd < 0) {
+        errno = -fd;
+        return -1;
+    }
+    return fd;
+}
+
 int close(int fd) {
-    errno = EBADF;
-    return -1;
+    int err = CloseFD(fd);
+    if (err < 0) {
+        errno = -err;
+        return -1;
+    }
+    return 0;
 }
 
 off_t lseek(int fd, off_t offset, int whence) {
-    errno = EBADF;
-    return -1;
+    long pos = SeekFD(fd, offset, whence);
+    if (pos < 0) {
+        errno = -pos;
+        return -1;
+    }
+    return pos;
 }
 
 ssize_t read(int fd, void *buf, size_t count) {
-    errno = EBADF;
-    return -1;
+    long n = ReadFD(fd, buf, count);
+    if (n < 0) {
+        errno = -n;
+        return -1;
+    }
+    return n;
 }
 
 ssize_t write(int fd, const void *buf, size_t count) {
-    errno = EBADF;
-    return -1;
+    long n = WriteFD(fd, buf, count);
+    if (n < 0) {
+        errno = -n;
+        return -1;
+    }
+    return n;
 }
 
 int fstat(int fd, struct stat *buf) {
-    errno = EBADF;
-    return -1;
+    long size = SizeFD(fd);
+    if (size < 0) {
+        errno = -size;
+        return -1;
+    }
+    buf->st_mode = S_IFREG;
+    buf->st_size = size;
+    return 0;
 }
 
 int isatty(int fd) {
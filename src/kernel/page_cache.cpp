@@ -0,0 +1,38 @@
+#include "page_cache.hpp"
+
+#include "fat.hpp"
+#include "address_space.hpp"
+
+FrameID PageCache::Find(unsigned long file_cluster, uint64_t page_addr) const {
+    auto it = pages_.find({file_cluster, page_addr});
+    if (it == pages_.end()) {
+        return kNullFrame;
+    }
+
+    return it->second;
+}
+
+void PageCache::Insert(unsigned long file_cluster, uint64_t page_addr, FrameID frame) {
+    pages_.insert_or_assign({file_cluster, page_addr}, frame);
+}
+
+void PageCache::Invalidate(unsigned long file_cluster) {
+    pages_.erase(pages_.lower_bound({file_cluster, 0}),
+                 pages_.lower_bound({file_cluster + 1, 0}));
+}
+
+size_t PageCache::Count() const {
+    return pages_.size();
+}
+
+
+PageCache *page_cache;
+
+void InitializePageCache() {
+    page_cache = new PageCache;
+    fat::SetChangeHandler([](unsigned long first_cluster) {
+        // pages mapped in place would see the change
+        DetachFile(first_cluster);
+        page_cache->Invalidate(first_cluster);
+    });
+}
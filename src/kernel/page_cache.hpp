@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <utility>
+
+#include "memory_manager.hpp"
+
+// PageCache keeps read-only pages of executables,
+// so that repeated launches share them instead of copying again.
+// Pages are keyed by (first cluster of the file, page aligned vaddr)
+// and are never evicted.
+class PageCache {
+public:
+    // Find returns the frame cached for the page, or kNullFrame
+    FrameID Find(unsigned long file_cluster, uint64_t page_addr) const;
+    void Insert(unsigned long file_cluster, uint64_t page_addr, FrameID frame);
+    // Invalidate drops the pages of the file. The frames are not freed,
+    // since running apps may still map them.
+    void Invalidate(unsigned long file_cluster);
+    size_t Count() const;
+
+private:
+    std::map<std::pair<unsigned long, uint64_t>, FrameID> pages_{};
+};
+
+extern PageCache *page_cache;
+
+void InitializePageCache();
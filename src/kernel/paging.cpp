@@ -1,5 +1,6 @@
 #include "paging.hpp"
 #include "asmfunc.h"
+#include "logger.hpp"
 
 namespace {
     const uint64_t kPageSize4K = 4096;
@@ -10,6 +11,33 @@ namespace {
     alignas(kPageSize4K) std::array<uint64_t, 512> pml4_table; // page map level 4 table
     alignas(kPageSize4K) std::array<uint64_t, 512> pdp_table; // page directory pointer table
     alignas(kPageSize4K) std::array<std::array<uint64_t, 512>, kPageDirectoryCount> page_directory;
+
+    // Page Attribute Table
+    const uint32_t kIA32PAT = 0x277;
+    // memory types
+    const uint64_t kMemoryTypeUC = 0x00; // uncacheable
+    const uint64_t kMemoryTypeWC = 0x01; // write combining
+    const uint64_t kMemoryTypeWT = 0x04; // write through
+    const uint64_t kMemoryTypeWB = 0x06; // write back
+    const uint64_t kMemoryTypeUCMinus = 0x07;
+    // PAT index 1 (PWT=1, PCD=0, PAT=0) is reprogrammed from WT to WC
+    const int kPATIndexWC = 1;
+    const uint64_t kPageWriteThrough = 0x008; // PWT bit, selects PAT index 1
+
+    void setupPAT() {
+        // PA0-3 and PA4-7 are the power-on defaults except PA1
+        uint64_t pat =
+            kMemoryTypeWB |
+            (kMemoryTypeWT << 8) |
+            (kMemoryTypeUCMinus << 16) |
+            (kMemoryTypeUC << 24);
+        pat |= pat << 32;
+        pat &= ~(0xfful << (8*kPATIndexWC));
+        pat |= kMemoryTypeWC << (8*kPATIndexWC);
+
+        WriteBackInvalidateCache();
+        WriteMSR(kIA32PAT, pat);
+    }
 }
 
 // 正直全然わからん 0x083 とか 0x003 をビット和するのは何故
@@ -28,4 +56,36 @@ void SetupIdentityPageTable() {
 
 void InitializePaging() {
     SetupIdentityPageTable();
+    setupPAT();
+
+    // CR0.WP: honor read-only pages in ring 0 too,
+    // since apps run in ring 0 and share read-only pages
+    SetCR0(GetCR0() | (1u << 16));
+}
+
+uint64_t KernelCR3() {
+    return reinterpret_cast<uint64_t>(&pml4_table[0]);
+}
+
+PageMapEntry *KernelPML4() {
+    return reinterpret_cast<PageMapEntry *>(&pml4_table[0]);
+}
+
+void SetWriteCombining(uintptr_t addr, size_t bytes) {
+    const uint64_t kIdentityMapEnd = kPageDirectoryCount * kPageSize1G;
+    if (bytes == 0 || addr + bytes > kIdentityMapEnd) {
+        Log(kLogMemory, kWarn, "SetWriteCombining: %lx (%lu bytes) is not identity mapped\n", addr, bytes);
+        return;
+    }
+
+    // PAT WC takes precedence over any MTRR type, so no MTRR setup is needed
+    const uint64_t first_page = addr / kPageSize2M;
+    const uint64_t last_page = (addr + bytes - 1) / kPageSize2M;
+    for (uint64_t page = first_page; page <= last_page; ++page) {
+        page_directory[page / 512][page % 512] |= kPageWriteThrough;
+    }
+
+    // flush stale cache lines and TLB entries
+    WriteBackInvalidateCache();
+    SetCR3(reinterpret_cast<uint64_t>(&pml4_table[0]));
 }
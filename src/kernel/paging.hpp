@@ -4,6 +4,71 @@
 #include <array>
 
 const size_t kPageDirectoryCount = 64;
+const uint64_t kBytesPerPage = 4096;
+
+union PageMapEntry {
+    uint64_t data;
+
+    struct {
+        uint64_t present: 1;
+        uint64_t writable: 1;
+        uint64_t user: 1;
+        uint64_t write_through: 1;
+        uint64_t cache_disable: 1;
+        uint64_t accessed: 1;
+        uint64_t dirty: 1;
+        uint64_t huge_page: 1;
+        uint64_t global: 1;
+        // available for software (ignored by CPU)
+        uint64_t shared: 1; // frame is not owned by this page map, don't free it
+        uint64_t copy_on_write: 1; // copy the frame on the first write
+        uint64_t: 1;
+
+        uint64_t addr: 40;
+        uint64_t: 12;
+    } __attribute__((packed)) bits;
+
+    PageMapEntry *Pointer() const {
+        return reinterpret_cast<PageMapEntry *>(bits.addr << 12);
+    }
+
+    void SetPointer(PageMapEntry *p) {
+        bits.addr = reinterpret_cast<uint64_t>(p) >> 12;
+    }
+};
+
+union LinearAddress4Level {
+    uint64_t value;
+
+    struct {
+        uint64_t offset: 12;
+        uint64_t page: 9;
+        uint64_t dir: 9;
+        uint64_t pdp: 9;
+        uint64_t pml4: 9;
+        uint64_t: 16;
+    } __attribute__((packed)) parts;
+
+    // Part returns the table index of given level (4: pml4 - 1: page table)
+    int Part(int page_map_level) const {
+        switch (page_map_level) {
+        case 0: return parts.offset;
+        case 1: return parts.page;
+        case 2: return parts.dir;
+        case 3: return parts.pdp;
+        case 4: return parts.pml4;
+        default: return 0;
+        }
+    }
+};
 
 void SetupIdentityPageTable();
 void InitializePaging();
+// KernelCR3 returns the page map shared by all kernel tasks
+uint64_t KernelCR3();
+// KernelPML4 returns the top level table of the kernel page map
+PageMapEntry *KernelPML4();
+
+// SetWriteCombining maps [addr, addr+bytes) as write-combining memory.
+// Intended for the frame buffer; the range is rounded out to 2 MiB pages.
+void SetWriteCombining(uintptr_t addr, size_t bytes);
@@ -1,4 +1,7 @@
 #include "pci.hpp"
+
+#include <algorithm>
+
 #include "asmfunc.h"
 #include "logger.hpp"
 
@@ -153,14 +156,100 @@ Error configureMSIRegister(
     return MAKE_ERROR(Error::kSuccess);
 }
 
+// findCapability returns the address of the capability, 0 if missing
+uint8_t findCapability(const Device& dev, uint8_t cap_id) {
+    // capabilities pointer from PCI configuration space 0x34-0x37
+    uint8_t cap_addr = ReadConfReg(dev, 0x34u) & 0xffu;
+    while (cap_addr != 0) {
+        auto header = ReadCapabilityHeader(dev, cap_addr);
+        if (header.bits.cap_id == cap_id) {
+            return cap_addr;
+        }
+        cap_addr = header.bits.next_ptr;
+    }
+    return 0;
+}
+
+uint32_t makeMSIAddress(uint8_t apic_id) {
+    return 0xfee00000u | (apic_id << 12); // bit 12-19 Destination ID
+}
+
+uint32_t makeMSIData(MSITriggerMode trigger_mode, MSIDeliveryMode delivery_mode, uint8_t vector) {
+    uint32_t msg_data = (static_cast<uint32_t>(delivery_mode) << 8) | vector;
+    if (trigger_mode == MSITriggerMode::kLevel) {
+        msg_data |= (0b1u << 15);
+    }
+    return msg_data;
+}
+
+// msixTable returns the MSI-X table mapped by the BAR
+WithError<volatile MSIXTableEntry *> msixTable(const Device& dev, uint8_t msix_cap_addr) {
+    const uint32_t table = ReadConfReg(dev, msix_cap_addr + 4);
+    Device bar_dev = dev;
+    auto [bar, err] = ReadBar(bar_dev, table & 0b111u);
+    if (err) {
+        return {nullptr, err};
+    }
+    const uint64_t base = bar & ~static_cast<uint64_t>(0xf);
+    return {
+        reinterpret_cast<volatile MSIXTableEntry *>(base + (table & ~0b111u)),
+        MAKE_ERROR(Error::kSuccess)
+    };
+}
+
+// writeMSIXEntry masks the entry while changing it, then unmasks
+void writeMSIXEntry(volatile MSIXTableEntry &entry, uint32_t msg_addr, uint32_t msg_data) {
+    entry.vector_control = entry.vector_control | 1u;
+    entry.msg_addr = msg_addr;
+    entry.msg_upper_addr = 0;
+    entry.msg_data = msg_data;
+    entry.vector_control = entry.vector_control & ~1u;
+}
+
+// enableMSIX turns MSI-X on and MSI off. The function mask is set
+// while the table is written by `write`.
+template <class F>
+Error enableMSIX(const Device& dev, uint8_t msix_cap_addr, F write) {
+    if (auto msi_cap_addr = findCapability(dev, kCapabilityMSI)) {
+        auto msi_cap = readMSICapability(dev, msi_cap_addr);
+        msi_cap.header.bits.msi_enable = 0;
+        writeMSICapability(dev, msi_cap_addr, msi_cap);
+    }
+
+    MSIXCapability msix_cap{};
+    msix_cap.header.data = ReadConfReg(dev, msix_cap_addr);
+    msix_cap.header.bits.msix_enable = 1;
+    msix_cap.header.bits.function_mask = 1;
+    WriteConfigReg(dev, msix_cap_addr, msix_cap.header.data);
+
+    auto [table, err] = msixTable(dev, msix_cap_addr);
+    if (!err) {
+        write(table, msix_cap.header.bits.table_size + 1u);
+    }
+
+    msix_cap.header.bits.function_mask = 0;
+    if (err) {
+        msix_cap.header.bits.msix_enable = 0;
+    }
+    WriteConfigReg(dev, msix_cap_addr, msix_cap.header.data);
+    return err;
+}
+
+// Program MSI-X table entries in the same way as multiple message MSI:
+// entry i gets msg_data + i.
 Error configureMSIXRegister(
     const Device& dev,
-    uint8_t msi_cap_addr,
+    uint8_t msix_cap_addr,
     uint32_t msg_addr,
     uint32_t msg_data,
     unsigned int num_vector_exponent
 ) {
-    return MAKE_ERROR(Error::kNotImplemented);
+    return enableMSIX(dev, msix_cap_addr, [&](volatile MSIXTableEntry *table, unsigned int size) {
+        const unsigned int n = std::min(1u << num_vector_exponent, size);
+        for (unsigned int i = 0; i < n; ++i) {
+            writeMSIXEntry(table[i], msg_addr, msg_data + i);
+        }
+    });
 }
 
 }
@@ -292,20 +381,8 @@ Error ConfigureMSI(
     uint32_t msg_data,
     unsigned int num_vector_exponent
 ) {
-    // capabilities pointer from PCI configuration space 0x34-0x37
-    uint8_t cap_addr = ReadConfReg(dev, 0x34u) & 0xffu;
-    uint8_t msi_cap_addr = 0;
-    uint8_t msix_cap_addr = 0;
-    while (cap_addr != 0) {
-        auto header = ReadCapabilityHeader(dev, cap_addr);
-        if (header.bits.cap_id == kCapabilityMSI) {
-            msi_cap_addr = cap_addr;
-        } else if (header.bits.cap_id == kCapabilityMSIX) {
-            msix_cap_addr = cap_addr;
-        }
-
-        cap_addr = header.bits.next_ptr;
-    }
+    const uint8_t msi_cap_addr = findCapability(dev, kCapabilityMSI);
+    const uint8_t msix_cap_addr = findCapability(dev, kCapabilityMSIX);
 
     if (msi_cap_addr) {
         return configureMSIRegister(dev, msi_cap_addr, msg_addr, msg_data, num_vector_exponent);
@@ -325,15 +402,58 @@ Error ConfigureMSIFixedDestination(
     unsigned int num_vector_exponent
 ) {
     // Message Address (CPU register)
-    uint32_t msg_addr = 0xfee00000u | (apic_id << 12); // bit 12-19 Destination ID
+    const uint32_t msg_addr = makeMSIAddress(apic_id);
     // Message Data
-    uint32_t msg_data = (static_cast<uint32_t>(delivery_mode) << 8) | vector;
+    const uint32_t msg_data = makeMSIData(trigger_mode, delivery_mode, vector);
 
-    if (trigger_mode == MSITriggerMode::kLevel) {
-        msg_data |= (0b1u << 15);
+    return ConfigureMSI(dev, msg_addr, msg_data, num_vector_exponent);
+}
+
+unsigned int MSIXTableSize(const Device& dev) {
+    const uint8_t msix_cap_addr = findCapability(dev, kCapabilityMSIX);
+    if (msix_cap_addr == 0) {
+        return 0;
     }
+    MSIXCapability msix_cap{};
+    msix_cap.header.data = ReadConfReg(dev, msix_cap_addr);
+    return msix_cap.header.bits.table_size + 1u;
+}
 
-    return ConfigureMSI(dev, msg_addr, msg_data, num_vector_exponent);
+Error ConfigureMSIXFixedDestination(
+    const Device& dev,
+    unsigned int entry,
+    uint8_t apic_id,
+    MSITriggerMode trigger_mode,
+    MSIDeliveryMode delivery_mode,
+    uint8_t vector
+) {
+    const uint8_t msix_cap_addr = findCapability(dev, kCapabilityMSIX);
+    if (msix_cap_addr == 0) {
+        return MAKE_ERROR(Error::kNoPCIMSI);
+    }
+
+    Error result = MAKE_ERROR(Error::kSuccess);
+    auto err = enableMSIX(dev, msix_cap_addr, [&](volatile MSIXTableEntry *table, unsigned int size) {
+        if (entry >= size) {
+            result = MAKE_ERROR(Error::kIndexOutOfRange);
+            return;
+        }
+        writeMSIXEntry(table[entry],
+                       makeMSIAddress(apic_id),
+                       makeMSIData(trigger_mode, delivery_mode, vector));
+    });
+    return err ? err : result;
+}
+
+void DisableMSIX(const Device& dev) {
+    const uint8_t msix_cap_addr = findCapability(dev, kCapabilityMSIX);
+    if (msix_cap_addr == 0) {
+        return;
+    }
+    MSIXCapability msix_cap{};
+    msix_cap.header.data = ReadConfReg(dev, msix_cap_addr);
+    msix_cap.header.bits.msix_enable = 0;
+    WriteConfigReg(dev, msix_cap_addr, msix_cap.header.data);
 }
 
 }
@@ -120,6 +120,32 @@ struct MSICapability {
     uint32_t pending_bits;
 } __attribute((packed));
 
+struct MSIXCapability {
+    union {
+        uint32_t data;
+        struct {
+            uint32_t cap_id: 8;
+            uint32_t next_ptr: 8;
+            uint32_t table_size: 11; // number of entries - 1
+            uint32_t: 3;
+            uint32_t function_mask: 1;
+            uint32_t msix_enable: 1;
+        } __attribute__((packed)) bits;
+    } __attribute__((packed)) header;
+
+    // offset in the BAR | BAR index (BIR) in bit 0-2
+    uint32_t table;
+    uint32_t pending_bit_array;
+} __attribute__((packed));
+
+// entry of the MSI-X table, in the memory space of a BAR
+struct MSIXTableEntry {
+    uint32_t msg_addr;
+    uint32_t msg_upper_addr;
+    uint32_t msg_data;
+    uint32_t vector_control; // bit 0: mask
+} __attribute__((packed));
+
 CapabilityHeader ReadCapabilityHeader(const Device& dev, uint8_t addr);
 
 Error ConfigureMSI(
@@ -138,6 +164,24 @@ Error ConfigureMSIFixedDestination(
     unsigned int num_vector_exponent
 );
 
+// MSIXTableSize returns the number of MSI-X vectors of the device, 0 without MSI-X
+unsigned int MSIXTableSize(const Device& dev);
+
+// ConfigureMSIXFixedDestination programs the MSI-X table entry `entry` and
+// enables MSI-X. Each entry has its own vector and destination CPU.
+// MSI is disabled, as a device uses only one of them.
+Error ConfigureMSIXFixedDestination(
+    const Device& dev,
+    unsigned int entry,
+    uint8_t apic_id,
+    MSITriggerMode trigger_mode,
+    MSIDeliveryMode delivery_mode,
+    uint8_t vector
+);
+
+// DisableMSIX turns MSI-X off, so that MSI can be used instead
+void DisableMSIX(const Device& dev);
+
 } // namespace pci
 
 
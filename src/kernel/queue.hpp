@@ -1,5 +1,7 @@
 #pragma once
 
+#include <array>
+#include <atomic>
 #include <cstdint>
 
 #include "error.hpp"
@@ -80,3 +82,107 @@ template <typename T>
 const T& ArrayQueue<T>::Front() const {
     return data_[read_pos_];
 }
+
+
+// MPSCQueue is a fixed-capacity FIFO queue which many producers push to and
+// one consumer pops from, without locks.
+// Producers may be interrupt handlers: Push never allocates nor waits for
+// others, and fails with kFull instead (the caller decides what to drop).
+// Each slot has a sequence number telling whether it's free for the producer
+// of the round or published to the consumer.
+template <typename T, size_t N>
+class MPSCQueue {
+    static_assert(N > 0 && (N & (N - 1)) == 0, "capacity must be a power of 2");
+
+private:
+    struct Slot {
+        std::atomic<size_t> seq;
+        T value;
+    };
+
+    std::array<Slot, N> slots_;
+    std::atomic<size_t> write_pos_;
+    size_t read_pos_; // owned by the consumer
+
+public:
+    MPSCQueue();
+    MPSCQueue(const MPSCQueue &) = delete;
+    MPSCQueue &operator =(const MPSCQueue &) = delete;
+
+    Error Push(const T& value);
+    // Empty, Front and Pop are for the consumer only.
+    // A slot reserved by an interrupted producer is seen as empty until published.
+    bool Empty() const;
+    const T& Front() const;
+    Error Pop();
+    // Count includes the slots being written
+    size_t Count() const;
+    size_t Capacity() const;
+};
+
+
+template <typename T, size_t N>
+MPSCQueue<T, N>::MPSCQueue() : write_pos_{0}, read_pos_{0} {
+    for (size_t i = 0; i < N; ++i) {
+        slots_[i].seq.store(i, std::memory_order_relaxed);
+    }
+}
+
+template <typename T, size_t N>
+Error MPSCQueue<T, N>::Push(const T& value) {
+    size_t pos = write_pos_.load(std::memory_order_relaxed);
+    Slot *slot;
+    while (true) {
+        slot = &slots_[pos & (N - 1)];
+        const auto diff = static_cast<intptr_t>(slot->seq.load(std::memory_order_acquire)) -
+            static_cast<intptr_t>(pos);
+        if (diff == 0) {
+            // free for this round, reserve it
+            if (write_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // not consumed since the previous round
+            return MAKE_ERROR(Error::kFull);
+        } else {
+            // another producer took it
+            pos = write_pos_.load(std::memory_order_relaxed);
+        }
+    }
+
+    slot->value = value;
+    slot->seq.store(pos + 1, std::memory_order_release);
+    return MAKE_ERROR(Error::kSuccess);
+}
+
+template <typename T, size_t N>
+bool MPSCQueue<T, N>::Empty() const {
+    return slots_[read_pos_ & (N - 1)].seq.load(std::memory_order_acquire) != read_pos_ + 1;
+}
+
+template <typename T, size_t N>
+const T& MPSCQueue<T, N>::Front() const {
+    return slots_[read_pos_ & (N - 1)].value;
+}
+
+template <typename T, size_t N>
+Error MPSCQueue<T, N>::Pop() {
+    if (Empty()) {
+        return MAKE_ERROR(Error::kEmpty);
+    }
+
+    // hand the slot to the producer of the next round
+    slots_[read_pos_ & (N - 1)].seq.store(read_pos_ + N, std::memory_order_release);
+    ++read_pos_;
+    return MAKE_ERROR(Error::kSuccess);
+}
+
+template <typename T, size_t N>
+size_t MPSCQueue<T, N>::Count() const {
+    return write_pos_.load(std::memory_order_relaxed) - read_pos_;
+}
+
+template <typename T, size_t N>
+size_t MPSCQueue<T, N>::Capacity() const {
+    return N;
+}
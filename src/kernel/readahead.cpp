@@ -0,0 +1,46 @@
+#include "readahead.hpp"
+
+#include "fat.hpp"
+#include "interrupt.hpp"
+#include "logger.hpp"
+#include "task.hpp"
+
+namespace {
+    uint64_t read_ahead_task_id;
+
+    // called by readers, queue the range to the task
+    void requestReadAhead(uint64_t offset, size_t len) {
+        Message msg{Message::kReadAhead};
+        msg.arg.read_ahead.offset = offset;
+        msg.arg.read_ahead.len = len;
+
+        task_manager->SendMessage(read_ahead_task_id, msg);
+    }
+
+    void ReadAheadTask(uint64_t task_id, int64_t data) {
+        Task &task = task_manager->CurrentTask();
+
+        while (true) {
+            auto msg = task.WaitMessage();
+            if (msg.type != Message::kReadAhead) {
+                continue;
+            }
+
+            // fat is not reentrant, so prefetch without being preempted.
+            // if a reader was interrupted in the middle of the cache, the request
+            // is dropped and the reader loads the blocks by itself.
+            InterruptGuard guard;
+            if (!fat::Prefetch(msg.arg.read_ahead.offset, msg.arg.read_ahead.len)) {
+                Log(kLogFS, kDebug, "read-ahead dropped: %lx\n", msg.arg.read_ahead.offset);
+            }
+        }
+    }
+}
+
+void InitializeReadAhead() {
+    read_ahead_task_id = task_manager->NewTask()
+        .InitContext(ReadAheadTask, 0)
+        .Wakeup()
+        .ID();
+    fat::SetReadAheadHandler(requestReadAhead);
+}
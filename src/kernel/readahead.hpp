@@ -0,0 +1,5 @@
+#pragma once
+
+// InitializeReadAhead starts the task which prefetches blocks
+// for sequential readers of fat files
+void InitializeReadAhead();
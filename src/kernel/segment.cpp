@@ -3,7 +3,13 @@
 
 namespace {
     // Global Descriptor Table
-    std::array<SegmentDescriptor, 3> gdt;
+    std::array<SegmentDescriptor, 5> gdt;
+    // Task State Segment, 104 bytes
+    std::array<uint32_t, 26> tss;
+
+    const size_t kISTStackBytes = 32 * 1024;
+    alignas(16) uint8_t ist_critical_stack[kISTStackBytes];
+    alignas(16) uint8_t ist_fault_stack[kISTStackBytes];
 
     void setCodeSegment(
         SegmentDescriptor &desc,
@@ -44,6 +50,26 @@ namespace {
         desc.bits.long_mode = 0;
         desc.bits.default_operation_size = 1;
     }
+
+    void setSystemSegment(
+        SegmentDescriptor &desc,
+        DescriptorType type,
+        unsigned int descriptor_privilege_level,
+        uint32_t base,
+        uint32_t limit
+    ) {
+        setCodeSegment(desc, type, descriptor_privilege_level, base, limit);
+
+        desc.bits.system_segment = 0;
+        desc.bits.long_mode = 0;
+        desc.bits.granualarity = 0; // limit unit is byte
+    }
+
+    // tss fields are 64bit, but not aligned to 8 bytes
+    void setTSS64(int index, uint64_t value) {
+        tss[index] = value & 0xffffffffu;
+        tss[index + 1] = value >> 32;
+    }
 }
 
 void SetupSegments() {
@@ -53,8 +79,27 @@ void SetupSegments() {
     LoadGDT(sizeof(gdt)-1, reinterpret_cast<uintptr_t>(&gdt[0]));
 }
 
+void InitializeTSS() {
+    // IST1-7 start at offset 0x24 (dword 9)
+    setTSS64(9 + 2*(kISTCritical - 1),
+             reinterpret_cast<uint64_t>(ist_critical_stack + kISTStackBytes));
+    setTSS64(9 + 2*(kISTFault - 1),
+             reinterpret_cast<uint64_t>(ist_fault_stack + kISTStackBytes));
+    // no I/O permission bitmap
+    tss[25] = sizeof(tss) << 16;
+
+    const uint64_t tss_addr = reinterpret_cast<uint64_t>(&tss[0]);
+    setSystemSegment(gdt[kTSS >> 3], DescriptorType::kTSSAvailable, 0,
+                     tss_addr & 0xffffffffu, sizeof(tss) - 1);
+    // upper half of the base address
+    gdt[(kTSS >> 3) + 1].data = tss_addr >> 32;
+
+    LoadTR(kTSS);
+}
+
 void InitializeSegmentation() {
     SetupSegments();
     SetDSAll(kKernelDS);
     SetCSSS(kKernelCS, kKernelSS);
+    InitializeTSS();
 }
@@ -27,6 +27,16 @@ union SegmentDescriptor {
 const uint16_t kKernelCS = 1 << 3;
 const uint16_t kKernelSS = 2 << 3;
 const uint16_t kKernelDS = 0;
+// TSS descriptor takes two entries
+const uint16_t kTSS = 3 << 3;
+
+// interrupt stack table indices (IST in the IDT attribute)
+// kISTCritical is for NMI, #DF and #MC, which must not trust the current stack.
+// kISTFault is for the other exceptions.
+const int kISTCritical = 1;
+const int kISTFault = 2;
 
 void SetupSegments();
 void InitializeSegmentation();
+// InitializeTSS loads the task state segment with the IST stacks
+void InitializeTSS();
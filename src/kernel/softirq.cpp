@@ -0,0 +1,75 @@
+#include "softirq.hpp"
+
+#include <array>
+#include <atomic>
+
+#include "interrupt.hpp"
+#include "logger.hpp"
+#include "task.hpp"
+#include "trace.hpp"
+
+namespace {
+    // CPUs with local APIC ID beyond this share the last bitmap
+    const uint32_t kMaxCPUs = 16;
+    // usb drivers ran on the main stack before, and interrupts nest on it
+    const size_t kStackBytes = 64 * 1024;
+
+    std::array<SoftirqHandler *, static_cast<size_t>(Softirq::kCount)> handlers{};
+    // pending bitmaps indexed by the local APIC ID
+    std::array<std::atomic<uint32_t>, kMaxCPUs> pending{};
+    Task *softirq_task;
+
+    std::atomic<uint32_t> &localPending() {
+        const auto id = LocalAPICID();
+        return pending[id < kMaxCPUs ? id : kMaxCPUs - 1];
+    }
+
+    void SoftirqTask(uint64_t task_id, int64_t data) {
+        Task &task = task_manager->CurrentTask();
+
+        while (true) {
+            uint32_t bits = localPending().exchange(0);
+            if (bits == 0) {
+                // check again with interrupts disabled, then sleep until raised
+                InterruptGuard guard;
+                if (localPending().load() == 0) {
+                    task.Sleep();
+                }
+                continue;
+            }
+
+            for (size_t i = 0; i < handlers.size(); ++i) {
+                if ((bits & (1u << i)) && handlers[i]) {
+                    Trace(TraceEvent::kSoftirqBegin, i);
+                    handlers[i]();
+                    Trace(TraceEvent::kSoftirqEnd, i);
+                }
+            }
+        }
+    }
+}
+
+void RegisterSoftirq(Softirq softirq, SoftirqHandler *handler) {
+    handlers[static_cast<size_t>(softirq)] = handler;
+}
+
+void RaiseSoftirq(Softirq softirq) {
+    localPending().fetch_or(1u << static_cast<int>(softirq));
+    if (softirq_task) {
+        softirq_task->Wakeup();
+    }
+}
+
+void PreemptForSoftirq() {
+    if (softirq_task && localPending().load() != 0 &&
+        &task_manager->CurrentTask() != softirq_task) {
+        task_manager->SwitchTask();
+    }
+}
+
+void InitializeSoftirq() {
+    InterruptGuard guard;
+    Task &task = task_manager->NewTask().InitContext(SoftirqTask, 0, kStackBytes);
+    task_manager->Wakeup(&task, TaskManager::kMaxLevel);
+    softirq_task = &task;
+}
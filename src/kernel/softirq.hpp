@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstdint>
+
+// Softirq is work deferred by an interrupt handler (the bottom half).
+// Handlers only mark it pending; the softirq task runs it at the highest
+// task level, apart from the main task drawing the screen.
+enum class Softirq {
+    kTimer,
+    // before kXHCI, so input isn't delayed behind other transfers
+    kXHCIInput,
+    kXHCI,
+    kCount,
+};
+
+using SoftirqHandler = void ();
+
+// RegisterSoftirq sets the function which runs the work
+void RegisterSoftirq(Softirq softirq, SoftirqHandler *handler);
+// RaiseSoftirq marks the work pending on this CPU and wakes the softirq task.
+// It's called with interrupts disabled, usually from interrupt handlers.
+void RaiseSoftirq(Softirq softirq);
+// PreemptForSoftirq switches to the softirq task if work is pending.
+// Interrupt handlers call it last, after the end of interrupt.
+void PreemptForSoftirq();
+// InitializeSoftirq starts the softirq task
+void InitializeSoftirq();
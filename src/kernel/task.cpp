@@ -6,7 +6,9 @@
 #include "timer.hpp"
 #include "asmfunc.h"
 #include "segment.hpp"
+#include "interrupt.hpp"
 #include "logger.hpp"
+#include "trace.hpp"
 
 
 namespace {
@@ -29,11 +31,10 @@ TaskManager *task_manager;
 void InitializeTask() {
     task_manager = new TaskManager();
 
-    __asm__("cli");
+    InterruptGuard guard;
     timer_manager->AddTimer(
         Timer{timer_manager->CurrentTick()+kTaskTimerPeriod, kTaskTimerValue}
     );
-    __asm__("sti");
 }
 
 Task& Task::setLevel(int level) {
@@ -46,11 +47,11 @@ Task& Task::setRunning(bool running) {
     return *this;
 }
 
-Task::Task(uint64_t id): id_{id}, msgs_{} {};
+Task::Task(uint64_t id): id_{id} {};
 
-Task &Task::InitContext(TaskFunc *f, int64_t data) {
+Task &Task::InitContext(TaskFunc *f, int64_t data, size_t stack_bytes) {
     // stack
-    const size_t stack_size = kDefaultStackBytes / sizeof(stack_[0]);
+    const size_t stack_size = stack_bytes / sizeof(stack_[0]);
     stack_.resize(stack_size);
     uint64_t stack_end = reinterpret_cast<uint64_t>(&stack_[stack_size]);
 
@@ -81,6 +82,10 @@ uint64_t Task::ID() const {
     return id_;
 }
 
+size_t Task::StackBytes() const {
+    return stack_.size() * sizeof(stack_[0]);
+}
+
 bool Task::Running() const {
     return running_;
 }
@@ -99,21 +104,84 @@ Task& Task::Wakeup() {
     return *this;
 }
 
-void Task::SendMessage(const Message& msg) {
-    msgs_.push_back(msg);
+Task& Task::SetAddressSpace(AddressSpace *as) {
+    address_space_ = as;
+    return *this;
+}
+
+AddressSpace *Task::GetAddressSpace() const {
+    return address_space_;
+}
+
+uint64_t &Task::OSStackPointer() {
+    return os_stack_ptr_;
+}
+
+std::vector<std::shared_ptr<::FileDescriptor>> &Task::Files() {
+    return files_;
+}
+
+Error Task::SendMessage(const Message& msg) {
+    if (auto err = msgs_.Push(msg)) {
+        // drop the newest: the receiver is behind, and older messages
+        // (such as the key pushes) are kept in order
+        dropped_messages_.fetch_add(1, std::memory_order_relaxed);
+        return err;
+    }
+
+    // the run queues are shared with the scheduler on the timer interrupt
+    InterruptGuard guard;
     Wakeup();
+    return MAKE_ERROR(Error::kSuccess);
 }
 
 std::optional<Message> Task::ReceiveMessage() {
-    if (msgs_.empty()) {
+    if (msgs_.Empty()) {
         return std::nullopt;
     }
 
-    auto m = msgs_.front();
-    msgs_.pop_front();
+    auto m = msgs_.Front();
+    msgs_.Pop();
     return m;
 }
 
+Message Task::WaitMessage() {
+    while (true) {
+        if (auto msg = ReceiveMessage()) {
+            return *msg;
+        }
+
+        // check again with interrupts disabled, or a message sent just before
+        // sleeping would not wake us up
+        InterruptGuard guard;
+        if (msgs_.Empty()) {
+            Sleep();
+        }
+    }
+}
+
+size_t Task::ReceiveMessages(Message *msgs, size_t max) {
+    size_t count = 0;
+    while (count < max && !msgs_.Empty()) {
+        msgs[count++] = msgs_.Front();
+        msgs_.Pop();
+    }
+    return count;
+}
+
+size_t Task::WaitMessages(Message *msgs, size_t max) {
+    if (max == 0) {
+        return 0;
+    }
+
+    msgs[0] = WaitMessage();
+    return 1 + ReceiveMessages(msgs + 1, max - 1);
+}
+
+uint64_t Task::DroppedMessages() const {
+    return dropped_messages_.load(std::memory_order_relaxed);
+}
+
 
 TaskManager::TaskManager() {
     // spawn task for the caller of TaskManager constructor (main task)
@@ -164,6 +232,10 @@ void TaskManager::SwitchTask(bool current_sleep) {
     }
 
     Task* next_task = running_[current_level_].front();
+    if (next_task != current_task) {
+        irq_off_start = 0;
+        Trace(TraceEvent::kTaskSwitch, current_task->ID(), next_task->ID());
+    }
     SwitchContext(&next_task->Context(), &current_task->Context());
 }
 
@@ -240,20 +312,77 @@ Task& TaskManager::CurrentTask() {
 }
 
 Error TaskManager::SendMessage(uint64_t id, const Message& msg) {
-    auto it = std::find_if(tasks_.begin(), tasks_.end(),
-        [id](const auto& t) {
-            return t->ID() == id;
-        }
-    );
+    // callers don't disable interrupts, and tasks_ may be growing in NewTask
+    InterruptGuard guard;
+    Task *task = findTask(id);
+    if (!task) {
+        return MAKE_ERROR(Error::kNoSuchTask);
+    }
 
-    if (it == tasks_.end()) {
+    return task->SendMessage(msg);
+}
+
+WithError<Message> TaskManager::Call(uint64_t id, const Message& msg) {
+    InterruptGuard guard;
+    Task &current = CurrentTask();
+    Task *server = findTask(id);
+    if (!server) {
+        return {Message{}, MAKE_ERROR(Error::kNoSuchTask)};
+    }
+    if (server == &current) {
+        // would wait for itself forever
+        return {Message{}, MAKE_ERROR(Error::kDeadlock)};
+    }
+
+    Message request = msg;
+    request.src_task = current.ID();
+    if (auto err = server->msgs_.Push(request)) {
+        server->dropped_messages_.fetch_add(1, std::memory_order_relaxed);
+        return {Message{}, err};
+    }
+
+    current.calling_ = id;
+    current.reply_.reset();
+    handoff(server, true);
+
+    // other messages wake us up too, wait for the reply
+    while (!current.reply_) {
+        Sleep(&current);
+    }
+    return {*current.reply_, MAKE_ERROR(Error::kSuccess)};
+}
+
+Error TaskManager::Reply(uint64_t caller, const Message& msg) {
+    InterruptGuard guard;
+    Task &current = CurrentTask();
+    Task *task = findTask(caller);
+    if (!task) {
         return MAKE_ERROR(Error::kNoSuchTask);
     }
+    if (task->calling_ != current.ID()) {
+        // the request was an ordinary message
+        return task->SendMessage(msg);
+    }
 
-    (*it)->SendMessage(msg);
+    task->calling_ = 0;
+    task->reply_ = msg;
+    handoff(task, false);
     return MAKE_ERROR(Error::kSuccess);
 }
 
+size_t TaskManager::TaskCount() const {
+    return tasks_.size();
+}
+
+size_t TaskManager::MemoryBytes() const {
+    size_t bytes = 0;
+    for (const auto &task : tasks_) {
+        bytes += sizeof(Task) + task->StackBytes();
+    }
+
+    return bytes;
+}
+
 void TaskManager::changeRunLevel(Task* task, int level) {
     if (level < 0 || level == task->Level()) {
         return;
@@ -283,3 +412,37 @@ void TaskManager::changeRunLevel(Task* task, int level) {
     
     current_level_ = level;
 }
+
+Task *TaskManager::findTask(uint64_t id) {
+    auto it = std::find_if(tasks_.begin(), tasks_.end(),
+        [id](const auto& t) {
+            return t->ID() == id;
+        }
+    );
+    return it == tasks_.end() ? nullptr : it->get();
+}
+
+void TaskManager::handoff(Task* next, bool current_sleep) {
+    auto& level_queue = running_[current_level_];
+    Task* current_task = level_queue.front();
+    level_queue.pop_front();
+    if (current_sleep) {
+        current_task->setRunning(false);
+    } else {
+        level_queue.push_back(current_task);
+    }
+
+    // run `next` now, even if a task of a higher level is waiting.
+    // the next SwitchTask looks for the highest level again.
+    if (next->Running()) {
+        erase(running_[next->Level()], next);
+    }
+    next->setRunning(true);
+    running_[next->Level()].push_front(next);
+    current_level_ = next->Level();
+    level_changed_ = true;
+
+    irq_off_start = 0;
+    Trace(TraceEvent::kTaskSwitch, current_task->ID(), next->ID());
+    SwitchContext(&next->Context(), &current_task->Context());
+}
@@ -8,6 +8,8 @@
 
 #include "error.hpp"
 #include "message.hpp"
+#include "queue.hpp"
+#include "file.hpp"
 
 struct TaskContext {
     uint64_t cr3, rip, rflags, reserved1; // offset 0x00
@@ -23,33 +25,66 @@ void InitializeTask();
 
 using TaskFunc = void (uint64_t, int64_t);
 
+class AddressSpace;
+
 class Task {
 public:
     static const size_t kDefaultStackBytes = 4096;
     static const int kDefaultLevel = 1;
+    static const size_t kMessageQueueCapacity = 256;
     
     Task(uint64_t id);
     Task(const Task &obj) = delete;
-    Task& InitContext(TaskFunc *f, int64_t data);
+    Task& InitContext(TaskFunc *f, int64_t data, size_t stack_bytes=kDefaultStackBytes);
 
     TaskContext &Context();
     uint64_t ID() const;
+    size_t StackBytes() const;
     bool Running() const;
     int Level() const;
 
     Task& Sleep();
     Task& Wakeup();
 
-    void SendMessage(const Message& msg);
+    // SetAddressSpace sets the address space of the app running on this task.
+    // nullptr means the kernel's.
+    Task& SetAddressSpace(AddressSpace *as);
+    AddressSpace *GetAddressSpace() const;
+    // OSStackPointer is where CallApp saved the stack while an app runs
+    // on this task, 0 otherwise. ExitApp returns to it to kill the app.
+    uint64_t &OSStackPointer();
+
+    // Files is the descriptor table, indexed by fd
+    std::vector<std::shared_ptr<::FileDescriptor>> &Files();
+
+    // SendMessage queues the message and wakes the task up. It may be called
+    // from interrupt handlers. When the queue is full, the message is dropped
+    // and counted, and kFull is returned.
+    Error SendMessage(const Message& msg);
+    // ReceiveMessage takes a message if any. Only this task may call it.
     std::optional<Message> ReceiveMessage();
+    // WaitMessage takes a message, sleeping until one arrives
+    Message WaitMessage();
+    // ReceiveMessages takes up to `max` messages in order and returns the count
+    size_t ReceiveMessages(Message *msgs, size_t max);
+    // WaitMessages is ReceiveMessages which sleeps until at least one arrives
+    size_t WaitMessages(Message *msgs, size_t max);
+    uint64_t DroppedMessages() const;
 
 private:
     uint64_t id_;
     std::vector<uint64_t> stack_;
     alignas(16) TaskContext context_;
-    std::deque<Message> msgs_;
+    MPSCQueue<Message, kMessageQueueCapacity> msgs_{};
+    std::atomic<uint64_t> dropped_messages_{0};
+    // set while the task is blocked in TaskManager::Call
+    uint64_t calling_{0};
+    std::optional<Message> reply_{};
     unsigned int level_{kDefaultLevel};
     bool running_{false};
+    AddressSpace *address_space_{nullptr};
+    uint64_t os_stack_ptr_{0};
+    std::vector<std::shared_ptr<::FileDescriptor>> files_{};
 
     Task& setLevel(int level);
     Task& setRunning(bool running);
@@ -74,6 +109,16 @@ public:
 
     Task& CurrentTask();
     Error SendMessage(uint64_t id, const Message& msg);
+    // Call sends a request to the task `id` and blocks until it replies.
+    // The receiver is switched to directly, using the rest of the caller's timeslice.
+    WithError<Message> Call(uint64_t id, const Message& msg);
+    // Reply answers a request from `caller`. If it's blocked in Call, it is
+    // switched back to directly; otherwise the reply is sent as a message.
+    Error Reply(uint64_t caller, const Message& msg);
+
+    size_t TaskCount() const;
+    // MemoryBytes returns bytes used by task structures and their stacks
+    size_t MemoryBytes() const;
 
 private:
     std::vector<std::unique_ptr<Task>> tasks_{};
@@ -83,6 +128,10 @@ private:
     bool level_changed_{false};
 
     void changeRunLevel(Task* task, int level);
+    Task *findTask(uint64_t id);
+    // handoff switches from the current task to `next` without going through
+    // the run queues. The current task sleeps or goes to the back of its queue.
+    void handoff(Task* next, bool current_sleep);
 };
 
 extern TaskManager* task_manager;
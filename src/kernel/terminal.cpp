@@ -1,6 +1,8 @@
 #include "terminal.hpp"
 
+#include <cerrno>
 #include <cstring>
+#include <algorithm>
 
 #include "layer.hpp"
 #include "task.hpp"
@@ -9,8 +11,20 @@
 #include "font.hpp"
 #include "pci.hpp"
 #include "fat.hpp"
+#include "file.hpp"
 #include "terminal.hpp"
 #include "elf.hpp"
+#include "asmfunc.h"
+#include "address_space.hpp"
+#include "memory_manager.hpp"
+#include "page_cache.hpp"
+#include "timer.hpp"
+#include "channel.hpp"
+#include "interrupt.hpp"
+#include "irqstat.hpp"
+#include "exception.hpp"
+#include "trace.hpp"
+#include "usb/memory.hpp"
 
 
 namespace {
@@ -51,6 +65,71 @@ std::vector<char *> makeArgVector(char *command, char *first_arg) {
     return argv;
 }
 
+// loadELF registers PT_LOAD segments to be mapped at their link addresses.
+// Pages are loaded from the file on the first touch (see AddressSpace::HandlePageFault).
+Error loadELF(AddressSpace &as, const fat::DirectoryEntry &file_entry,
+              const std::vector<uint8_t> &header_buf) {
+    auto elf_header = reinterpret_cast<const Elf64_Ehdr *>(&header_buf[0]);
+    const auto phdr_end = elf_header->e_phoff + elf_header->e_phnum * sizeof(Elf64_Phdr);
+    if (phdr_end > header_buf.size()) {
+        return MAKE_ERROR(Error::kInvalidFile);
+    }
+
+    // shared by all segments, so that page faults can seek the file quickly
+    auto file = std::make_shared<const fat::ExtentMap>(file_entry);
+
+    auto phdr = reinterpret_cast<const Elf64_Phdr *>(&header_buf[elf_header->e_phoff]);
+    for (int i = 0; i < elf_header->e_phnum; ++i) {
+        if (phdr[i].p_type != PT_LOAD) {
+            continue;
+        }
+
+        if (phdr[i].p_vaddr < AddressSpace::kUserBase ||
+            phdr[i].p_filesz > phdr[i].p_memsz ||
+            phdr[i].p_offset + phdr[i].p_filesz > file_entry.file_size) {
+            // apps must be linked to the upper half, lower half is the kernel's
+            return MAKE_ERROR(Error::kInvalidFile);
+        }
+
+        FileRegion region{
+            phdr[i].p_vaddr, phdr[i].p_memsz,
+            phdr[i].p_offset, phdr[i].p_filesz,
+            (phdr[i].p_flags & PF_W) != 0,
+            file
+        };
+        if (auto err = as.MapFile(region)) {
+            return err;
+        }
+    }
+
+    return MAKE_ERROR(Error::kSuccess);
+}
+
+// formatCycles writes TSC cycles as time, such as "750ns" or "12us"
+void formatCycles(char *s, size_t len, uint64_t cycles) {
+    const uint64_t ns = cycles * 1000 / std::max<uint64_t>(tsc_freq / 1000000, 1);
+    if (ns < 10000) {
+        snprintf(s, len, "%luns", ns);
+    } else if (ns < 10000000) {
+        snprintf(s, len, "%luus", ns / 1000);
+    } else {
+        snprintf(s, len, "%lums", ns / 1000000);
+    }
+}
+
+const LogLevel kLogLevels[] = {kError, kWarn, kInfo, kDebug};
+const char *kLogLevelNames[] = {"error", "warn", "info", "debug"};
+
+const char *vectorName(int vector) {
+    switch (vector) {
+        case InterruptVector::kPageFault: return "#PF";
+        case InterruptVector::kXHCI: return "xhci";
+        case InterruptVector::kXHCIInput: return "xhci-in";
+        case InterruptVector::kLAPICTimer: return "timer";
+        default: return vector < 32 ? "exception" : "";
+    }
+}
+
 } // namespace
 
 
@@ -86,6 +165,10 @@ Rectangle<int> Terminal::BlinkCursor() {
     };
 }
 
+void Terminal::Output(const char *s) {
+    print(s);
+}
+
 Rectangle<int> Terminal::InputKey(uint8_t modifier, uint8_t keycode, char ascii) {
     drawCursor(false);
 
@@ -222,67 +305,251 @@ void Terminal::executeLine() {
         for (int i = 0 ; i < pci::num_device; ++i) {
             const auto &dev = pci::devices[i];
             auto vendor_id = pci::ReadVendorID(dev);
-            sprintf(s, "%02x:%02x.%d vendor %04x head %02x class %02x.%02x.%02x\n", 
+            snprintf(s, sizeof(s), "%02x:%02x.%d vendor %04x head %02x class %02x.%02x.%02x\n", 
                 dev.bus, dev.device, dev.function, vendor_id, dev.header_type,
                 dev.class_code.base, dev.class_code.sub, dev.class_code.interface);
             print(s);
         }
     } else if (strcmp(command, "ls") == 0) {
-        auto root_dir_entries = fat::GetSectorByCluster<fat::DirectoryEntry>(
-            fat::boot_volume_image->root_cluster
-        );
-        auto entries_per_cluster = fat::bytes_per_cluster / sizeof(fat::DirectoryEntry);
-        char base[9], ext[4];
         char s[64];
-
-        for (int i = 0; i < entries_per_cluster; ++i) {
-            fat::ReadName(root_dir_entries[i], base, ext);
-            if (base[0] == 0x00) {
-                // this DirectoryEntry is empty, and no entries follows.
-                break;
-            } else if (static_cast<uint8_t>(base[0]) == 0xe5) {
-                // this DirectoryEntry is empty.
-                continue;
-            } else if (root_dir_entries[i].attr == fat::Attribute::kLongName) {
-                continue;
+        unsigned long dir_cluster = 0; // root
+        if (first_arg && first_arg[0]) {
+            auto dir_entry = fat::FindFile(first_arg);
+            if (!dir_entry) {
+                snprintf(s, sizeof(s), "no such directory: %s\n", first_arg);
+                print(s);
+                return;
             }
-
-            if (ext[0]) {
-                sprintf(s, "%s.%s\n", base, ext);
-            } else {
-                sprintf(s, "%s\n", base);
+            if ((static_cast<uint8_t>(dir_entry->attr) &
+                 static_cast<uint8_t>(fat::Attribute::kDirectory)) == 0) {
+                print(first_arg);
+                print("\n");
+                return;
             }
+            dir_cluster = dir_entry->FirstCluster();
+        }
 
-            print(s);
+        for (const auto &item : fat::ReadDirectory(dir_cluster)) {
+            const bool is_dir = (static_cast<uint8_t>(item.entry->attr) &
+                                 static_cast<uint8_t>(fat::Attribute::kDirectory)) != 0;
+            print(item.name.c_str());
+            print(is_dir ? "/\n" : "\n");
         }
     } else if (strcmp(command, "cat") == 0) {
         char s[64];
-        Log(kWarn, "start cat\n");
 
-        auto file_entry = fat::FindFile(first_arg);
-        Log(kWarn, "file_entry %p\n", file_entry);
-        if (!file_entry) {
-            sprintf(s, "no such file: %s\n", first_arg);
+        const int fd = OpenFD(first_arg, kOpenRead);
+        if (fd == -ENOENT) {
+            snprintf(s, sizeof(s), "no such file: %s\n", first_arg);
             print(s); // print entire string
+        } else if (fd == -EISDIR) {
+            snprintf(s, sizeof(s), "is a directory: %s\n", first_arg);
+            print(s);
+        } else if (fd < 0) {
+            snprintf(s, sizeof(s), "cannot open %s (errno %d)\n", first_arg, -fd);
+            print(s);
         } else {
-            // found file, read it!
-            auto cluster = file_entry->FirstCluster();
-            auto remain_bytes = file_entry->file_size;
+            // found file, stream it through a bounded buffer
+            char buf[256];
 
             drawCursor(false);
-            while (cluster != 0 && cluster != fat::kEndOfClusterChain) {
-                char *p = fat::GetSectorByCluster<char>(cluster);
-                int i = 0;
-                for (; i < fat::bytes_per_cluster && i < remain_bytes; ++i) {
-                    print(*p); // print only this char
-                    ++p;
+            while (true) {
+                const auto n = ReadFD(fd, buf, sizeof(buf));
+                if (n < 0) {
+                    snprintf(s, sizeof(s), "\nread error (errno %ld)\n", -n);
+                    print(s);
+                    break;
+                } else if (n == 0) {
+                    break;
+                }
+                for (long i = 0; i < n; ++i) {
+                    print(buf[i]); // print only this char
                 }
-                remain_bytes -= i;
-                cluster = fat::NextCluster(cluster);
             }
+            CloseFD(fd);
 
             drawCursor(true);
         }
+    } else if (strcmp(command, "df") == 0) {
+        char s[64];
+        const auto stat = fat::GetVolumeStat();
+        snprintf(s, sizeof(s), "volume: %lu / %lu KiB free\n",
+            stat.free_clusters * fat::bytes_per_cluster / 1024,
+            stat.total_clusters * fat::bytes_per_cluster / 1024);
+        print(s);
+        snprintf(s, sizeof(s), "contiguous runs: %lu\n", stat.chain_runs);
+        print(s);
+    } else if (strcmp(command, "sync") == 0) {
+        if (auto err = fat::Sync()) {
+            char s[64];
+            snprintf(s, sizeof(s), "sync failed: %s\n", err.Name());
+            print(s);
+        }
+    } else if (strcmp(command, "meminfo") == 0 || strcmp(command, "free") == 0) {
+        char s[128];
+        const unsigned long kKiBPerFrame = kBytesPerFrame / 1024;
+
+        const auto mem = memory_manager->Stat();
+        snprintf(s, sizeof(s), "frames: %lu / %lu used (%lu KiB free)\n",
+            mem.allocated_frames, mem.total_frames,
+            (mem.total_frames - mem.allocated_frames) * kKiBPerFrame);
+        print(s);
+        snprintf(s, sizeof(s), "  free runs %lu, largest %lu KiB\n",
+            mem.free_runs, mem.largest_free_run * kKiBPerFrame);
+        print(s);
+        snprintf(s, sizeof(s), "  alloc %lu, free %lu, failed %lu\n",
+            mem.alloc_count, mem.free_count, mem.failed_count);
+        print(s);
+        snprintf(s, sizeof(s), "  cached in magazines %lu KiB\n",
+            frame_cache->CachedFrames() * kKiBPerFrame);
+        print(s);
+
+        const auto heap = GetHeapStat();
+        snprintf(s, sizeof(s), "heap: %lu / %lu KiB used, high water %lu KiB\n",
+            heap.used_bytes / 1024, heap.total_bytes / 1024, heap.high_water_bytes / 1024);
+        print(s);
+
+        snprintf(s, sizeof(s), "  windows:    %lu KiB\n", layer_manager->MemoryBytes() / 1024);
+        print(s);
+        snprintf(s, sizeof(s), "  tasks:      %lu KiB (%lu tasks)\n",
+            task_manager->MemoryBytes() / 1024, task_manager->TaskCount());
+        print(s);
+        snprintf(s, sizeof(s), "usb pool: %lu / %lu KiB used\n",
+            usb::UsedMemoryBytes() / 1024, usb::kMemoryPoolSize / 1024);
+        print(s);
+        snprintf(s, sizeof(s), "page cache: %lu KiB\n", page_cache->Count() * kBytesPerPage / 1024);
+        print(s);
+        const auto blocks = fat::CacheStat();
+        snprintf(s, sizeof(s), "block cache: %lu / %lu KiB (hit %lu, miss %lu, prefetch %lu)\n",
+            blocks.cached_blocks * block::Cache::kBlockBytes / 1024,
+            blocks.capacity_blocks * block::Cache::kBlockBytes / 1024,
+            blocks.hits, blocks.misses, blocks.prefetched_blocks);
+        print(s);
+    } else if (strcmp(command, "irqstat") == 0) {
+        if (first_arg && strcmp(first_arg, "reset") == 0) {
+            InterruptGuard guard;
+            ResetIRQStats();
+            return;
+        }
+
+        char s[64], avg[16], max[16];
+        const auto secs = std::max<unsigned long>(timer_manager->CurrentTick() / kTimerFreq, 1);
+        print("vector         count    /sec     avg     max\n");
+        for (int vector = 0; vector < 256; ++vector) {
+            IRQStat stat;
+            {
+                InterruptGuard guard;
+                stat = GetIRQStat(vector);
+            }
+            if (stat.count == 0) {
+                continue;
+            }
+            formatCycles(avg, sizeof(avg), stat.total_cycles / stat.count);
+            formatCycles(max, sizeof(max), stat.max_cycles);
+            snprintf(s, sizeof(s), "0x%02x %-9s %6lu %7lu %7s %7s\n",
+                vector, vectorName(vector), stat.count, stat.count / secs, avg, max);
+            print(s);
+
+            // histogram, by the upper bound of each bucket
+            int shown = 0;
+            for (int i = 0; i < kIRQHistogramBuckets; ++i) {
+                if (stat.histogram[i] == 0) {
+                    continue;
+                }
+                formatCycles(max, sizeof(max), 2ul << i);
+                snprintf(s, sizeof(s), "%s<%s:%u", shown % 4 == 0 ? "  " : " ", max, stat.histogram[i]);
+                print(s);
+                if (++shown % 4 == 0) {
+                    print("\n");
+                }
+            }
+            if (shown % 4 != 0) {
+                print("\n");
+            }
+        }
+
+        std::array<IRQOffWindow, kIRQOffWindows> windows;
+        {
+            InterruptGuard guard;
+            windows = IRQOffWindows();
+        }
+        print("longest interrupts-disabled windows:\n");
+        for (const auto &w : windows) {
+            if (w.cycles == 0) {
+                break;
+            }
+            formatCycles(max, sizeof(max), w.cycles);
+            uint64_t offset;
+            if (auto name = FindKernelSymbol(w.rip, &offset)) {
+                snprintf(s, sizeof(s), "%7s ", max);
+                print(s);
+                print(name);
+                snprintf(s, sizeof(s), "+0x%lx\n", offset);
+            } else {
+                snprintf(s, sizeof(s), "%7s %016lx\n", max, w.rip);
+            }
+            print(s);
+        }
+    } else if (strcmp(command, "log") == 0) {
+        // log [subsystem level]
+        char s[128];
+        if (first_arg) {
+            char *level_name = strchr(first_arg, ' ');
+            if (level_name) {
+                *level_name++ = 0;
+            }
+            int subsystem = 0;
+            while (subsystem < kLogSubsystemCount &&
+                   strcmp(first_arg, LogSubsystemName(static_cast<LogSubsystem>(subsystem))) != 0) {
+                ++subsystem;
+            }
+            int level = -1;
+            for (int i = 0; i < 4 && level_name; ++i) {
+                if (strcmp(level_name, kLogLevelNames[i]) == 0) {
+                    level = kLogLevels[i];
+                }
+            }
+            if (subsystem == kLogSubsystemCount || level < 0) {
+                print("usage: log [kernel|usb|fs|memory error|warn|info|debug]\n");
+                return;
+            }
+            SetLogLevel(static_cast<LogSubsystem>(subsystem), static_cast<LogLevel>(level));
+        }
+
+        for (int i = 0; i < kLogSubsystemCount; ++i) {
+            const auto subsystem = static_cast<LogSubsystem>(i);
+            const char *level_name = "?";
+            for (int j = 0; j < 4; ++j) {
+                if (kLogLevels[j] == GetLogLevel(subsystem)) {
+                    level_name = kLogLevelNames[j];
+                }
+            }
+            snprintf(s, sizeof(s), "%-8s %s\n", LogSubsystemName(subsystem), level_name);
+            print(s);
+        }
+        const auto stat = GetLogStat();
+        snprintf(s, sizeof(s), "queued %lu, dropped %lu (full) %lu (rate)\n",
+            stat.queued, stat.dropped_full, stat.dropped_rate);
+        print(s);
+    } else if (strcmp(command, "trace") == 0) {
+        // trace [on|off|clear|dump [serial]]
+        char s[64];
+        const char *sub_command = first_arg ? first_arg : "";
+        if (strcmp(sub_command, "on") == 0) {
+            trace_enabled = true;
+        } else if (strcmp(sub_command, "off") == 0) {
+            trace_enabled = false;
+        } else if (strcmp(sub_command, "clear") == 0) {
+            ClearTrace();
+        } else if (strcmp(sub_command, "dump") == 0 || strcmp(sub_command, "dump serial") == 0) {
+            const bool serial = strcmp(sub_command, "dump serial") == 0;
+            const auto n = DumpTrace(serial ? TraceSink::kSerial : TraceSink::kDebugConsole);
+            snprintf(s, sizeof(s), "%lu records dumped to %s\n", n, serial ? "COM1" : "port 0xe9");
+            print(s);
+            return;
+        }
+        snprintf(s, sizeof(s), "trace %s, %lu records\n", trace_enabled ? "on" : "off", TraceRecords());
+        print(s);
     } else if (command[0] != 0) {
         auto file_entry = fat::FindFile(command);
         if (!file_entry) {
@@ -296,43 +563,58 @@ void Terminal::executeLine() {
 }
 
 void Terminal::executeFile(const fat::DirectoryEntry &file_entry, char *command, char *first_arg) {
-    auto cluster = file_entry.FirstCluster();
-    auto remain_bytes = file_entry.file_size;
+    // read only the head of the file (ELF header and program headers).
+    // the rest is loaded on demand.
+    std::vector<uint8_t> header_buf(std::min<size_t>(file_entry.file_size, kBytesPerPage));
+    fat::ReadFile(file_entry, 0, &header_buf[0], header_buf.size());
 
-    std::vector<uint8_t> file_buf(remain_bytes);
-    auto p = &file_buf[0];
-
-    while (cluster != 0 && cluster != fat::kEndOfClusterChain) {
-        const auto copy_bytes = fat::bytes_per_cluster < remain_bytes ?
-            fat::bytes_per_cluster : remain_bytes;
-        memcpy(p, fat::GetSectorByCluster<uint8_t>(cluster), copy_bytes);
+    // executables can be one of raw, or elf
+    auto elf_header = reinterpret_cast<Elf64_Ehdr *>(&header_buf[0]);
+    if (header_buf.size() < sizeof(Elf64_Ehdr) ||
+        memcmp(elf_header->e_ident, "\x7f" "ELF", 4) != 0) {
+        // not elf (raw). run it in place if it's on contiguous clusters,
+        // otherwise load whole file
+        const fat::ExtentMap file{file_entry};
+        std::vector<uint8_t> file_buf;
+        auto code = file.Pointer(0, file.FileSize());
+        if (!code) {
+            file_buf.resize(file_entry.file_size);
+            file.Read(0, &file_buf[0], file_buf.size());
+            code = &file_buf[0];
+        }
 
-        remain_bytes -= copy_bytes;
-        p += copy_bytes;
-        cluster = fat::NextCluster(cluster);
+        // raw apps return nothing, CallApp is only for killing it on exceptions
+        auto &task = task_manager->CurrentTask();
+        CallApp(0, nullptr, reinterpret_cast<uint64_t>(code), &task.OSStackPointer());
+        task.OSStackPointer() = 0;
+        return;
     }
 
-    // executables can be one of raw, or elf
-    auto elf_header = reinterpret_cast<Elf64_Ehdr *>(&file_buf[0]);
-    if (memcmp(elf_header->e_ident, "\x7f" "ELF", 4) != 0) {
-        // not elf (raw)
-        using Func = void ();
-        auto f = reinterpret_cast<Func *>(&file_buf[0]);
-        f();
+    // execute elf in its own address space
+    char s[64];
+    AddressSpace as;
+    if (auto err = as.Initialize()) {
+        snprintf(s, sizeof(s), "failed to create address space: %s\n", err.Name());
+        print(s);
+        return;
+    }
+    if (auto err = loadELF(as, file_entry, header_buf)) {
+        snprintf(s, sizeof(s), "failed to load app: %s\n", err.Name());
+        print(s);
         return;
     }
 
-    // execute elf
     auto argv = makeArgVector(command, first_arg);
-    auto entry_addr = elf_header->e_entry;
-    entry_addr += reinterpret_cast<uintptr_t>(&file_buf[0]);
-
-    using Func = int (int, char **);
-    auto f = reinterpret_cast<Func *>(entry_addr);
-    auto ret = f(argv.size(), &argv[0]);
-
-    char s[64];
-    sprintf(s, "app exited (code %d)\n", ret);
+    auto &task = task_manager->CurrentTask();
+    task.SetAddressSpace(&as);
+    SetCR3(as.CR3());
+    // returns early with 128 + vector if the app is killed by an exception
+    auto ret = CallApp(argv.size(), &argv[0], elf_header->e_entry, &task.OSStackPointer());
+    SetCR3(KernelCR3());
+    task.SetAddressSpace(nullptr);
+    task.OSStackPointer() = 0;
+
+    snprintf(s, sizeof(s), "app exited (code %d)\n", ret);
     print(s);
 }
 
@@ -367,6 +649,48 @@ Rectangle<int> Terminal::historyUpDown(int direction) {
 }
 
 
+std::shared_ptr<Channel> terminal_output;
+
+namespace {
+    // the terminal printing terminal_output, and its task
+    Terminal *output_terminal = nullptr;
+    uint64_t output_task_id = 0;
+
+    // drainOutput prints all the records of terminal_output, then draws once
+    void drainOutput() {
+        static std::vector<char> buf(256);
+        while (true) {
+            auto [len, err] = terminal_output->Read(&buf[0], buf.size() - 1);
+            if (err.Cause() == Error::kBufferTooSmall) {
+                buf.resize(len + 1);
+                continue;
+            } else if (err.Cause() == Error::kIndexOutOfRange) {
+                // a broken record stops every record after it
+                Log(kError, "terminal output is broken, discarding it\n");
+                terminal_output->Reset();
+                continue;
+            } else if (err) {
+                break; // kEmpty, the doorbell is armed
+            }
+            buf[len] = 0;
+            output_terminal->Output(&buf[0]);
+        }
+
+        Message msg = MakeLayerMessage(output_task_id, output_terminal->LayerID(), LayerOperation::Draw, {});
+        if (auto err = task_manager->Call(1, msg).error) {
+            Log(kError, "failed to draw terminal: %s\n", err.Name());
+        }
+    }
+}
+
+void FlushTerminalOutput() {
+    if (!terminal_output || !output_terminal ||
+            task_manager->CurrentTask().ID() != output_task_id) {
+        return;
+    }
+    drainOutput();
+}
+
 void TerminalTask(uint64_t task_id, int64_t data) {
     __asm__("cli");
     Task &task = task_manager->CurrentTask();
@@ -374,23 +698,35 @@ void TerminalTask(uint64_t task_id, int64_t data) {
     layer_manager->Move(terminal->LayerID(), {100, 200});
     active_layer->Activate(terminal->LayerID());
     layer_task_map->insert(std::make_pair(terminal->LayerID(), task_id));
+    if (auto [channel, err] = Channel::Create(Terminal::kOutputFrames, task_id); err) {
+        Log(kError, "failed to create terminal output: %s\n", err.Name());
+    } else {
+        terminal_output = channel;
+        output_terminal = terminal;
+        output_task_id = task_id;
+    }
     __asm__("sti");
 
+    // flush the volume periodically. fat is updated only from this task;
+    // the read-ahead task only fills the block cache through fat::Prefetch,
+    // which backs off when it interrupts another fat call.
+    // so it's flushed here rather than from a timer handler.
+    const unsigned long kSyncPeriod = kTimerFreq * 5;
+    unsigned long next_sync = kSyncPeriod;
+
     // mainloop
     while (true) {
-        __asm__("cli");
-        auto msg = task.ReceiveMessage();
-        if (!msg) {
-            task.Sleep();
-            __asm__("sti");
-            continue;
-        }
-
-        // prevent os stall
-        __asm__("sti");
+        auto msg = task.WaitMessage();
 
-        switch (msg->type) {
+        switch (msg.type) {
         case Message::kTimerTimeout:
+            if (msg.arg.timer.timeout >= next_sync) {
+                if (auto err = fat::Sync()) {
+                    Log(kError, "failed to sync: %s\n", err.Name());
+                }
+                next_sync = msg.arg.timer.timeout + kSyncPeriod;
+            }
+
             {
                 const auto area = terminal->BlinkCursor();
 
@@ -398,22 +734,29 @@ void TerminalTask(uint64_t task_id, int64_t data) {
                 Message msg = MakeLayerMessage(
                     task_id, terminal->LayerID(), LayerOperation::DrawArea, area
                 );
-                __asm__("cli");
-                task_manager->SendMessage(1, msg);
-                __asm__("sti");
+                // wait until drawn, the main task runs right away
+                if (auto err = task_manager->Call(1, msg).error) {
+                    Log(kError, "failed to draw terminal: %s\n", err.Name());
+                }
             }
 
             break;
         case Message::kKeyPush:
             {
-                const auto area = terminal->InputKey(msg->arg.keyboard.modifier,
-                                                     msg->arg.keyboard.keycode,
-                                                     msg->arg.keyboard.ascii);
+                const auto area = terminal->InputKey(msg.arg.keyboard.modifier,
+                                                     msg.arg.keyboard.keycode,
+                                                     msg.arg.keyboard.ascii);
                 Message msg = MakeLayerMessage(task_id, terminal->LayerID(), LayerOperation::DrawArea, area);
-                __asm__("cli");
-                task_manager->SendMessage(1, msg);
-                __asm__("sti");
+                if (auto err = task_manager->Call(1, msg).error) {
+                    Log(kError, "failed to draw terminal: %s\n", err.Name());
+                }
+            }
+            break;
+        case Message::kChannel:
+            if (!terminal_output || msg.arg.channel.id != terminal_output->ID()) {
+                break;
             }
+            drainOutput();
             break;
         default:
             break;
@@ -12,11 +12,15 @@ public:
     static const int kRows = 15;
     static const int kColumns = 60;
     static const int kLineMax = 128;
+    // frames of terminal_output
+    static const size_t kOutputFrames = 4;
 
     Terminal();
     unsigned int LayerID() const;
     Rectangle<int> BlinkCursor();
     Rectangle<int> InputKey(uint8_t modifier, uint8_t keycode, char ascii);
+    // Output prints text from other tasks. The caller draws the whole layer.
+    void Output(const char *s);
 
 private:
     std::shared_ptr<ToplevelWindow> window_;
@@ -41,4 +45,17 @@ private:
     Rectangle<int> historyUpDown(int direction);
 };
 
+class Channel;
+// terminal_output is read by the terminal, which prints the text records written to it.
+// stdout and stderr of apps (WriteFD) are written to it.
+extern std::shared_ptr<Channel> terminal_output;
+// FlushTerminalOutput prints what is in terminal_output now.
+// Apps run on the terminal task, so a writer which found it full calls this
+// instead of waiting for the terminal. It does nothing on other tasks.
+void FlushTerminalOutput();
+
+// apps run on the terminal's stack, and so do their page faults,
+// which read the file through the fat layer
+const size_t kTerminalStackBytes = 64 * 1024;
+
 void TerminalTask(uint64_t task_id, int64_t data);
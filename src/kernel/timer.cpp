@@ -3,6 +3,8 @@
 #include "interrupt.hpp"
 #include "acpi.hpp"
 #include "task.hpp"
+#include "softirq.hpp"
+#include "trace.hpp"
 
 
 TimerManager::TimerManager() {
@@ -10,37 +12,43 @@ TimerManager::TimerManager() {
 }
 
 void TimerManager::AddTimer(const Timer &timer) {
+    if (timer.Value() == kTaskTimerValue) {
+        // task switches are kept apart, they must happen in the interrupt handler
+        next_task_timer_ = timer.Timeout();
+        return;
+    }
     timers_.push(timer);
 }
 
 bool TimerManager::Tick() {
     ++tick_;
+    Trace(TraceEvent::kTimerTick, tick_);
 
-    bool is_task_timer = false;
-    while (true) {
-        const auto &t = timers_.top();
-        if (t.Timeout() > tick_) {
-            // timeout not arrived, skip
-            break;
-        }
-
-        // handle task timer
-        if (t.Value() == kTaskTimerValue) {
-            is_task_timer = true;
-            timers_.pop();
-            timers_.push(Timer{tick_+kTaskTimerPeriod, kTaskTimerValue});
-            continue;
-        }
+    // expired timers are sent by the softirq, out of the interrupt handler
+    if (timers_.top().Timeout() <= tick_) {
+        RaiseSoftirq(Softirq::kTimer);
+    }
+
+    if (next_task_timer_ == 0 || next_task_timer_ > tick_) {
+        return false;
+    }
+    next_task_timer_ = tick_ + kTaskTimerPeriod;
+    return true;
+}
 
+void TimerManager::Expire() {
+    // timers_ is shared with Tick
+    InterruptGuard guard;
+    Trace(TraceEvent::kTimerExpire, tick_);
+    while (timers_.top().Timeout() <= tick_) {
+        const auto &t = timers_.top();
         Message msg{Message::kTimerTimeout};
         msg.arg.timer.timeout = t.Timeout();
         msg.arg.timer.value = t.Value();
-        task_manager->SendMessage(1, msg);
-
         timers_.pop();
-    }
 
-    return is_task_timer;
+        task_manager->SendMessage(1, msg);
+    }
 }
 
 unsigned long TimerManager::CurrentTick() const {
@@ -61,6 +69,7 @@ int Timer::Value() const {
 
 TimerManager* timer_manager;
 unsigned long lapic_timer_freq;
+unsigned long tsc_freq;
 
 
 namespace {
@@ -73,17 +82,20 @@ namespace {
 
 void InitializeLAPICTimer() {
     timer_manager = new TimerManager();
+    RegisterSoftirq(Softirq::kTimer, [] { timer_manager->Expire(); });
 
     // set divide configuration (分周比)
     divide_config = 0b1011u; // 1:1
     lvt_timer = (0b001u << 16); // ?????
 
+    const auto tsc_start = ReadTSC();
     StartLAPICTimer();
     acpi::WaitMilliseconds(100);
     const auto elapsed = LAPICTimerElapsed();
     StopLAPICTimer();
 
     lapic_timer_freq = static_cast<unsigned long>(elapsed) * 10;
+    tsc_freq = (ReadTSC() - tsc_start) * 10;
 
     divide_config = 0b1011u; // 1:1
     lvt_timer = (0b010u << 16) | InterruptVector::kLAPICTimer; // ?????
@@ -104,10 +116,15 @@ void StopLAPICTimer() {
 
 
 void LAPICTimerOnInterrupt() {
+    IRQStatScope stat{InterruptVector::kLAPICTimer};
     const bool is_task_timer = timer_manager->Tick();
     NotifyEndOfInterrupt();
+    // the rest runs other tasks
+    stat.Stop();
 
     if (is_task_timer) {
         task_manager->SwitchTask();
+    } else {
+        PreemptForSoftirq();
     }
 }
@@ -27,11 +27,15 @@ class TimerManager {
 private:
     volatile unsigned long tick_{0};
     std::priority_queue<Timer> timers_{};
+    unsigned long next_task_timer_{0}; // 0 until the task timer is added
 
 public:
     TimerManager();
     void AddTimer(const Timer &timer);
+    // Tick is called by the interrupt handler, and returns true to switch tasks
     bool Tick();
+    // Expire sends kTimerTimeout for the expired timers, as a softirq
+    void Expire();
     unsigned long CurrentTick() const;
 };
 
@@ -44,6 +48,8 @@ const int kTaskTimerValue = std::numeric_limits<int>::min();
 
 extern TimerManager *timer_manager;
 extern unsigned long lapic_timer_freq;
+// time stamp counter ticks per sec, measured with the ACPI PM timer
+extern unsigned long tsc_freq;
 
 // initialize Local APIC timer
 void InitializeLAPICTimer();
@@ -0,0 +1,113 @@
+#include "trace.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+#include "asmfunc.h"
+#include "interrupt.hpp"
+#include "timer.hpp"
+
+std::atomic<bool> trace_enabled{false};
+
+namespace {
+    // CPUs with local APIC ID beyond this share the last ring
+    const uint32_t kTraceCPUs = 4;
+    // records per CPU, power of 2
+    const uint64_t kTraceRecords = 4096;
+
+    const uint16_t kDebugConsolePort = 0xe9;
+    const uint16_t kCOM1 = 0x3f8;
+
+    struct TraceRing {
+        // total records written; the latest kTraceRecords are kept
+        std::atomic<uint64_t> head;
+        std::array<TraceRecord, kTraceRecords> records;
+    };
+
+    std::array<TraceRing, kTraceCPUs> rings;
+    bool serial_initialized = false;
+
+    void initializeSerial() {
+        IoOut8(kCOM1 + 1, 0x00); // disable interrupts
+        IoOut8(kCOM1 + 3, 0x80); // DLAB on
+        IoOut8(kCOM1 + 0, 0x01); // divisor 1: 115200 baud
+        IoOut8(kCOM1 + 1, 0x00);
+        IoOut8(kCOM1 + 3, 0x03); // 8 bits, no parity, 1 stop bit
+        IoOut8(kCOM1 + 2, 0xc7); // enable and clear FIFO
+        serial_initialized = true;
+    }
+
+    void writeBytes(TraceSink sink, const void *data, size_t len) {
+        auto p = reinterpret_cast<const uint8_t *>(data);
+        for (size_t i = 0; i < len; ++i) {
+            if (sink == TraceSink::kSerial) {
+                // wait for the transmitter holding register to be empty
+                while ((IoIn8(kCOM1 + 5) & 0x20) == 0) {}
+                IoOut8(kCOM1, p[i]);
+            } else {
+                IoOut8(kDebugConsolePort, p[i]);
+            }
+        }
+    }
+
+    uint64_t keptRecords(const TraceRing &ring) {
+        return std::min(ring.head.load(std::memory_order_acquire), kTraceRecords);
+    }
+}
+
+void WriteTrace(TraceEvent event, uint32_t arg0, uint64_t arg1) {
+    const auto cpu = LocalAPICID();
+    auto &ring = rings[cpu < kTraceCPUs ? cpu : kTraceCPUs - 1];
+    // interrupts may trace in between, each takes its own slot
+    const auto index = ring.head.fetch_add(1, std::memory_order_relaxed);
+    ring.records[index & (kTraceRecords - 1)] = TraceRecord{
+        ReadTSC(), static_cast<uint16_t>(event), static_cast<uint16_t>(cpu), arg0, arg1
+    };
+}
+
+size_t DumpTrace(TraceSink sink) {
+    const bool was_enabled = trace_enabled.exchange(false);
+    if (sink == TraceSink::kSerial && !serial_initialized) {
+        initializeSerial();
+    }
+
+    TraceDumpHeader header{};
+    memcpy(header.magic, "MIKANTRC", sizeof(header.magic));
+    header.version = kTraceVersion;
+    header.record_bytes = sizeof(TraceRecord);
+    header.tsc_freq = tsc_freq;
+    header.cpus = kTraceCPUs;
+    writeBytes(sink, &header, sizeof(header));
+
+    size_t total = 0;
+    for (uint32_t cpu = 0; cpu < kTraceCPUs; ++cpu) {
+        const auto &ring = rings[cpu];
+        const uint64_t head = ring.head.load(std::memory_order_acquire);
+        const uint64_t count = keptRecords(ring);
+
+        TraceCPUHeader cpu_header{cpu, static_cast<uint32_t>(count)};
+        writeBytes(sink, &cpu_header, sizeof(cpu_header));
+        for (uint64_t i = head - count; i < head; ++i) {
+            writeBytes(sink, &ring.records[i & (kTraceRecords - 1)], sizeof(TraceRecord));
+        }
+        total += count;
+    }
+
+    trace_enabled.store(was_enabled);
+    return total;
+}
+
+void ClearTrace() {
+    for (auto &ring : rings) {
+        ring.head.store(0);
+    }
+}
+
+size_t TraceRecords() {
+    size_t total = 0;
+    for (const auto &ring : rings) {
+        total += keptRecords(ring);
+    }
+    return total;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Kernel tracing: tracepoints append fixed size binary records to a
+// per-CPU ring, without formatting or locks. The rings are dumped in binary
+// over the QEMU debug console or the serial port, and decoded on the host
+// by tools/trace2json.py into the Chrome trace format.
+
+enum class TraceEvent : uint16_t {
+    kTaskSwitch = 1,   // arg0: current task, arg1: next task
+    kTimerTick,        // arg0: tick
+    kTimerExpire,      // arg0: tick
+    kSoftirqBegin,     // arg0: Softirq
+    kSoftirqEnd,       // arg0: Softirq
+    kDrawBegin,        // arg0: layer id (~0 for an area), arg1: width << 32 | height
+    kDrawEnd,          // arg0: layer id
+    kXHCIEvent,        // arg0: TRB type, arg1: interrupter
+};
+
+struct TraceRecord {
+    uint64_t tsc;
+    uint16_t event;
+    uint16_t cpu;
+    uint32_t arg0;
+    uint64_t arg1;
+} __attribute__((packed));
+
+// dump format: TraceDumpHeader, then for each CPU a TraceCPUHeader
+// followed by `count` TraceRecords, oldest first
+struct TraceDumpHeader {
+    char magic[8]; // "MIKANTRC"
+    uint32_t version;
+    uint32_t record_bytes;
+    uint64_t tsc_freq;
+    uint32_t cpus;
+    uint32_t reserved;
+} __attribute__((packed));
+
+struct TraceCPUHeader {
+    uint32_t cpu;
+    uint32_t count;
+} __attribute__((packed));
+
+const uint32_t kTraceVersion = 1;
+
+enum class TraceSink {
+    kDebugConsole, // QEMU -debugcon, port 0xe9
+    kSerial,       // COM1
+};
+
+// off at boot. "trace on" in the terminal starts recording
+extern std::atomic<bool> trace_enabled;
+
+void WriteTrace(TraceEvent event, uint32_t arg0, uint64_t arg1);
+
+// Trace records an event. It's cheap when tracing is off.
+inline void Trace(TraceEvent event, uint32_t arg0 = 0, uint64_t arg1 = 0) {
+    if (trace_enabled.load(std::memory_order_relaxed)) {
+        WriteTrace(event, arg0, arg1);
+    }
+}
+
+// DumpTrace writes the rings to `sink` and returns the number of records.
+// Tracing is paused while dumping.
+size_t DumpTrace(TraceSink sink);
+void ClearTrace();
+// TraceRecords returns the number of records kept now
+size_t TraceRecords();
@@ -74,29 +74,29 @@ namespace {
   }
 
   void Log(LogLevel level, const usb::InterfaceDescriptor& if_desc) {
-    Log(level, "Interface Descriptor: class=%d, sub=%d, protocol=%d\n",
+    Log(kLogUSB, level, "Interface Descriptor: class=%d, sub=%d, protocol=%d\n",
         if_desc.interface_class,
         if_desc.interface_sub_class,
         if_desc.interface_protocol);
   }
 
   void Log(LogLevel level, const usb::EndpointConfig& conf) {
-    Log(level, "EndpointConf: ep_id=%d, ep_type=%d"
+    Log(kLogUSB, level, "EndpointConf: ep_id=%d, ep_type=%d"
         ", max_packet_size=%d, interval=%d\n",
         conf.ep_id.Address(), conf.ep_type,
         conf.max_packet_size, conf.interval);
   }
 
   void Log(LogLevel level, const usb::HIDDescriptor& hid_desc) {
-    Log(level, "HID Descriptor: release=0x%02x, num_desc=%d",
+    Log(kLogUSB, level, "HID Descriptor: release=0x%02x, num_desc=%d",
         hid_desc.hid_release,
         hid_desc.num_descriptors);
     for (int i = 0; i < hid_desc.num_descriptors; ++i) {
-      Log(level, ", desc_type=%d, len=%d",
+      Log(kLogUSB, level, ", desc_type=%d, len=%d",
           hid_desc.GetClassDescriptor(i)->descriptor_type,
           hid_desc.GetClassDescriptor(i)->descriptor_length);
     }
-    Log(level, "\n");
+    Log(kLogUSB, level, "\n");
   }
 }
 
@@ -148,7 +148,7 @@ namespace usb {
 
   Error Device::OnControlCompleted(EndpointID ep_id, SetupData setup_data,
                                    const void* buf, int len) {
-    Log(kDebug, "Device::OnControlCompleted: buf 0x%08x, len %d, dir %d\n",
+    Log(kLogUSB, kDebug, "Device::OnControlCompleted: buf 0x%08x, len %d, dir %d\n",
         buf, len, setup_data.request_type.bits.direction);
     if (is_initialized_) {
       if (auto w = event_waiters_.Get(setup_data)) {
@@ -181,7 +181,7 @@ namespace usb {
   }
 
   Error Device::OnInterruptCompleted(EndpointID ep_id, const void* buf, int len) {
-    Log(kDebug, "Device::OnInterruptCompleted: ep addr %d\n", ep_id.Address());
+    Log(kLogUSB, kDebug, "Device::OnInterruptCompleted: ep addr %d\n", ep_id.Address());
     if (auto w = class_drivers_[ep_id.Number()]) {
       return w->OnInterruptCompleted(ep_id, buf, len);
     }
@@ -193,7 +193,7 @@ namespace usb {
     num_configurations_ = device_desc->num_configurations;
     config_index_ = 0;
     initialize_phase_ = 2;
-    Log(kDebug, "issuing GetDesc(Config): index=%d)\n", config_index_);
+    Log(kLogUSB, kDebug, "issuing GetDesc(Config): index=%d)\n", config_index_);
     return GetDescriptor(*this, kDefaultControlPipeID,
                          ConfigurationDescriptor::kType, config_index_,
                          buf_.data(), buf_.size(), true);
@@ -239,7 +239,7 @@ namespace usb {
       return MAKE_ERROR(Error::kSuccess);
     }
     initialize_phase_ = 3;
-    Log(kDebug, "issuing SetConfiguration: conf_val=%d\n",
+    Log(kLogUSB, kDebug, "issuing SetConfiguration: conf_val=%d\n",
         conf_desc->configuration_value);
     return SetConfiguration(*this, kDefaultControlPipeID,
                             conf_desc->configuration_value, true);
@@ -40,4 +40,8 @@ namespace usb {
   }
 
   void FreeMem(void* p) {}
+
+  size_t UsedMemoryBytes() {
+    return alloc_ptr - reinterpret_cast<uintptr_t>(memory_pool);
+  }
 }
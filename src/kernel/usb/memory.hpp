@@ -34,6 +34,9 @@ namespace usb {
   /** @brief 指定されたメモリ領域を解放する．本当に解放することは保証されない． */
   void FreeMem(void* p);
 
+  /** @brief メモリプールのうち確保済み（アライメントの隙間を含む）のバイト数 */
+  size_t UsedMemoryBytes();
+
   /** @brief 標準コンテナ用のメモリアロケータ */
   template <class T, unsigned int Alignment = 64, unsigned int Boundary = 4096>
   class Allocator {
@@ -28,7 +28,7 @@ namespace {
   }
 
   void Log(LogLevel level, const DataStageTRB& trb) {
-    Log(level,
+    Log(kLogUSB, level,
         "DataStageTRB: len %d, buf 0x%08lx, dir %d, attr 0x%02x\n",
         trb.bits.trb_transfer_length,
         trb.bits.data_buffer_pointer,
@@ -37,7 +37,7 @@ namespace {
   }
 
   void Log(LogLevel level, const SetupStageTRB& trb) {
-    Log(level,
+    Log(kLogUSB, level,
         "  SetupStage TRB: req_type %02x, req %02x, val %02x, ind %02x, len %02x\n",
         trb.bits.request_type,
         trb.bits.request,
@@ -48,7 +48,7 @@ namespace {
 
   void Log(LogLevel level, const TransferEventTRB& trb) {
     if (trb.bits.event_data) {
-      Log(level,
+      Log(kLogUSB, level,
           "Transfer (value %08lx) completed: %s, residual length %d, slot %d, ep addr %d\n",
           reinterpret_cast<uint64_t>(trb.Pointer()),
           kTRBCompletionCodeToName[trb.bits.completion_code],
@@ -59,7 +59,7 @@ namespace {
     }
 
     TRB* issuer_trb = trb.Pointer();
-    Log(level,
+    Log(kLogUSB, level,
         "%s completed: %s, residual length %d, slot %d, ep addr %d\n",
         kTRBTypeToName[issuer_trb->bits.trb_type],
         kTRBCompletionCodeToName[trb.bits.completion_code],
@@ -67,10 +67,10 @@ namespace {
         trb.bits.slot_id,
         trb.EndpointID().Address());
     if (auto data_trb = TRBDynamicCast<DataStageTRB>(issuer_trb)) {
-      Log(level, "  ");
+      Log(kLogUSB, level, "  ");
       Log(level, *data_trb);
     } else if (auto setup_trb = TRBDynamicCast<SetupStageTRB>(issuer_trb)) {
-      Log(level, "  ");
+      Log(kLogUSB, level, "  ");
       Log(level, *setup_trb);
     }
   }
@@ -110,7 +110,7 @@ namespace usb::xhci {
       return err;
     }
 
-    Log(kDebug, "Device::ControlIn: ep addr %d, buf 0x%08x, len %d\n",
+    Log(kLogUSB, kDebug, "Device::ControlIn: ep addr %d, buf 0x%08x, len %d\n",
         ep_id.Address(), buf, len);
     if (ep_id.Number() < 0 || 15 < ep_id.Number()) {
       return MAKE_ERROR(Error::kInvalidEndpointNumber);
@@ -157,7 +157,7 @@ namespace usb::xhci {
       return err;
     }
 
-    Log(kDebug, "Device::ControlOut: ep addr %d, buf 0x%08x, len %d\n",
+    Log(kLogUSB, kDebug, "Device::ControlOut: ep addr %d, buf 0x%08x, len %d\n",
         ep_id.Address(), buf, len);
     if (ep_id.Number() < 0 || 15 < ep_id.Number()) {
       return MAKE_ERROR(Error::kInvalidEndpointNumber);
@@ -216,6 +216,7 @@ namespace usb::xhci {
     normal.bits.trb_transfer_length = len;
     normal.bits.interrupt_on_short_packet = true;
     normal.bits.interrupt_on_completion = true;
+    normal.bits.interrupter_target = interrupt_in_target_;
 
     tr->Push(normal);
     dbreg_->Ring(dci.value);
@@ -227,7 +228,7 @@ namespace usb::xhci {
       return err;
     }
 
-    Log(kDebug, "Device::InterrutpOut: ep addr %d, buf %08lx, len %d, dev %08lx\n",
+    Log(kLogUSB, kDebug, "Device::InterrutpOut: ep addr %d, buf %08lx, len %d, dev %08lx\n",
         ep_id.Address(), buf, len, this);
     return MAKE_ERROR(Error::kNotImplemented);
   }
@@ -252,7 +253,7 @@ namespace usb::xhci {
 
     auto opt_setup_stage_trb = setup_stage_map_.Get(issuer_trb);
     if (!opt_setup_stage_trb) {
-      Log(kDebug, "No Corresponding Setup Stage for issuer %s\n",
+      Log(kLogUSB, kDebug, "No Corresponding Setup Stage for issuer %s\n",
           kTRBTypeToName[issuer_trb->bits.trb_type]);
       if (auto data_trb = TRBDynamicCast<DataStageTRB>(issuer_trb)) {
         Log(kDebug, *data_trb);
@@ -57,6 +57,9 @@ namespace usb::xhci {
 
     Error OnTransferEventReceived(const TransferEventTRB& trb);
 
+    /** 割り込み IN 転送の完了イベントを送るインタラプタを設定する． */
+    void SetInterruptInTarget(uint16_t interrupter) { interrupt_in_target_ = interrupter; }
+
    private:
     alignas(64) struct DeviceContext ctx_;
     alignas(64) struct InputContext input_ctx_;
@@ -65,6 +68,7 @@ namespace usb::xhci {
     DoorbellRegister* const dbreg_;
 
     enum State state_;
+    uint16_t interrupt_in_target_{0};
     std::array<Ring*, 31> transfer_rings_; // index = dci - 1
 
     /** コントロール転送が完了した際に DataStageTRB や StatusStageTRB
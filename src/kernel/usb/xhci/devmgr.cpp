@@ -78,6 +78,7 @@ namespace usb::xhci {
 
     devices_[slot_id] = AllocArray<Device>(1, 64, 4096);
     new(devices_[slot_id]) Device(slot_id, dbreg);
+    devices_[slot_id]->SetInterruptInTarget(input_interrupter_);
     return MAKE_ERROR(Error::kSuccess);
   }
 
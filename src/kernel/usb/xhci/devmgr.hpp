@@ -26,6 +26,8 @@ namespace usb::xhci {
     Error AllocDevice(uint8_t slot_id, DoorbellRegister* dbreg);
     Error LoadDCBAA(uint8_t slot_id);
     Error Remove(uint8_t slot_id);
+    /** 以降に割り当てるデバイスの割り込み IN 転送のイベントを送るインタラプタを設定する． */
+    void SetInputInterrupter(uint16_t interrupter) { input_interrupter_ = interrupter; }
 
    private:
     // device_context_pointers_ can be used as DCBAAP's value.
@@ -35,5 +37,7 @@ namespace usb::xhci {
 
     // The number of elements is max_slots_ + 1.
     Device** devices_;
+
+    uint16_t input_interrupter_{0};
   };
 }
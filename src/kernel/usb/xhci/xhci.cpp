@@ -5,6 +5,7 @@
 #include "logger.hpp"
 #include "pci.hpp"
 #include "interrupt.hpp"
+#include "trace.hpp"
 #include "usb/setupdata.hpp"
 #include "usb/device.hpp"
 #include "usb/descriptor.hpp"
@@ -91,7 +92,7 @@ namespace {
 
   Error ResetPort(Controller& xhc, Port& port) {
     const bool is_connected = port.IsConnected();
-    Log(kDebug, "ResetPort: port.IsConnected() = %s\n",
+    Log(kLogUSB, kDebug, "ResetPort: port.IsConnected() = %s\n",
         is_connected ? "true" : "false");
 
     if (!is_connected) {
@@ -116,7 +117,7 @@ namespace {
   Error EnableSlot(Controller& xhc, Port& port) {
     const bool is_enabled = port.IsEnabled();
     const bool reset_completed = port.IsPortResetChanged();
-    Log(kDebug, "EnableSlot: port.IsEnabled() = %s, port.IsPortResetChanged() = %s\n",
+    Log(kLogUSB, kDebug, "EnableSlot: port.IsEnabled() = %s, port.IsPortResetChanged() = %s\n",
         is_enabled ? "true" : "false",
         reset_completed ? "true" : "false");
 
@@ -133,7 +134,7 @@ namespace {
   }
 
   Error AddressDevice(Controller& xhc, uint8_t port_id, uint8_t slot_id) {
-    Log(kDebug, "AddressDevice: port_id = %d, slot_id = %d\n", port_id, slot_id);
+    Log(kLogUSB, kDebug, "AddressDevice: port_id = %d, slot_id = %d\n", port_id, slot_id);
 
     xhc.DeviceManager()->AllocDevice(slot_id, xhc.DoorbellRegisterAt(slot_id));
 
@@ -168,7 +169,7 @@ namespace {
   }
 
   Error InitializeDevice(Controller& xhc, uint8_t port_id, uint8_t slot_id) {
-    Log(kDebug, "InitializeDevice: port_id = %d, slot_id = %d\n", port_id, slot_id);
+    Log(kLogUSB, kDebug, "InitializeDevice: port_id = %d, slot_id = %d\n", port_id, slot_id);
 
     auto dev = xhc.DeviceManager()->FindBySlot(slot_id);
     if (dev == nullptr) {
@@ -182,7 +183,7 @@ namespace {
   }
 
   Error CompleteConfiguration(Controller& xhc, uint8_t port_id, uint8_t slot_id) {
-    Log(kDebug, "CompleteConfiguration: port_id = %d, slot_id = %d\n", port_id, slot_id);
+    Log(kLogUSB, kDebug, "CompleteConfiguration: port_id = %d, slot_id = %d\n", port_id, slot_id);
 
     auto dev = xhc.DeviceManager()->FindBySlot(slot_id);
     if (dev == nullptr) {
@@ -196,7 +197,7 @@ namespace {
   }
 
   Error OnEvent(Controller& xhc, PortStatusChangeEventTRB& trb) {
-    Log(kDebug, "PortStatusChangeEvent: port_id = %d\n", trb.bits.port_id);
+    Log(kLogUSB, kDebug, "PortStatusChangeEvent: port_id = %d\n", trb.bits.port_id);
     auto port_id = trb.bits.port_id;
     auto port = xhc.PortAt(port_id);
 
@@ -231,7 +232,7 @@ namespace {
   Error OnEvent(Controller& xhc, CommandCompletionEventTRB& trb) {
     const auto issuer_type = trb.Pointer()->bits.trb_type;
     const auto slot_id = trb.bits.slot_id;
-    Log(kDebug, "CommandCompletionEvent: slot_id = %d, issuer = %s\n",
+    Log(kLogUSB, kDebug, "CommandCompletionEvent: slot_id = %d, issuer = %s\n",
         trb.bits.slot_id, kTRBTypeToName[issuer_type]);
 
     if (issuer_type == EnableSlotCommandTRB::Type) {
@@ -303,14 +304,14 @@ namespace {
     }
 
     r.bits.hc_os_owned_semaphore = 1;
-    Log(kDebug, "waiting until OS owns xHC...\n");
+    Log(kLogUSB, kDebug, "waiting until OS owns xHC...\n");
     reg.Write(r);
 
     do {
       r = reg.Read();
     } while (r.bits.hc_bios_owned_semaphore ||
              !r.bits.hc_os_owned_semaphore);
-    Log(kDebug, "OS has owned xHC\n");
+    Log(kLogUSB, kDebug, "OS has owned xHC\n");
   }
 
 
@@ -333,7 +334,7 @@ namespace {
     uint32_t ehci2xhci_ports = pci::ReadConfReg(xhc_dev, 0xd4u); // XUSB2PRM
     pci::WriteConfigReg(xhc_dev, 0xd0u, ehci2xhci_ports); //XUSB2PR
 
-    Log(kDebug, "SwitchEhci2Xhci: SS=%02x, xHCI=%02x\n", superspeed_ports, ehci2xhci_ports);
+    Log(kLogUSB, kDebug, "SwitchEhci2Xhci: SS=%02x, xHCI=%02x\n", superspeed_ports, ehci2xhci_ports);
   }
 }
 
@@ -348,7 +349,7 @@ namespace usb::xhci {
             cap_->HCSPARAMS1.Read().bits.max_ports)} {
   }
 
-  Error Controller::Initialize() {
+  Error Controller::Initialize(int num_interrupters) {
     if (auto err = devmgr_.Initialize(kDeviceSize)) {
       return err;
     }
@@ -374,7 +375,7 @@ namespace usb::xhci {
     while (op_->USBCMD.Read().bits.host_controller_reset);
     while (op_->USBSTS.Read().bits.controller_not_ready);
 
-    Log(kDebug, "MaxSlots: %u\n", cap_->HCSPARAMS1.Read().bits.max_device_slots);
+    Log(kLogUSB, kDebug, "MaxSlots: %u\n", cap_->HCSPARAMS1.Read().bits.max_device_slots);
     // Set "Max Slots Enabled" field in CONFIG.
     auto config = op_->CONFIG.Read();
     config.bits.max_device_slots_enabled = kDeviceSize;
@@ -388,11 +389,11 @@ namespace usb::xhci {
       auto scratchpad_buf_arr = AllocArray<void*>(max_scratchpad_buffers, 64, 4096);
       for (int i = 0; i < max_scratchpad_buffers; ++i) {
         scratchpad_buf_arr[i] = AllocMem(4096, 4096, 4096);
-        Log(kDebug, "scratchpad buffer array %d = %p\n",
+        Log(kLogUSB, kDebug, "scratchpad buffer array %d = %p\n",
             i, scratchpad_buf_arr[i]);
       }
       devmgr_.DeviceContexts()[0] = reinterpret_cast<DeviceContext*>(scratchpad_buf_arr);
-      Log(kInfo, "wrote scratchpad buffer array %p to dev ctx array 0\n",
+      Log(kLogUSB, kInfo, "wrote scratchpad buffer array %p to dev ctx array 0\n",
           scratchpad_buf_arr);
     }
 
@@ -400,21 +401,25 @@ namespace usb::xhci {
     dcbaap.SetPointer(reinterpret_cast<uint64_t>(devmgr_.DeviceContexts()));
     op_->DCBAAP.Write(dcbaap);
 
-    auto primary_interrupter = &InterrupterRegisterSets()[0];
     if (auto err = cr_.Initialize(32)) {
         return err;
     }
     if (auto err = RegisterCommandRing(&cr_, &op_->CRCR)) {
         return err; }
-    if (auto err = er_.Initialize(32, primary_interrupter)) {
-        return err;
-    }
 
-    // Enable interrupt for the primary interrupter
-    auto iman = primary_interrupter->IMAN.Read();
-    iman.bits.interrupt_pending = true;
-    iman.bits.interrupt_enable = true;
-    primary_interrupter->IMAN.Write(iman);
+    num_interrupters_ = std::min({num_interrupters, kMaxInterrupters, MaxInterrupters()});
+    for (int i = 0; i < num_interrupters_; ++i) {
+      auto interrupter = &InterrupterRegisterSets()[i];
+      if (auto err = er_[i].Initialize(32, interrupter)) {
+          return err;
+      }
+
+      // Enable interrupt for the interrupter
+      auto iman = interrupter->IMAN.Read();
+      iman.bits.interrupt_pending = true;
+      iman.bits.interrupt_enable = true;
+      interrupter->IMAN.Write(iman);
+    }
 
     // Enable interrupt for the controller
     usbcmd = op_->USBCMD.Read();
@@ -513,12 +518,17 @@ namespace usb::xhci {
   }
 
   Error ProcessEvent(Controller& xhc) {
-    if (!xhc.PrimaryEventRing()->HasFront()) {
+    return ProcessEvent(xhc, *xhc.PrimaryEventRing());
+  }
+
+  Error ProcessEvent(Controller& xhc, EventRing& er) {
+    if (!er.HasFront()) {
       return MAKE_ERROR(Error::kSuccess);
     }
 
     Error err = MAKE_ERROR(Error::kNotImplemented);
-    auto event_trb = xhc.PrimaryEventRing()->Front();
+    auto event_trb = er.Front();
+    Trace(TraceEvent::kXHCIEvent, event_trb->bits.trb_type, &er - xhc.PrimaryEventRing());
     if (auto trb = TRBDynamicCast<TransferEventTRB>(event_trb)) {
       err = OnEvent(xhc, *trb);
     } else if (auto trb = TRBDynamicCast<PortStatusChangeEventTRB>(event_trb)) {
@@ -526,7 +536,7 @@ namespace usb::xhci {
     } else if (auto trb = TRBDynamicCast<CommandCompletionEventTRB>(event_trb)) {
       err = OnEvent(xhc, *trb);
     }
-    xhc.PrimaryEventRing()->Pop();
+    er.Pop();
 
     return err;
   }
@@ -551,49 +561,82 @@ namespace usb::xhci {
     }
 
     if (xhc_dev) {
-        Log(kInfo, "found xHC: %d.%d.%d\n", xhc_dev->bus, xhc_dev->device, xhc_dev->function);
+        Log(kLogUSB, kInfo, "found xHC: %d.%d.%d\n", xhc_dev->bus, xhc_dev->device, xhc_dev->function);
     } else {
-      Log(kError, "xHC is missing\n");
+      Log(kLogUSB, kError, "xHC is missing\n");
       exit(1);
     }
 
-    const uint8_t bsp_local_apic_id = *reinterpret_cast<const uint32_t*>(0xfee00020) >> 24;
-    pci::ConfigureMSIFixedDestination(
-      *xhc_dev,
-      bsp_local_apic_id,
-      pci::MSITriggerMode::kLevel,
-      pci::MSIDeliveryMode::kFixed,
-      InterruptVector::kXHCI,
-      0
-    );
-
     const WithError<uint64_t> xhc_bar = pci::ReadBar(*xhc_dev, 0);
-    Log(kDebug, "ReadBar: %s\n", xhc_bar.error.Name());
+    Log(kLogUSB, kDebug, "ReadBar: %s\n", xhc_bar.error.Name());
     const uint64_t xhc_mmio_base = xhc_bar.value & ~static_cast<uint64_t>(0xf);
-    Log(kDebug, "xHC mmio_base: %08lx\n", xhc_mmio_base);
+    Log(kLogUSB, kDebug, "xHC mmio_base: %08lx\n", xhc_mmio_base);
 
     usb::xhci::controller = new Controller{xhc_mmio_base};
     Controller &xhc = *usb::xhci::controller;
 
+    // インタラプタごとに MSI-X のベクタと割り込み先 CPU を割り当てる．
+    // AP は起動していないので，割り込み先は今のところすべて BSP．
+    const uint8_t bsp_local_apic_id = *reinterpret_cast<const uint32_t*>(0xfee00020) >> 24;
+    const std::array<uint8_t, Controller::kMaxInterrupters> interrupter_vectors{
+      InterruptVector::kXHCI, InterruptVector::kXHCIInput
+    };
+    const std::array<uint8_t, Controller::kMaxInterrupters> interrupter_apic_ids{
+      bsp_local_apic_id, bsp_local_apic_id
+    };
+
+    int num_interrupters = 1;
+    if (pci::MSIXTableSize(*xhc_dev) >= Controller::kMaxInterrupters &&
+        xhc.MaxInterrupters() >= Controller::kMaxInterrupters) {
+      num_interrupters = Controller::kMaxInterrupters;
+      for (int i = 0; i < num_interrupters; ++i) {
+        if (auto err = pci::ConfigureMSIXFixedDestination(
+              *xhc_dev, i, interrupter_apic_ids[i],
+              pci::MSITriggerMode::kEdge, pci::MSIDeliveryMode::kFixed,
+              interrupter_vectors[i])) {
+          Log(kLogUSB, kError, "failed to configure MSI-X entry %d: %s\n", i, err.Name());
+          // MSI と同時に有効にしてはいけない
+          pci::DisableMSIX(*xhc_dev);
+          num_interrupters = 1;
+          break;
+        }
+      }
+    }
+    if (num_interrupters == 1) {
+      // MSI-X が使えなければ，単一ベクタの MSI ですべてプライマリに集める
+      pci::ConfigureMSIFixedDestination(
+        *xhc_dev,
+        bsp_local_apic_id,
+        pci::MSITriggerMode::kLevel,
+        pci::MSIDeliveryMode::kFixed,
+        InterruptVector::kXHCI,
+        0
+      );
+    }
+    Log(kLogUSB, kInfo, "xHC interrupters: %d\n", num_interrupters);
+
     // workaround for Intel Panther Point
     if (pci::ReadVendorID(*xhc_dev) == 0x8086u) {
         switchEhci2Xhci(*xhc_dev);
     }
 
-    if (auto err = xhc.Initialize()) {
-        Log(kDebug, "xhc.Initialize: %s\n", err.Name());
+    if (auto err = xhc.Initialize(num_interrupters)) {
+        Log(kLogUSB, kDebug, "xhc.Initialize: %s\n", err.Name());
     }
+    // HID の割り込み転送のイベントは専用のインタラプタに分ける
+    xhc.DeviceManager()->SetInputInterrupter(
+        xhc.Interrupters() > Controller::kInputInterrupter ? Controller::kInputInterrupter : 0);
 
-    Log(kInfo, "Starting xHC\n");
+    Log(kLogUSB, kInfo, "Starting xHC\n");
     xhc.Run();
 
     for (int i = 1; i <= xhc.MaxPorts(); ++i) {
       auto port = xhc.PortAt(i);
-      Log(kDebug, "Port %d: IsConnected=%d\n", i, port.IsConnected());
+      Log(kLogUSB, kDebug, "Port %d: IsConnected=%d\n", i, port.IsConnected());
 
       if (port.IsConnected()) {
         if (auto err = ConfigurePort(xhc, port)) {
-            Log(kError, "Failed to configure port (%s) at %s:%d\n", err.Name(), err.File(), err.Line());
+            Log(kLogUSB, kError, "Failed to configure port (%s) at %s:%d\n", err.Name(), err.File(), err.Line());
             continue;
         }
       }
@@ -603,7 +646,20 @@ namespace usb::xhci {
   void ProcessEvents() {
     while (controller->PrimaryEventRing()->HasFront()) {
       if (auto err = ProcessEvent(*controller)) {
-          Log(kError, "Error while ProcessEvent (%s) at %s:%d\n",
+          Log(kLogUSB, kError, "Error while ProcessEvent (%s) at %s:%d\n",
+              err.Name(), err.File(), err.Line());
+      }
+    }
+  }
+
+  void ProcessInputEvents() {
+    if (controller->Interrupters() <= Controller::kInputInterrupter) {
+      return;
+    }
+    auto er = controller->EventRingAt(Controller::kInputInterrupter);
+    while (er->HasFront()) {
+      if (auto err = ProcessEvent(*controller, *er)) {
+          Log(kLogUSB, kError, "Error while ProcessEvent (%s) at %s:%d\n",
               err.Name(), err.File(), err.Line());
       }
     }
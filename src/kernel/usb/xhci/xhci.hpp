@@ -6,6 +6,7 @@
 
 #pragma once
 
+#include <array>
 #include <cstring>
 
 #include "error.hpp"
@@ -18,11 +19,22 @@
 namespace usb::xhci {
   class Controller {
    public:
+    /** 使うインタラプタの最大数．0 番はプライマリ，1 番は HID の割り込み転送用． */
+    static constexpr int kMaxInterrupters = 2;
+    static constexpr int kInputInterrupter = 1;
+
     Controller(uintptr_t mmio_base);
-    Error Initialize();
+    /** @param num_interrupters 有効にするインタラプタの数．それぞれにイベントリングを作る． */
+    Error Initialize(int num_interrupters = 1);
     Error Run();
     Ring* CommandRing() { return &cr_; }
-    EventRing* PrimaryEventRing() { return &er_; }
+    EventRing* PrimaryEventRing() { return &er_[0]; }
+    EventRing* EventRingAt(int interrupter) { return &er_[interrupter]; }
+    int Interrupters() const { return num_interrupters_; }
+    /** ホストコントローラが持つインタラプタの数 */
+    int MaxInterrupters() const {
+      return cap_->HCSPARAMS1.Read().bits.max_interrupters;
+    }
     DoorbellRegister* DoorbellRegisterAt(uint8_t index);
     Port PortAt(uint8_t port_num) {
       return Port{port_num, PortRegisterSets()[port_num - 1]};
@@ -40,7 +52,8 @@ namespace usb::xhci {
 
     class DeviceManager devmgr_;
     Ring cr_;
-    EventRing er_;
+    std::array<EventRing, kMaxInterrupters> er_;
+    int num_interrupters_{1};
 
     InterrupterRegisterSetArray InterrupterRegisterSets() const {
       return {mmio_base_ + cap_->RTSOFF.Read().Offset() + 0x20u, 1024};
@@ -67,8 +80,18 @@ namespace usb::xhci {
    */
   Error ProcessEvent(Controller& xhc);
 
+  /** @brief 指定したイベントリングのイベントを高々1つ処理する．
+   *
+   * コマンド完了とポート状態変化はプライマリにしか来ないが，
+   * 転送イベントは転送 TRB の Interrupter Target で指定したリングに来る．
+   */
+  Error ProcessEvent(Controller& xhc, EventRing& er);
+
   extern Controller *controller;
   
   void Initialize();
+  /** プライマリイベントリングのイベントをすべて処理する． */
   void ProcessEvents();
+  /** HID 入力用イベントリングのイベントをすべて処理する． */
+  void ProcessInputEvents();
 }
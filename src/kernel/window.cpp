@@ -138,6 +138,11 @@ Vector2D<int> Window::Size() const {
     return {width_, height_};
 }
 
+size_t Window::MemoryBytes() const {
+    return static_cast<size_t>(width_) * height_ * sizeof(PixelColor) +
+        shadow_buffer_.BufferBytes();
+}
+
 
 ToplevelWindow::ToplevelWindow(int width, int height, PixelFormat shadow_format, const std::string &title)
     : Window{width, height, shadow_format}, title_{title} {
@@ -59,6 +59,8 @@ public:
     int Width() const;
     int Height() const;
     Vector2D<int> Size() const;
+    // MemoryBytes returns bytes of pixel data and shadow buffer
+    size_t MemoryBytes() const;
 
     virtual void Activate() {};
     virtual void Deactivate() {};
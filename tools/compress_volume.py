@@ -0,0 +1,182 @@
+#!/usr/bin/python3
+
+# Make a compressed volume (src/Include/compressed_volume.hpp) from a raw
+# disk image. Put it on the boot volume as `fat_disk`; the loader passes it
+# to the kernel, which expands the blocks on demand.
+
+import argparse
+import struct
+import sys
+
+try:
+    import lz4.block
+except ImportError:
+    lz4 = None
+
+
+MAGIC = b'MIKANLZ4'
+VERSION = 1
+HEADER = struct.Struct('<8sIIQQII')
+SECTOR_BYTES = 512
+
+MIN_MATCH = 4
+MAX_OFFSET = 65535
+LAST_LITERALS = 5  # the last 5 bytes are always literals
+MATCH_LIMIT = 12  # the last match starts 12 bytes before the end at the latest
+
+
+def put_length(out: bytearray, length: int):
+    length -= 15
+    while length >= 255:
+        out.append(255)
+        length -= 255
+    out.append(length)
+
+
+def put_sequence(out: bytearray, literals: bytes, offset: int, match: int):
+    lit_len = len(literals)
+    token = min(lit_len, 15) << 4
+    if match:
+        token |= min(match - MIN_MATCH, 15)
+    out.append(token)
+    if lit_len >= 15:
+        put_length(out, lit_len)
+    out += literals
+    if match:
+        out += struct.pack('<H', offset)
+        if match - MIN_MATCH >= 15:
+            put_length(out, match - MIN_MATCH)
+
+
+def compress_block(data: bytes) -> bytes:
+    """Compress in the LZ4 block format, with a greedy matcher."""
+    if lz4:
+        return lz4.block.compress(data, store_size=False)
+
+    out = bytearray()
+    table = {}
+    n = len(data)
+    anchor = 0
+    i = 0
+    while i < n - MATCH_LIMIT:
+        key = data[i:i + MIN_MATCH]
+        candidate = table.get(key)
+        table[key] = i
+        if candidate is None or i - candidate > MAX_OFFSET:
+            i += 1
+            continue
+
+        match = MIN_MATCH
+        max_match = n - LAST_LITERALS - i
+        while match < max_match and data[candidate + match] == data[i + match]:
+            match += 1
+        put_sequence(out, data[anchor:i], i - candidate, match)
+        i += match
+        anchor = i
+
+    put_sequence(out, data[anchor:], 0, 0)
+    return bytes(out)
+
+
+def decompress_block(src: bytes, size: int) -> bytes:
+    out = bytearray()
+    p = 0
+
+    def get_length(length):
+        nonlocal p
+        if length == 15:
+            while True:
+                b = src[p]
+                p += 1
+                length += b
+                if b != 255:
+                    break
+        return length
+
+    while p < len(src):
+        token = src[p]
+        p += 1
+        literals = get_length(token >> 4)
+        out += src[p:p + literals]
+        p += literals
+        if p == len(src):
+            break
+        offset = src[p] | (src[p + 1] << 8)
+        p += 2
+        match = get_length(token & 0x0f) + MIN_MATCH
+        for _ in range(match):
+            out.append(out[-offset])
+    if len(out) != size:
+        raise ValueError('block expands to {} bytes'.format(len(out)))
+    return bytes(out)
+
+
+def compress(image: bytes, block_bytes: int) -> bytes:
+    image_bytes = len(image) - len(image) % SECTOR_BYTES
+    block_count = (image_bytes + block_bytes - 1) // block_bytes
+    zero_block = bytes(block_bytes)
+
+    blocks = []
+    for i in range(block_count):
+        block = image[i * block_bytes:(i + 1) * block_bytes]
+        block += bytes(block_bytes - len(block))
+        if block == zero_block:
+            blocks.append(b'')
+            continue
+        compressed = compress_block(block)
+        blocks.append(compressed if len(compressed) < block_bytes else block)
+
+    offsets = [HEADER.size + 8 * (block_count + 1)]
+    for block in blocks:
+        offsets.append(offsets[-1] + len(block))
+
+    header = HEADER.pack(MAGIC, VERSION, block_bytes, image_bytes, offsets[-1], block_count, 0)
+    return b''.join([header, struct.pack('<{}Q'.format(len(offsets)), *offsets)] + blocks)
+
+
+def expand(container: bytes) -> bytes:
+    magic, version, block_bytes, image_bytes, _, block_count, _ = HEADER.unpack_from(container)
+    if magic != MAGIC or version != VERSION:
+        raise ValueError('not a compressed volume')
+    offsets = struct.unpack_from('<{}Q'.format(block_count + 1), container, HEADER.size)
+
+    out = []
+    for i in range(block_count):
+        data = container[offsets[i]:offsets[i + 1]]
+        if not data:
+            out.append(bytes(block_bytes))
+        elif len(data) == block_bytes:
+            out.append(data)
+        else:
+            out.append(decompress_block(data, block_bytes))
+    return b''.join(out)[:image_bytes]
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('image', help='path to a raw disk image')
+    parser.add_argument('-o', help='path to an output file', default='fat_disk')
+    parser.add_argument('-b', type=int, help='block size in bytes', default=4096)
+    parser.add_argument('--check', action='store_true',
+                        help='expand the output again and compare it with the image')
+    ns = parser.parse_args()
+
+    if ns.b <= 0 or ns.b % SECTOR_BYTES != 0:
+        sys.exit('block size must be a multiple of {}'.format(SECTOR_BYTES))
+
+    with open(ns.image, 'rb') as f:
+        image = f.read()
+    container = compress(image, ns.b)
+    with open(ns.o, 'wb') as out:
+        out.write(container)
+
+    print('{}: {} -> {} bytes'.format(ns.o, len(image), len(container)))
+    if ns.check:
+        image_bytes = len(image) - len(image) % SECTOR_BYTES
+        if expand(container) != image[:image_bytes]:
+            sys.exit('check failed')
+        print('check ok')
+
+
+if __name__ == '__main__':
+    main()
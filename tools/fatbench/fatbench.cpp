@@ -0,0 +1,301 @@
+// fatbench measures the kernel FAT layer (src/kernel/fat.cpp) on the host.
+// It builds a synthetic FAT32 image, then times mount, path lookup,
+// directory listing and reads, both on a resident RAM disk (today's boot
+// volume) and on a device read through the block cache. The data read is
+// checked against the pattern the image was built with.
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "fat.hpp"
+#include "image_builder.hpp"
+
+namespace {
+    struct Options {
+        size_t image_mib = 64;
+        int sectors_per_cluster = 8;
+        size_t files = 2000;
+        int depth = 3;
+        int fanout = 4;
+        double fragment = 0.0;
+        size_t max_file_kib = 48;
+        size_t random_reads = 20000;
+        int repeat = 5;
+        unsigned int seed = 1;
+    };
+
+    struct FileInfo {
+        std::string path;
+        size_t size;
+    };
+
+    struct Volume {
+        std::vector<FileInfo> files;
+        std::vector<uint32_t> dirs; // clusters, root is 0
+    };
+
+    // MemoryDisk is a non-resident device, so reads go through the block cache
+    class MemoryDisk : public block::Device {
+    public:
+        explicit MemoryDisk(std::vector<uint8_t> &image) : image_{image} {}
+
+        Error Read(uint64_t lba, void *buf, size_t sectors) override {
+            memcpy(buf, &image_[lba * block::kSectorBytes], sectors * block::kSectorBytes);
+            return MAKE_ERROR(Error::kSuccess);
+        }
+        Error Write(uint64_t lba, const void *buf, size_t sectors) override {
+            memcpy(&image_[lba * block::kSectorBytes], buf, sectors * block::kSectorBytes);
+            return MAKE_ERROR(Error::kSuccess);
+        }
+        uint64_t Sectors() const override { return image_.size() / block::kSectorBytes; }
+
+    private:
+        std::vector<uint8_t> &image_;
+    };
+
+    uint64_t checksum; // keeps reads from being optimized away
+
+    double seconds(const std::function<void ()> &f) {
+        const auto begin = std::chrono::steady_clock::now();
+        f();
+        const auto end = std::chrono::steady_clock::now();
+        return std::chrono::duration<double>(end - begin).count();
+    }
+
+    void makeTree(ImageBuilder &builder, Volume &volume, uint32_t cluster,
+                  const std::string &path, int depth, const Options &opts) {
+        volume.dirs.push_back(cluster == builder.RootCluster() ? 0 : cluster);
+        if (depth == 0) {
+            return;
+        }
+        for (int i = 0; i < opts.fanout; ++i) {
+            const std::string name = "directory " + std::to_string(i);
+            if (auto c = builder.MakeDirectory(cluster, name)) {
+                makeTree(builder, volume, c, path + name + "/", depth - 1, opts);
+            }
+        }
+    }
+
+    Volume build(ImageBuilder &builder, const Options &opts) {
+        Volume volume;
+        makeTree(builder, volume, builder.RootCluster(), "", opts.depth, opts);
+
+        // paths of the directories, in the order of volume.dirs
+        std::vector<std::string> dir_paths{""};
+        std::function<void (const std::string &, int)> collect = [&](const std::string &path, int depth) {
+            if (depth == 0) {
+                return;
+            }
+            for (int i = 0; i < opts.fanout; ++i) {
+                const auto p = path + "directory " + std::to_string(i) + "/";
+                dir_paths.push_back(p);
+                collect(p, depth - 1);
+            }
+        };
+        collect("", opts.depth);
+
+        std::mt19937 rng{opts.seed};
+        std::uniform_int_distribution<size_t> size_dist{0, opts.max_file_kib * 1024};
+        for (size_t i = 0; i < opts.files; ++i) {
+            const size_t d = i % volume.dirs.size();
+            const auto dir_cluster = volume.dirs[d] == 0 ? builder.RootCluster() : volume.dirs[d];
+            const std::string name = "file " + std::to_string(i) + ".dat";
+            const size_t size = size_dist(rng);
+            if (!builder.AddFile(dir_cluster, name, size)) {
+                fprintf(stderr, "volume full after %zu files\n", i);
+                break;
+            }
+            volume.files.push_back({dir_paths[d] + name, size});
+        }
+        return volume;
+    }
+
+    // mismatch reports the first byte of `buf` that differs from the pattern
+    bool mismatch(const FileInfo &file, const fat::DirectoryEntry &entry,
+                  size_t offset, const uint8_t *buf, size_t len) {
+        for (size_t i = 0; i < len; ++i) {
+            if (buf[i] != ImageBuilder::PatternByte(entry.FirstCluster(), offset + i)) {
+                fprintf(stderr, "%s: wrong data at offset %zu\n", file.path.c_str(), offset + i);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // verify reads every file once through a descriptor and at random offsets,
+    // and compares the data with the pattern written by ImageBuilder
+    void verify(const Volume &volume, const std::vector<fat::DirectoryEntry *> &entries,
+                const Options &opts) {
+        std::vector<uint8_t> buf(64 * 1024);
+        for (size_t i = 0; i < entries.size(); ++i) {
+            const auto &file = volume.files[i];
+            fat::FileDescriptor fd{*entries[i]};
+            size_t offset = 0;
+            while (auto n = fd.Read(&buf[0], buf.size())) {
+                if (mismatch(file, *entries[i], offset, &buf[0], n)) {
+                    exit(1);
+                }
+                offset += n;
+            }
+            if (offset != file.size) {
+                fprintf(stderr, "%s: read %zu bytes, expected %zu\n", file.path.c_str(), offset, file.size);
+                exit(1);
+            }
+        }
+
+        std::mt19937 rng{opts.seed + 1};
+        std::uniform_int_distribution<size_t> file_dist{0, entries.size() - 1};
+        for (size_t i = 0; i < opts.random_reads; ++i) {
+            const size_t f = file_dist(rng);
+            const auto entry = entries[f];
+            const size_t offset = entry->file_size ? rng() % entry->file_size : 0;
+            const size_t n = fat::ReadFile(*entry, offset, &buf[0], 4096);
+            if (n != std::min<size_t>(4096, entry->file_size - offset) ||
+                mismatch(volume.files[f], *entry, offset, &buf[0], n)) {
+                exit(1);
+            }
+        }
+    }
+
+    // run returns timings of one device: mount (ms), lookups (us), listing (ms), reads
+    std::vector<double> run(block::Device &device, const Volume &volume, const Options &opts) {
+        std::vector<double> result;
+
+        const double mount = seconds([&] {
+            for (int i = 0; i < opts.repeat; ++i) {
+                fat::Initialize(device);
+            }
+        });
+        result.push_back(mount / opts.repeat * 1e3);
+
+        // cold: directories are read into the dentry cache on the way
+        fat::Initialize(device);
+        const auto lookup = [&] {
+            for (const auto &file : volume.files) {
+                if (!fat::FindFile(file.path.c_str())) {
+                    fprintf(stderr, "not found: %s\n", file.path.c_str());
+                    exit(1);
+                }
+            }
+        };
+        result.push_back(seconds(lookup) / volume.files.size() * 1e6);
+        result.push_back(seconds([&] {
+            for (int i = 0; i < opts.repeat; ++i) {
+                lookup();
+            }
+        }) / (volume.files.size() * opts.repeat) * 1e6);
+
+        fat::Initialize(device);
+        const auto list = [&] {
+            for (auto dir : volume.dirs) {
+                for (const auto &item : fat::ReadDirectory(dir)) {
+                    checksum += item.name.size();
+                }
+            }
+        };
+        result.push_back(seconds(list) * 1e3);
+        result.push_back(seconds(list) * 1e3);
+
+        // sequential: every file through a descriptor
+        std::vector<fat::DirectoryEntry *> entries;
+        size_t total_bytes = 0;
+        for (const auto &file : volume.files) {
+            entries.push_back(fat::FindFile(file.path.c_str()));
+            total_bytes += file.size;
+        }
+        std::vector<uint8_t> buf(64 * 1024);
+        const double seq = seconds([&] {
+            for (auto entry : entries) {
+                fat::FileDescriptor fd{*entry};
+                while (auto n = fd.Read(&buf[0], buf.size())) {
+                    checksum += buf[n - 1];
+                }
+            }
+        });
+        result.push_back(total_bytes / seq / (1024 * 1024));
+
+        // random: 4 KiB at random offsets of random files
+        std::mt19937 rng{opts.seed};
+        std::uniform_int_distribution<size_t> file_dist{0, entries.size() - 1};
+        const double rand_read = seconds([&] {
+            for (size_t i = 0; i < opts.random_reads; ++i) {
+                const auto entry = entries[file_dist(rng)];
+                const size_t offset = entry->file_size ? rng() % entry->file_size : 0;
+                checksum += fat::ReadFile(*entry, offset, &buf[0], 4096);
+            }
+        });
+        result.push_back(opts.random_reads / rand_read / 1e3);
+
+        const auto stat = fat::CacheStat();
+        result.push_back(stat.hits + stat.misses ?
+            100.0 * stat.hits / (stat.hits + stat.misses) : 100.0);
+
+        // not timed, and after the stats so that it doesn't warm the caches
+        verify(volume, entries, opts);
+        return result;
+    }
+
+    void usage(const char *argv0) {
+        fprintf(stderr,
+            "usage: %s [-s image MiB] [-c sectors per cluster] [-n files] [-d depth]\n"
+            "          [-w directory fanout] [-f fragment ratio 0-1] [-m max file KiB]\n"
+            "          [-r repeat] [-x random reads] [-S seed]\n", argv0);
+        exit(2);
+    }
+}
+
+int main(int argc, char **argv) {
+    Options opts;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:c:n:d:w:f:m:r:x:S:h")) != -1) {
+        switch (opt) {
+        case 's': opts.image_mib = strtoul(optarg, nullptr, 0); break;
+        case 'c': opts.sectors_per_cluster = atoi(optarg); break;
+        case 'n': opts.files = strtoul(optarg, nullptr, 0); break;
+        case 'd': opts.depth = atoi(optarg); break;
+        case 'w': opts.fanout = atoi(optarg); break;
+        case 'f': opts.fragment = atof(optarg); break;
+        case 'm': opts.max_file_kib = strtoul(optarg, nullptr, 0); break;
+        case 'r': opts.repeat = atoi(optarg); break;
+        case 'x': opts.random_reads = strtoul(optarg, nullptr, 0); break;
+        case 'S': opts.seed = strtoul(optarg, nullptr, 0); break;
+        default: usage(argv[0]);
+        }
+    }
+    if (opts.sectors_per_cluster <= 0 || opts.repeat <= 0 || opts.files == 0) {
+        usage(argv[0]);
+    }
+
+    ImageBuilder builder{opts.image_mib * 1024 * 1024, opts.sectors_per_cluster, opts.fragment, opts.seed};
+    const auto volume = build(builder, opts);
+    printf("image %zu MiB, %d B/cluster, %zu files, %zu dirs, depth %d, fragment %.2f, %zu clusters used\n",
+        opts.image_mib, opts.sectors_per_cluster * 512, volume.files.size(), volume.dirs.size(),
+        opts.depth, opts.fragment, builder.UsedClusters());
+
+    block::RamDisk ram_disk{&builder.Image()[0], builder.Image().size() / block::kSectorBytes};
+    MemoryDisk memory_disk{builder.Image()};
+    const auto resident = run(ram_disk, volume, opts);
+    const auto cached = run(memory_disk, volume, opts);
+
+    const char *rows[] = {
+        "mount (ms)",
+        "lookup cold (us)",
+        "lookup warm (us)",
+        "list cold (ms)",
+        "list warm (ms)",
+        "sequential (MiB/s)",
+        "random 4K (kops/s)",
+        "block cache hit (%)",
+    };
+    printf("%-22s %12s %12s\n", "", "resident", "cached");
+    for (size_t i = 0; i < sizeof(rows) / sizeof(rows[0]); ++i) {
+        printf("%-22s %12.3f %12.3f\n", rows[i], resident[i], cached[i]);
+    }
+    printf("checksum %lx\n", static_cast<unsigned long>(checksum));
+}
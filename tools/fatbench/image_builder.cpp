@@ -0,0 +1,199 @@
+#include "image_builder.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <map>
+
+#include "fat.hpp"
+
+namespace {
+    const size_t kReservedSectors = 32;
+    const int kNumFATs = 2;
+    const uint32_t kEndOfChain = 0x0fffffff;
+
+    uint8_t shortNameChecksum(const unsigned char *name) {
+        uint8_t sum = 0;
+        for (int i = 0; i < 11; ++i) {
+            sum = ((sum & 1) ? 0x80 : 0) + (sum >> 1) + name[i];
+        }
+        return sum;
+    }
+
+    // next free slot of each directory
+    std::map<uint32_t, size_t> dir_slots;
+}
+
+ImageBuilder::ImageBuilder(size_t bytes, int sectors_per_cluster, double fragment, unsigned int seed)
+    : image_(bytes), bytes_per_cluster_{bytes_per_sector_ * sectors_per_cluster},
+      fragment_{fragment}, rng_{seed} {
+    dir_slots.clear();
+
+    const size_t total_sectors = bytes / bytes_per_sector_;
+    // each fat sector covers 128 clusters
+    const size_t fat_size = (total_sectors - kReservedSectors + sectors_per_cluster * 128 + 1) /
+        (sectors_per_cluster * 128 + 2);
+    const size_t data_sector = kReservedSectors + kNumFATs * fat_size;
+    data_offset_ = data_sector * bytes_per_sector_;
+    cluster_count_ = std::min((total_sectors - data_sector) / sectors_per_cluster, fat_size * 128 - 2);
+    used_.resize(cluster_count_ + 2);
+    used_[0] = used_[1] = true;
+
+    auto bpb = reinterpret_cast<fat::BPB *>(&image_[0]);
+    memcpy(bpb->jump_boot, "\xeb\x58\x90", 3);
+    memcpy(bpb->oem_name, "FATBENCH", 8);
+    bpb->bytes_per_sector = bytes_per_sector_;
+    bpb->sectors_per_cluster = sectors_per_cluster;
+    bpb->reserved_sector_count = kReservedSectors;
+    bpb->num_fats = kNumFATs;
+    bpb->media = 0xf8;
+    bpb->total_sectors_32 = total_sectors;
+    bpb->fat_size_32 = fat_size;
+    bpb->root_cluster = RootCluster();
+    bpb->fs_info = 1;
+    bpb->boot_signature = 0x29;
+    memcpy(bpb->volume_label, "BENCH      ", 11);
+    memcpy(bpb->fs_type, "FAT32   ", 8);
+    image_[510] = 0x55;
+    image_[511] = 0xaa;
+
+    auto fsinfo = reinterpret_cast<uint32_t *>(&image_[bytes_per_sector_]);
+    fsinfo[0] = 0x41615252;
+    fsinfo[121] = 0x61417272;
+    fsinfo[122] = 0xffffffff; // free count unknown
+    fsinfo[123] = 0xffffffff;
+    fsinfo[127] = 0xaa550000;
+
+    fat()[0] = 0x0ffffff8;
+    fat()[1] = kEndOfChain;
+    // root directory
+    allocate(0);
+}
+
+uint32_t ImageBuilder::allocate(uint32_t last) {
+    if (used_count_ + 2 >= used_.size()) {
+        return 0;
+    }
+
+    uint32_t c = 0;
+    if (last != 0 && std::uniform_real_distribution<>{}(rng_) < fragment_) {
+        // a few tries at a random place, then fall back to the next one
+        std::uniform_int_distribution<uint32_t> dist{2, cluster_count_ + 1};
+        for (int i = 0; i < 8 && c == 0; ++i) {
+            const auto candidate = dist(rng_);
+            if (!used_[candidate]) {
+                c = candidate;
+            }
+        }
+    }
+    if (c == 0) {
+        while (used_[next_]) {
+            next_ = next_ + 1 < used_.size() ? next_ + 1 : 2;
+        }
+        c = next_;
+    }
+
+    used_[c] = true;
+    ++used_count_;
+    fat()[c] = kEndOfChain;
+    if (last != 0) {
+        fat()[last] = c;
+    }
+    memset(cluster(c), 0, bytes_per_cluster_);
+    return c;
+}
+
+bool ImageBuilder::addEntry(uint32_t dir_cluster, const std::string &name, uint8_t attr,
+                            uint32_t first_cluster, uint32_t size) {
+    // short name is a unique serial, the real name is in the long name entries
+    fat::DirectoryEntry entry{};
+    char short_name[12];
+    snprintf(short_name, sizeof(short_name), "N%07X   ", short_name_seq_++);
+    memcpy(entry.name, short_name, 11);
+    entry.attr = static_cast<fat::Attribute>(attr);
+    entry.first_cluster_low = first_cluster & 0xffff;
+    entry.first_cluster_high = first_cluster >> 16;
+    entry.file_size = size;
+
+    std::vector<fat::DirectoryEntry> entries;
+    const size_t num_lfn = (name.size() + 12) / 13;
+    const uint8_t checksum = shortNameChecksum(entry.name);
+    for (size_t i = num_lfn; i-- > 0;) {
+        uint16_t chars[13];
+        for (size_t j = 0; j < 13; ++j) {
+            const size_t k = i * 13 + j;
+            chars[j] = k < name.size() ? name[k] : (k == name.size() ? 0 : 0xffff);
+        }
+
+        fat::LongNameEntry lfn{};
+        lfn.ord = (i + 1) | (i + 1 == num_lfn ? 0x40 : 0);
+        lfn.attr = fat::Attribute::kLongName;
+        lfn.checksum = checksum;
+        memcpy(lfn.name1, &chars[0], sizeof(lfn.name1));
+        memcpy(lfn.name2, &chars[5], sizeof(lfn.name2));
+        memcpy(lfn.name3, &chars[11], sizeof(lfn.name3));
+        entries.push_back(reinterpret_cast<const fat::DirectoryEntry &>(lfn));
+    }
+    entries.push_back(entry);
+
+    const size_t entries_per_cluster = bytes_per_cluster_ / sizeof(fat::DirectoryEntry);
+    auto &slot = dir_slots[dir_cluster];
+    for (const auto &e : entries) {
+        // walk to the cluster of the slot, growing the directory
+        uint32_t c = dir_cluster;
+        for (size_t i = 0; i < slot / entries_per_cluster; ++i) {
+            c = fat()[c] == kEndOfChain ? allocate(c) : fat()[c];
+            if (c == 0) {
+                return false;
+            }
+        }
+        memcpy(cluster(c) + (slot % entries_per_cluster) * sizeof(e), &e, sizeof(e));
+        ++slot;
+    }
+    return true;
+}
+
+uint32_t ImageBuilder::MakeDirectory(uint32_t dir_cluster, const std::string &name) {
+    const uint32_t c = allocate(0);
+    if (c == 0) {
+        return 0;
+    }
+
+    const uint32_t parent = dir_cluster == RootCluster() ? 0 : dir_cluster;
+    auto dot = reinterpret_cast<fat::DirectoryEntry *>(cluster(c));
+    memcpy(dot[0].name, ".          ", 11);
+    dot[0].attr = fat::Attribute::kDirectory;
+    dot[0].first_cluster_low = c & 0xffff;
+    dot[0].first_cluster_high = c >> 16;
+    memcpy(dot[1].name, "..         ", 11);
+    dot[1].attr = fat::Attribute::kDirectory;
+    dot[1].first_cluster_low = parent & 0xffff;
+    dot[1].first_cluster_high = parent >> 16;
+    dir_slots[c] = 2;
+
+    if (!addEntry(dir_cluster, name, 0x10, c, 0)) {
+        return 0;
+    }
+    return c;
+}
+
+bool ImageBuilder::AddFile(uint32_t dir_cluster, const std::string &name, size_t size) {
+    uint32_t first = 0, last = 0;
+    for (size_t done = 0; done < size; done += bytes_per_cluster_) {
+        last = allocate(last);
+        if (last == 0) {
+            return false;
+        }
+        if (first == 0) {
+            first = last;
+        }
+
+        auto p = cluster(last);
+        const size_t n = std::min(bytes_per_cluster_, size - done);
+        for (size_t i = 0; i < n; ++i) {
+            p[i] = PatternByte(first, done + i);
+        }
+    }
+
+    return addEntry(dir_cluster, name, 0x20, first, size);
+}
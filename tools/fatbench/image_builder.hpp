@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+// ImageBuilder makes a FAT32 volume image in memory
+class ImageBuilder {
+public:
+    // `fragment` is the probability that a cluster of a file is not placed
+    // right after the previous one
+    ImageBuilder(size_t bytes, int sectors_per_cluster, double fragment, unsigned int seed);
+
+    uint32_t RootCluster() const { return 2; }
+    // MakeDirectory creates a directory in the directory and returns its cluster
+    uint32_t MakeDirectory(uint32_t dir_cluster, const std::string &name);
+    // AddFile creates a file filled with a pattern derived from its first cluster
+    bool AddFile(uint32_t dir_cluster, const std::string &name, size_t size);
+    // PatternByte is the byte AddFile writes at `offset` of the file
+    static uint8_t PatternByte(uint32_t first_cluster, size_t offset) {
+        return offset * 131 + first_cluster;
+    }
+
+    std::vector<uint8_t> &Image() { return image_; }
+    size_t UsedClusters() const { return used_count_; }
+
+private:
+    std::vector<uint8_t> image_;
+    size_t bytes_per_sector_{512}, bytes_per_cluster_;
+    size_t data_offset_;
+    uint32_t cluster_count_;
+    std::vector<bool> used_;
+    size_t used_count_{0};
+    uint32_t next_{2};
+    double fragment_;
+    std::mt19937 rng_;
+    uint32_t short_name_seq_{0};
+
+    uint32_t *fat() { return reinterpret_cast<uint32_t *>(&image_[32 * bytes_per_sector_]); }
+    uint8_t *cluster(uint32_t c) { return &image_[data_offset_ + (c - 2) * bytes_per_cluster_]; }
+    // allocate links a free cluster after `last` (0 starts a chain). Returns 0 when full.
+    uint32_t allocate(uint32_t last);
+    bool addEntry(uint32_t dir_cluster, const std::string &name, uint8_t attr,
+                  uint32_t first_cluster, uint32_t size);
+};
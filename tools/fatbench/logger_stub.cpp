@@ -0,0 +1,12 @@
+// fat.cpp logs through the kernel logger, which is not needed on the host
+#include "logger.hpp"
+
+void SetLogLevel(LogLevel level) {}
+
+int Log(LogLevel level, const char* format, ...) {
+    return 0;
+}
+
+int Log(LogSubsystem subsystem, LogLevel level, const char* format, ...) {
+    return 0;
+}
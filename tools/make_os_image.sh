@@ -42,5 +42,13 @@ then
   sudo cp $MIKANOS_DIR/$RESOURCE_DIR/* $MOUNT_POINT/
 fi
 
+if [ "$FAT_DISK" != "" ]
+then
+  # a raw volume image for the kernel, compressed to cut the read at boot
+  python3 "$(dirname "$0")/compress_volume.py" "$FAT_DISK" -o ./fat_disk.lz4
+  sudo cp ./fat_disk.lz4 $MOUNT_POINT/fat_disk
+  rm ./fat_disk.lz4
+fi
+
 sleep 0.5
 sudo umount $MOUNT_POINT
@@ -0,0 +1,174 @@
+#!/usr/bin/python3
+
+# Decode a kernel trace dump (src/kernel/trace.hpp) into the Chrome trace
+# event format, for chrome://tracing or https://ui.perfetto.dev.
+#
+# Take the dump with the terminal command `trace dump`, with QEMU started
+# with `-debugcon file:trace.bin`. `trace dump serial` writes it to COM1
+# instead, for `-serial file:trace.bin`. Other output in the file is skipped.
+
+import argparse
+import json
+import struct
+import sys
+
+
+MAGIC = b'MIKANTRC'
+VERSION = 1
+HEADER = struct.Struct('<8sIIQII')
+CPU_HEADER = struct.Struct('<II')
+RECORD = struct.Struct('<QHHIQ')
+
+TASK_SWITCH = 1
+TIMER_TICK = 2
+TIMER_EXPIRE = 3
+SOFTIRQ_BEGIN = 4
+SOFTIRQ_END = 5
+DRAW_BEGIN = 6
+DRAW_END = 7
+XHCI_EVENT = 8
+
+SOFTIRQS = ['timer', 'xhci input', 'xhci']
+TRB_TYPES = {32: 'transfer', 33: 'command completion', 34: 'port status change'}
+AREA_ID = 0xffffffff
+
+# tracks (threads in the trace viewer) of each CPU
+TRACKS = ['tasks', 'softirq', 'draw', 'events']
+
+
+def parse(data: bytes, index: int):
+    """returns (tsc_freq, {cpu: [records]}) of the dump at `index` in the file"""
+    offsets = []
+    pos = data.find(MAGIC)
+    while pos >= 0:
+        offsets.append(pos)
+        pos = data.find(MAGIC, pos + 1)
+    if not offsets:
+        raise ValueError('no trace dump found')
+    pos = offsets[index]
+
+    magic, version, record_bytes, tsc_freq, cpus, _ = HEADER.unpack_from(data, pos)
+    if version != VERSION or record_bytes != RECORD.size:
+        raise ValueError(f'unsupported dump: version {version}, record {record_bytes} bytes')
+    pos += HEADER.size
+
+    records = {}
+    for _ in range(cpus):
+        cpu, count = CPU_HEADER.unpack_from(data, pos)
+        pos += CPU_HEADER.size
+        end = pos + count * RECORD.size
+        if end > len(data):
+            raise ValueError(f'dump is truncated at cpu {cpu}')
+        records[cpu] = [RECORD.unpack_from(data, p) for p in range(pos, end, RECORD.size)]
+        pos = end
+    return tsc_freq, records
+
+
+def tid(cpu: int, track: str) -> int:
+    return cpu * len(TRACKS) + TRACKS.index(track)
+
+
+def convert(tsc_freq: int, records) -> dict:
+    if tsc_freq == 0:
+        raise ValueError('TSC frequency is not calibrated')
+    starts = [r[0][0] for r in records.values() if r]
+    base = min(starts) if starts else 0
+
+    def us(tsc):
+        return (tsc - base) * 1e6 / tsc_freq
+
+    events = [{'name': 'process_name', 'ph': 'M', 'pid': 0, 'args': {'name': 'MikanOS'}}]
+    for cpu, recs in records.items():
+        if not recs:
+            continue
+        for track in TRACKS:
+            events.append({'name': 'thread_name', 'ph': 'M', 'pid': 0, 'tid': tid(cpu, track),
+                           'args': {'name': f'cpu{cpu} {track}'}})
+
+        # the task running at the first record is unknown until it switches away
+        task, task_start = None, us(recs[0][0])
+        # begin records whose ends are not seen yet, by track
+        open_slices = {'softirq': 0, 'draw': 0}
+
+        def begin(track, name, ts, args):
+            open_slices[track] += 1
+            events.append({'name': name, 'ph': 'B', 'ts': ts, 'pid': 0,
+                           'tid': tid(cpu, track), 'args': args})
+
+        def end(track, ts):
+            # the begin may be overwritten in the ring
+            if open_slices[track] > 0:
+                open_slices[track] -= 1
+                events.append({'ph': 'E', 'ts': ts, 'pid': 0, 'tid': tid(cpu, track)})
+
+        def instant(name, ts, args):
+            events.append({'name': name, 'ph': 'i', 's': 't', 'ts': ts, 'pid': 0,
+                           'tid': tid(cpu, 'events'), 'args': args})
+
+        for tsc, event, _, arg0, arg1 in recs:
+            ts = us(tsc)
+            if event == TASK_SWITCH:
+                events.append({'name': f'task {arg0}', 'ph': 'X', 'ts': task_start,
+                               'dur': ts - task_start, 'pid': 0, 'tid': tid(cpu, 'tasks')})
+                task, task_start = arg1, ts
+            elif event == TIMER_TICK:
+                instant('tick', ts, {'tick': arg0})
+            elif event == TIMER_EXPIRE:
+                instant('timer expire', ts, {'tick': arg0})
+            elif event == SOFTIRQ_BEGIN:
+                name = SOFTIRQS[arg0] if arg0 < len(SOFTIRQS) else f'softirq {arg0}'
+                begin('softirq', name, ts, {})
+            elif event == SOFTIRQ_END:
+                end('softirq', ts)
+            elif event == DRAW_BEGIN:
+                width, height = arg1 >> 32, arg1 & 0xffffffff
+                size = 'whole' if width == 0xffffffff else f'{width}x{height}'
+                name = 'draw area' if arg0 == AREA_ID else f'draw layer {arg0}'
+                begin('draw', name, ts, {'size': size})
+            elif event == DRAW_END:
+                end('draw', ts)
+            elif event == XHCI_EVENT:
+                instant(f'xhci {TRB_TYPES.get(arg0, arg0)}', ts, {'interrupter': arg1})
+            else:
+                instant(f'event {event}', ts, {'arg0': arg0, 'arg1': arg1})
+
+        last = us(recs[-1][0])
+        if task is not None:
+            events.append({'name': f'task {task}', 'ph': 'X', 'ts': task_start,
+                           'dur': last - task_start, 'pid': 0, 'tid': tid(cpu, 'tasks')})
+        for track, depth in open_slices.items():
+            for _ in range(depth):
+                events.append({'ph': 'E', 'ts': last, 'pid': 0, 'tid': tid(cpu, track)})
+
+    return {'traceEvents': events, 'displayTimeUnit': 'ns'}
+
+
+def main():
+    parser = argparse.ArgumentParser(description='decode a MikanOS trace dump to Chrome trace JSON')
+    parser.add_argument('dump', help='file written by QEMU debugcon or serial')
+    parser.add_argument('-o', '--output', help='output JSON (default: stdout)')
+    parser.add_argument('-n', '--index', type=int, default=-1,
+                        help='which dump in the file, 0 for the first (default: the last)')
+    args = parser.parse_args()
+
+    with open(args.dump, 'rb') as f:
+        data = f.read()
+    try:
+        tsc_freq, records = parse(data, args.index)
+        trace = convert(tsc_freq, records)
+    except (ValueError, IndexError, struct.error) as e:
+        print(f'{args.dump}: {e}', file=sys.stderr)
+        return 1
+
+    total = sum(len(r) for r in records.values())
+    print(f'{total} records, TSC {tsc_freq / 1e6:.0f} MHz', file=sys.stderr)
+    if args.output:
+        with open(args.output, 'w') as f:
+            json.dump(trace, f)
+    else:
+        json.dump(trace, sys.stdout)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())